@@ -26,6 +26,8 @@
 
 #include <ladspa.h>
 #include "ladspa_utils.h"
+#include "ladspa_index.h"
+#include "stats.h"
 
 typedef struct snd_ctl_iemladspa_control {
   long min;
@@ -35,13 +37,53 @@ typedef struct snd_ctl_iemladspa_control {
 
 typedef struct snd_ctl_iemladspa {
   snd_ctl_ext_t ext;
-  void *library;
+  void *library;                  /* (NULL: the controls file describes the plugin) */
   const LADSPA_Descriptor *klass;
   int num_input_controls;
   LADSPA_Control *control_data;
   snd_ctl_iemladspa_control_t *control_info;
+  char *stats_name;
+  stats_t *stats;          /* (mapped once the PCM has published anything) */
+  char *persist;           /* the controls file to write the settings back to
+                            * (NULL: the controls are mapped from it directly) */
+  unsigned int persisted;  /* the settings' sequence number when they were last written back */
+  char *notify;            /* the object the controls are mapped from (touched after changing them) */
+  long *reported;          /* the values of the elements, as last reported (see iemladspa_read_event()) */
+  unsigned char *changed;  /* the elements whose change is yet to be reported */
 } snd_ctl_iemladspa_t;
 
+/* besides the LADSPA controls, there is a switch to bypass the plugin
+ * and a (read-only) display of the delay through the PCM
+ * (they come after them, so the keys of the LADSPA controls stay the same) */
+#define BYPASS_NAME "Bypass"
+#define IS_BYPASS(iemladspa, key) ((int)(key) == (iemladspa)->num_input_controls)
+#define LATENCY_NAME "Latency"
+#define IS_LATENCY(iemladspa, key) ((int)(key) == (iemladspa)->num_input_controls + 1)
+#define LATENCY_MAX 0x7fffffff
+#define LOAD_NAME "DSP Load"
+#define IS_LOAD(iemladspa, key) ((int)(key) == (iemladspa)->num_input_controls + 2)
+#define IS_READONLY(iemladspa, key) (IS_LATENCY(iemladspa, key) || IS_LOAD(iemladspa, key))
+#define LOAD_MAX 100
+/* elements that send change events (all but the DSP load, which changes all the time) */
+#define NUM_EVENTS(iemladspa) ((iemladspa)->num_input_controls + 2)
+
+/* the time the PCM spent on its last period, in percent of the period's duration
+ * (of the stream that runs the plugin, which is the busier one) */
+static long iemladspa_load(snd_ctl_iemladspa_t *iemladspa)
+{
+  stats_stream_t copy;
+  unsigned int stream, load = 0;
+  if(!iemladspa->stats && iemladspa->stats_name)
+    iemladspa->stats = stats_map(iemladspa->stats_name, 0);
+  if(!iemladspa->stats)
+    return 0;
+  for(stream = 0; stream < 2; stream++)
+    if(stats_read(iemladspa->stats, stream, &copy) && copy.load > load)
+      load = copy.load;
+  load /= 10;
+  return (load < LOAD_MAX)?load:LOAD_MAX;
+}
+
 static void iemladspa_close(snd_ctl_ext_t *ext)
 {
   snd_ctl_iemladspa_t *iemladspa = ext->private_data;
@@ -50,15 +92,29 @@ static void iemladspa_close(snd_ctl_ext_t *ext)
     free(iemladspa->control_info[i].name);
   }
   free(iemladspa->control_info);
+  stats_unmap(iemladspa->stats);
+  free(iemladspa->stats_name);
+  /* the controls live in shared memory: write back what we changed
+   * (the PCM does so as well, but it might not be running) */
+  if(iemladspa->persist && __atomic_load_n(&LADSPAcontrolInput(iemladspa->control_data)->seq,
+                                           __ATOMIC_ACQUIRE) != iemladspa->persisted)
+    LADSPAcontrolPersist(iemladspa->control_data, iemladspa->persist, &iemladspa->persisted);
+  free(iemladspa->persist);
+  free(iemladspa->notify);
+  free(iemladspa->reported);
+  free(iemladspa->changed);
+  if(iemladspa->ext.poll_fd >= 0)
+    close(iemladspa->ext.poll_fd);
   LADSPAcontrolUnMMAP(iemladspa->control_data);
-  LADSPAunload(iemladspa->library);
+  if(iemladspa->library)
+    LADSPAunload(iemladspa->library);
   free(iemladspa);
 }
 
 static int iemladspa_elem_count(snd_ctl_ext_t *ext)
 {
   snd_ctl_iemladspa_t *iemladspa = ext->private_data;
-  return iemladspa->num_input_controls;
+  return iemladspa->num_input_controls + 3;
 }
 
 static int iemladspa_elem_list(snd_ctl_ext_t *ext, unsigned int offset,
@@ -66,7 +122,14 @@ static int iemladspa_elem_list(snd_ctl_ext_t *ext, unsigned int offset,
 {
   snd_ctl_iemladspa_t *iemladspa = ext->private_data;
   snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
-  snd_ctl_elem_id_set_name(id, iemladspa->control_info[offset].name);
+  if(IS_BYPASS(iemladspa, offset))
+    snd_ctl_elem_id_set_name(id, BYPASS_NAME);
+  else if(IS_LATENCY(iemladspa, offset))
+    snd_ctl_elem_id_set_name(id, LATENCY_NAME);
+  else if(IS_LOAD(iemladspa, offset))
+    snd_ctl_elem_id_set_name(id, LOAD_NAME);
+  else
+    snd_ctl_elem_id_set_name(id, iemladspa->control_info[offset].name);
   snd_ctl_elem_id_set_device(id, offset);
   return 0;
 }
@@ -79,6 +142,12 @@ static snd_ctl_ext_key_t iemladspa_find_elem(snd_ctl_ext_t *ext,
   unsigned int i, key;
 
   name = snd_ctl_elem_id_get_name(id);
+  if (!strcmp(name, BYPASS_NAME))
+    return iemladspa->num_input_controls;
+  if (!strcmp(name, LATENCY_NAME))
+    return iemladspa->num_input_controls + 1;
+  if (!strcmp(name, LOAD_NAME))
+    return iemladspa->num_input_controls + 2;
 
   for (i = 0; i < iemladspa->num_input_controls; i++) {
     key = i;
@@ -93,8 +162,9 @@ static snd_ctl_ext_key_t iemladspa_find_elem(snd_ctl_ext_t *ext,
 static int iemladspa_get_attribute(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
                                    int *type, unsigned int *acc, unsigned int *count)
 {
-  *type = SND_CTL_ELEM_TYPE_INTEGER;
-  *acc = SND_CTL_EXT_ACCESS_READWRITE;
+  snd_ctl_iemladspa_t *iemladspa = ext->private_data;
+  *type = IS_BYPASS(iemladspa, key)?SND_CTL_ELEM_TYPE_BOOLEAN:SND_CTL_ELEM_TYPE_INTEGER;
+  *acc = IS_READONLY(iemladspa, key)?SND_CTL_EXT_ACCESS_READ:SND_CTL_EXT_ACCESS_READWRITE;
   *count = 1;
   return 0;
 }
@@ -102,9 +172,10 @@ static int iemladspa_get_attribute(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
 static int iemladspa_get_integer_info(snd_ctl_ext_t *ext,
                                       snd_ctl_ext_key_t key, long *imin, long *imax, long *istep)
 {
+  snd_ctl_iemladspa_t *iemladspa = ext->private_data;
   *istep = 1;
   *imin = 0;
-  *imax = 100;
+  *imax = IS_LATENCY(iemladspa, key)?LATENCY_MAX:IS_LOAD(iemladspa, key)?LOAD_MAX:100;
   return 0;
 }
 
@@ -113,7 +184,23 @@ static int iemladspa_read_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
                                   long *value)
 {
   snd_ctl_iemladspa_t *iemladspa = ext->private_data;
-  LADSPA_Data v = iemladspa->control_data->data[key].data;
+  LADSPA_Data v;
+
+  if (IS_BYPASS(iemladspa, key)) {
+    value[0] = !!__atomic_load_n(&LADSPAcontrolInput(iemladspa->control_data)->bypass, __ATOMIC_RELAXED);
+    return sizeof(long);
+  }
+  if (IS_LATENCY(iemladspa, key)) {
+    /* in frames (as published by the PCM) */
+    const unsigned long latency = LADSPAcontrolOutput(iemladspa->control_data)->latency;
+    value[0] = (latency < LATENCY_MAX)?(long)latency:LATENCY_MAX;
+    return sizeof(long);
+  }
+  if (IS_LOAD(iemladspa, key)) {
+    value[0] = iemladspa_load(iemladspa);
+    return sizeof(long);
+  }
+  v = LADSPAcontrolInput(iemladspa->control_data)->value[key];
 
   if (iemladspa->control_info[key].max == iemladspa->control_info[key].min) {
     value[0]= v * 100;
@@ -133,24 +220,59 @@ static int iemladspa_write_integer(snd_ctl_ext_t *ext, snd_ctl_ext_key_t key,
   snd_ctl_iemladspa_t *iemladspa = ext->private_data;
   float setting;
 
+  if (IS_BYPASS(iemladspa, key)) {
+    LADSPAcontrolBypass(iemladspa->control_data, !!value[0]);
+    if(iemladspa->notify)
+      LADSPAcontrolNotify(iemladspa->notify);
+    return 1;
+  }
+  if (IS_READONLY(iemladspa, key))
+    return -EPERM;
   setting = value[0];
   if (iemladspa->control_info[key].max == iemladspa->control_info[key].min) {
-    iemladspa->control_data->data[key].data = (setting/100);
+    setting = (setting/100);
   } else {
-    iemladspa->control_data->data[key].data = (setting/100)*
+    setting = (setting/100)*
       (iemladspa->control_info[key].max-
        iemladspa->control_info[key].min)+
       iemladspa->control_info[key].min;
   }
+  LADSPAcontrolWrite(iemladspa->control_data, key, setting);
+  if(iemladspa->notify)
+    LADSPAcontrolNotify(iemladspa->notify);
 
   return 1;
 }
 
-static int iemladspa_read_event(snd_ctl_ext_t *ext ATTRIBUTE_UNUSED,
-                                snd_ctl_elem_id_t *id ATTRIBUTE_UNUSED,
-                                unsigned int *event_mask ATTRIBUTE_UNUSED)
+/* report the elements that have changed (one per call):
+ * whoever changes the controls touches them, which makes our poll_fd readable */
+static int iemladspa_read_event(snd_ctl_ext_t *ext, snd_ctl_elem_id_t *id,
+                                unsigned int *event_mask)
 {
-  return -EAGAIN;
+  snd_ctl_iemladspa_t *iemladspa = ext->private_data;
+  const int count = NUM_EVENTS(iemladspa);
+  long value;
+  int key;
+
+  /* look for new changes, once the last ones have been reported */
+  for(key = 0; key < count && !iemladspa->changed[key]; key++);
+  if(key == count && ext->poll_fd >= 0 && LADSPAcontrolWatched(ext->poll_fd)) {
+    for(key = 0; key < count; key++) {
+      iemladspa_read_integer(ext, key, &value);
+      if(value != iemladspa->reported[key]) {
+        iemladspa->reported[key] = value;
+        iemladspa->changed[key] = 1;
+      }
+    }
+    for(key = 0; key < count && !iemladspa->changed[key]; key++);
+  }
+  if(key == count)
+    return -EAGAIN;
+
+  iemladspa->changed[key] = 0;
+  iemladspa_elem_list(ext, key, id);
+  *event_mask = SND_CTL_EVENT_MASK_VALUE;
+  return 1;
 }
 
 static snd_ctl_ext_callback_t iemladspa_ext_callback = {
@@ -175,13 +297,17 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
   const char *configname = NULL;
   const char *controls = NULL;
   char *default_controls=NULL;
-  const char *library = "/usr/lib/ladspa/iemladspa.so";
-  const char *module = "iemladspa";
+  const char *library = NULL;
+  const char *module = NULL;
+  char *found_library = NULL, *found_module = NULL;
+  const char *label, *longname;
   int err, i, index;
 
   iemladspa_iochannels_t sourcechannels, sinkchannels;
   long inchannels = 2;
   long outchannels = 2;
+  int replicate = 0;
+  int backend = LADSPA_CNTRL_BACKEND_FILE;
 
   if (snd_config_get_id(conf, &configname) < 0)
     configname="alsaiemladspa";
@@ -222,12 +348,33 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
       }
       continue;
     }
+    if (strcmp(id, "replicate") == 0) {
+      replicate = snd_config_get_bool(n);
+      if(replicate < 0) {
+        SNDERR("replicate must be a boolean");
+        retval=-EINVAL; goto cleanup;
+      }
+      continue;
+    }
+    if (strcmp(id, "controls_backend") == 0) {
+      const char*str = NULL;
+      if(snd_config_get_string(n, &str) < 0 || (backend = LADSPAcontrolBackend(str)) < 0) {
+        SNDERR("controls_backend must be 'file' or 'shm'");
+        retval=-EINVAL; goto cleanup;
+      }
+      continue;
+    }
 
     SNDERR("Unknown field %s", id);
     retval=-EINVAL; goto cleanup;
   }
   sourcechannels.in = sourcechannels.out = inchannels;
   sinkchannels.in   = sinkchannels.out   = outchannels;
+  if(replicate) {
+    /* a mono plugin, copied for each channel of the PCM */
+    sourcechannels.in = sourcechannels.out = 1;
+    sinkchannels.in   = sinkchannels.out   = 0;
+  }
 
   if(!controls) {
     default_controls=(char*)calloc(strlen(configname)+5, 1);
@@ -240,6 +387,22 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
     controls=default_controls;
   }
 
+  /* without a module, it's the default plugin; without a library, the module
+   * (a label or a UniqueID) is looked up along the LADSPA_PATH */
+  if(!module) {
+    module = "iemladspa";
+    if(!library)
+      library = "/usr/lib/ladspa/iemladspa.so";
+  } else if(!library) {
+    err = ladspa_index_find(module, &found_library, &found_module);
+    if(err < 0) {
+      SNDERR("unable to find the LADSPA-plugin '%s' along the LADSPA_PATH", module);
+      retval=err; goto cleanup;
+    }
+    library = found_library;
+    module = found_module;
+  }
+
 
   /* Intialize the local object data */
   iemladspa = calloc(1, sizeof(*iemladspa));
@@ -253,37 +416,52 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
   iemladspa->ext.callback = &iemladspa_ext_callback;
   iemladspa->ext.private_data = iemladspa;
 
-  /* Open the LADSPA Plugin */
-  iemladspa->library = LADSPAload(library);
-  if(iemladspa->library == NULL) {
-    retval=-1; goto cleanup;
-  }
+  /* MMAP to the controls file: if it describes the plugin, that's all we need
+   * (loading the plugin just to look at its ports can be slow) */
+  iemladspa->control_data = LADSPAcontrolMMAPmeta(library, module, controls,
+                                                  sourcechannels, sinkchannels, backend);
+  if(iemladspa->control_data) {
+    label = LADSPAcontrolMeta(iemladspa->control_data)->label;
+    longname = LADSPAcontrolMeta(iemladspa->control_data)->name;
+  } else {
+    /* Open the LADSPA Plugin */
+    iemladspa->library = LADSPAload(library);
+    if(iemladspa->library == NULL) {
+      retval=-1; goto cleanup;
+    }
 
-  iemladspa->klass = LADSPAfind(iemladspa->library, library, module);
-  if(iemladspa->klass == NULL) {
-    retval=-1; goto cleanup;
+    iemladspa->klass = LADSPAfind(iemladspa->library, library, module);
+    if(iemladspa->klass == NULL) {
+      retval=-1; goto cleanup;
+    }
+
+    /* (this describes the plugin in the controls file, for the next time) */
+    iemladspa->control_data = LADSPAcontrolMMAP(iemladspa->klass, library, controls,
+                                                sourcechannels, sinkchannels, backend);
+    if(iemladspa->control_data == NULL) {
+      retval=-1; goto cleanup;
+    }
+    label = iemladspa->klass->Label;
+    longname = iemladspa->klass->Name;
   }
 
   /* Import data from the LADSPA Plugin */
-  strncpy(iemladspa->ext.id, iemladspa->klass->Label, sizeof(iemladspa->ext.id));
+  strncpy(iemladspa->ext.id, label, sizeof(iemladspa->ext.id));
   strncpy(iemladspa->ext.driver, "LADSPA Plugin", sizeof(iemladspa->ext.driver));
-  strncpy(iemladspa->ext.name, iemladspa->klass->Label, sizeof(iemladspa->ext.name));
-  strncpy(iemladspa->ext.longname, iemladspa->klass->Name,
+  strncpy(iemladspa->ext.name, label, sizeof(iemladspa->ext.name));
+  strncpy(iemladspa->ext.longname, longname,
           sizeof(iemladspa->ext.longname));
   strncpy(iemladspa->ext.mixername, "LADSPA ALSA", sizeof(iemladspa->ext.mixername));
-
-  /* Create the ALSA External Plugin */
-  err = snd_ctl_ext_create(&iemladspa->ext, name, SND_CTL_NONBLOCK);
-  if (err < 0) {
-    retval=-1; goto cleanup;
-  }
-
-  /* MMAP to the controls file */
-  iemladspa->control_data = LADSPAcontrolMMAP(iemladspa->klass, controls,
-                                              sourcechannels, sinkchannels);
-  if(iemladspa->control_data == NULL) {
-    retval=-1; goto cleanup;
+  if(LADSPA_CNTRL_BACKEND_SHM == backend) {
+    iemladspa->persist = LADSPAcontrolFilename(controls);
+    if(iemladspa->persist == NULL) {
+      retval=-1; goto cleanup;
+    }
+    iemladspa->persisted = __atomic_load_n(&LADSPAcontrolInput(iemladspa->control_data)->seq,
+                                           __ATOMIC_ACQUIRE);
   }
+  /* the PCM might not have been opened yet, so the statistics are mapped when needed */
+  iemladspa->stats_name = stats_name(controls);
 	
   iemladspa->num_input_controls = 0;
   for(i = 0; i < iemladspa->control_data->num_controls; i++) {
@@ -301,28 +479,36 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
 
   for(i = 0; i < iemladspa->num_input_controls; i++) {
     if(iemladspa->control_data->data[i].type == LADSPA_CNTRL_INPUT) {
+      const LADSPA_PortRangeHint *hint;
+      const char *portname;
       index = iemladspa->control_data->data[i].index;
-      if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
-         (LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL)) {
-	SNDERR("Problem with control file %s, %d.", controls, index);
-	retval=-1; goto cleanup;
+      if(iemladspa->klass) {
+        if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
+           (LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL)) {
+          SNDERR("Problem with control file %s, %d.", controls, index);
+          retval=-1; goto cleanup;
+        }
+        hint = &iemladspa->klass->PortRangeHints[index];
+        portname = iemladspa->klass->PortNames[index];
+      } else {
+        hint = &LADSPAcontrolMeta(iemladspa->control_data)->port[i].hint;
+        portname = LADSPAcontrolMeta(iemladspa->control_data)->port[i].name;
       }
-      iemladspa->control_info[i].min =
-        iemladspa->klass->PortRangeHints[index].LowerBound;
-      iemladspa->control_info[i].max =
-        iemladspa->klass->PortRangeHints[index].UpperBound;
+      iemladspa->control_info[i].min = hint->LowerBound;
+      iemladspa->control_info[i].max = hint->UpperBound;
 
-      iemladspa->control_info[i].name = strdup(iemladspa->klass->PortNames[index]);
+      iemladspa->control_info[i].name = strdup(portname);
       if(iemladspa->control_info[i].name == NULL) {
 	retval=-1; goto cleanup;
       }
     }
   }
 
-  /* Make sure that the control file makes sense */
+  /* Make sure that the control file makes sense
+   * (a description of the plugin has been checked when it was mapped) */
   const unsigned long offset_in = iemladspa->control_data->num_controls;
   const unsigned long offset_out = offset_in + iemladspa->control_data->num_inchannels;
-  for(i=0; i<iemladspa->control_data->num_inchannels; i++) {
+  for(i=0; iemladspa->klass && i<iemladspa->control_data->num_inchannels; i++) {
     unsigned int index=iemladspa->control_data->data[offset_in + i].index;
     if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
        (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
@@ -330,7 +516,7 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
       retval=-1; goto cleanup;
     }
   }
-  for(i=0; i<iemladspa->control_data->num_outchannels; i++) {
+  for(i=0; iemladspa->klass && i<iemladspa->control_data->num_outchannels; i++) {
     unsigned int index=iemladspa->control_data->data[offset_out + i].index;
 
     if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
@@ -340,11 +526,32 @@ SND_CTL_PLUGIN_DEFINE_FUNC(iemladspa)
     }
   }
 
+  /* what the elements look like now (changes are reported relative to that),
+   * and get woken up when somebody changes them */
+  iemladspa->reported = calloc(NUM_EVENTS(iemladspa), sizeof(long));
+  iemladspa->changed = calloc(NUM_EVENTS(iemladspa), 1);
+  if(iemladspa->reported == NULL || iemladspa->changed == NULL) {
+    retval=-ENOMEM; goto cleanup;
+  }
+  for(i = 0; i < NUM_EVENTS(iemladspa); i++)
+    iemladspa_read_integer(&iemladspa->ext, i, &iemladspa->reported[i]);
+  iemladspa->notify = LADSPAcontrolPath(controls, backend);
+  if(iemladspa->notify)
+    iemladspa->ext.poll_fd = LADSPAcontrolWatch(iemladspa->notify);
+
+  /* Create the ALSA External Plugin */
+  err = snd_ctl_ext_create(&iemladspa->ext, name, SND_CTL_NONBLOCK);
+  if (err < 0) {
+    retval=-1; goto cleanup;
+  }
+
   *handlep = iemladspa->ext.handle;
 
  cleanup:
   if(default_controls)
     free(default_controls);
+  free(found_library);
+  free(found_module);
   return retval;
 }
 
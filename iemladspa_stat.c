@@ -0,0 +1,149 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* print the timing statistics of an iemladspa PCM, like vmstat does
+ *
+ * usage: iemladspa-stat [-n count] <controls> [interval]
+ *
+ * <controls> is the 'controls' file of the PCM (e.g. 'ladspa.bin').
+ * every <interval> seconds (default: 1), one line per active stream shows
+ * what happened since the previous line: transfers and frames per second,
+ * the DSP load (last and highest, in percent of a period), the time spent
+ * per frame, how it splits up into the phases of a transfer, and the
+ * 99th percentile of the transfer times (from the histogram).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stats.h"
+
+static const char *s_stream[] = { "play", "capt" };
+
+/* the upper bound of the histogram bucket that holds the <permille>th transfer */
+static uint64_t percentile(const uint64_t *histogram, uint64_t count, unsigned int permille)
+{
+  uint64_t seen = 0;
+  unsigned int k;
+  for(k = 0; k < STATS_BUCKETS; k++) {
+    seen += histogram[k];
+    if(seen * 1000 >= count * permille)
+      break;
+  }
+  return (k < 63)?(2ULL << k):~0ULL;
+}
+
+static void print_header(void)
+{
+  printf("%-4s %8s %9s %5s %5s %8s %5s %5s %5s %5s %8s\n",
+         "", "xfer/s", "frames/s", "load", "max", "ns/frm",
+         "deint", "mute", "run", "reint", "p99(us)");
+}
+
+static void print_delta(unsigned int stream, const stats_stream_t *now, const stats_stream_t *then,
+                        double seconds)
+{
+  const uint64_t transfers = now->transfers - then->transfers;
+  const uint64_t frames = now->frames - then->frames;
+  const uint64_t busy = now->busy - then->busy;
+  uint64_t histogram[STATS_BUCKETS];
+  double share[STATS_PHASES];
+  unsigned int k;
+
+  for(k = 0; k < STATS_BUCKETS; k++)
+    histogram[k] = now->histogram[k] - then->histogram[k];
+  for(k = 0; k < STATS_PHASES; k++)
+    share[k] = busy?100. * (now->phase[k] - then->phase[k]) / busy:0.;
+
+  printf("%-4s %8.0f %9.0f %4u%% %4u%% %8.1f %4.0f%% %4.0f%% %4.0f%% %4.0f%% %8.1f\n",
+         s_stream[stream], transfers / seconds, frames / seconds,
+         now->load / 10, now->load_max / 10,
+         frames?(double)busy / frames:0.,
+         share[STATS_DEINTERLEAVE], share[STATS_MUTE], share[STATS_RUN], share[STATS_REINTERLEAVE],
+         transfers?percentile(histogram, transfers, 990) / 1000.:0.);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-n count] <controls> [interval]\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  stats_stream_t last[2], now[2];
+  stats_t *stats;
+  char *name;
+  double interval = 1.;
+  long count = -1;
+  uint64_t then;
+  int opt, lines = 0;
+  unsigned int stream;
+
+  while((opt = getopt(argc, argv, "n:")) != -1) {
+    if('n' != opt)
+      usage(argv[0]);
+    count = atol(optarg);
+  }
+  if(optind >= argc)
+    usage(argv[0]);
+  if(optind + 1 < argc)
+    interval = atof(argv[optind + 1]);
+  if(interval <= 0.)
+    usage(argv[0]);
+
+  name = stats_name(argv[optind]);
+  stats = name?stats_map(name, 0):NULL;
+  if(!stats) {
+    fprintf(stderr, "no statistics for '%s' (is the PCM running?)\n", argv[optind]);
+    free(name);
+    return 1;
+  }
+
+  for(stream = 0; stream < 2; stream++)
+    if(!stats_read(stats, stream, &last[stream]))
+      memset(&last[stream], 0, sizeof(last[stream]));
+  then = stats_now();
+
+  while(count < 0 || count--) {
+    uint64_t t;
+    usleep((useconds_t)(interval * 1e6));
+    t = stats_now();
+    if(!(lines++ % 20))
+      print_header();
+    for(stream = 0; stream < 2; stream++) {
+      if(!stats_read(stats, stream, &now[stream]))
+        continue;
+      /* the PCM was set up anew: start over */
+      if(now[stream].transfers < last[stream].transfers)
+        memset(&last[stream], 0, sizeof(last[stream]));
+      if(now[stream].transfers != last[stream].transfers)
+        print_delta(stream, &now[stream], &last[stream], (t - then) * 1e-9);
+      last[stream] = now[stream];
+    }
+    then = t;
+    fflush(stdout);
+  }
+
+  stats_unmap(stats);
+  free(name);
+  return 0;
+}
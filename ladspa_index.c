@@ -0,0 +1,514 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* an index of the LADSPA-plugins along the LADSPA_PATH (see ladspa_index.h) */
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <ladspa.h>
+#include "ladspa_utils.h"
+#include "ladspa_index.h"
+
+#define INDEX_FILENAME "ladspa.index"
+#define INDEX_HEADER "# iemladspa index 2\n"
+#define INDEX_DEFAULT_PATH "/usr/local/lib/ladspa:/usr/lib/ladspa"
+
+/* a directory along the LADSPA_PATH (its mtime changes whenever a library is
+ * added to it, or removed) */
+typedef struct _index_directory {
+  char *path;
+  long long mtime;              /* -1: missing */
+} index_directory_t;
+
+typedef struct _index_library {
+  char *path;
+  long long mtime, size;
+} index_library_t;
+
+typedef struct _index_plugin {
+  unsigned int library;
+  unsigned long id;
+  char *label;
+  unsigned long ports;
+  unsigned int controls, inputs, outputs; /* (audio in- and outputs) */
+} index_plugin_t;
+
+typedef struct _ladspa_index {
+  index_directory_t *directories; /* (in the order of the LADSPA_PATH) */
+  unsigned int num_directories, max_directories;
+  index_library_t *libraries;     /* (in the order they are searched) */
+  unsigned int num_libraries, max_libraries;
+  index_plugin_t *plugins;
+  unsigned int num_plugins, max_plugins;
+  /* open addressing (with linear probing) into 'plugins'; -1: empty */
+  int *bylabel, *byid;
+  unsigned int mask;
+} ladspa_index_t;
+
+static void index_free(ladspa_index_t *index) {
+  unsigned int i;
+  for(i = 0; i < index->num_directories; i++)
+    free(index->directories[i].path);
+  for(i = 0; i < index->num_libraries; i++)
+    free(index->libraries[i].path);
+  for(i = 0; i < index->num_plugins; i++)
+    free(index->plugins[i].label);
+  free(index->directories);
+  free(index->libraries);
+  free(index->plugins);
+  free(index->bylabel);
+  free(index->byid);
+  memset(index, 0, sizeof(*index));
+}
+
+static int index_add_directory(ladspa_index_t *index, const char *path, long long mtime) {
+  index_directory_t *directory;
+  if(index->num_directories == index->max_directories) {
+    const unsigned int max = index->max_directories ? 2 * index->max_directories : 8;
+    index_directory_t *directories = realloc(index->directories, max * sizeof(*directories));
+    if(!directories)
+      return -1;
+    index->directories = directories;
+    index->max_directories = max;
+  }
+  directory = &index->directories[index->num_directories];
+  directory->path = strdup(path);
+  if(!directory->path)
+    return -1;
+  directory->mtime = mtime;
+  return index->num_directories++;
+}
+
+static int index_add_library(ladspa_index_t *index, const char *path, long long mtime, long long size) {
+  index_library_t *library;
+  if(index->num_libraries == index->max_libraries) {
+    const unsigned int max = index->max_libraries ? 2 * index->max_libraries : 64;
+    index_library_t *libraries = realloc(index->libraries, max * sizeof(*libraries));
+    if(!libraries)
+      return -1;
+    index->libraries = libraries;
+    index->max_libraries = max;
+  }
+  library = &index->libraries[index->num_libraries];
+  library->path = strdup(path);
+  if(!library->path)
+    return -1;
+  library->mtime = mtime;
+  library->size = size;
+  return index->num_libraries++;
+}
+
+/* (to the last library added) */
+static int index_add_plugin(ladspa_index_t *index, const index_plugin_t *plugin) {
+  if(!index->num_libraries)
+    return -1;
+  if(index->num_plugins == index->max_plugins) {
+    const unsigned int max = index->max_plugins ? 2 * index->max_plugins : 256;
+    index_plugin_t *plugins = realloc(index->plugins, max * sizeof(*plugins));
+    if(!plugins)
+      return -1;
+    index->plugins = plugins;
+    index->max_plugins = max;
+  }
+  index->plugins[index->num_plugins] = *plugin;
+  index->plugins[index->num_plugins].library = index->num_libraries - 1;
+  index->plugins[index->num_plugins].label = strdup(plugin->label);
+  if(!index->plugins[index->num_plugins].label)
+    return -1;
+  return index->num_plugins++;
+}
+
+/* ------------------------------------------------------------------ */
+
+static unsigned int hash_label(const char *label) {
+  unsigned int hash = 2166136261u; /* FNV-1a */
+  for(; *label; label++)
+    hash = (hash ^ (unsigned char)*label) * 16777619u;
+  return hash;
+}
+static unsigned int hash_id(unsigned long id) {
+  return (unsigned int)id * 2654435761u;
+}
+
+/* (re)build the hash tables; the first plugin of a label (or an ID) wins */
+static int index_hash(ladspa_index_t *index) {
+  unsigned int size = 16, i, slot;
+  while(size < 2 * index->num_plugins)
+    size *= 2;
+  free(index->bylabel);
+  free(index->byid);
+  index->bylabel = malloc(size * sizeof(int));
+  index->byid = malloc(size * sizeof(int));
+  if(!index->bylabel || !index->byid)
+    return -1;
+  memset(index->bylabel, -1, size * sizeof(int));
+  memset(index->byid, -1, size * sizeof(int));
+  index->mask = size - 1;
+  for(i = 0; i < index->num_plugins; i++) {
+    const index_plugin_t *plugin = &index->plugins[i];
+    for(slot = hash_label(plugin->label) & index->mask; index->bylabel[slot] >= 0; slot = (slot + 1) & index->mask)
+      if(!strcmp(index->plugins[index->bylabel[slot]].label, plugin->label))
+        break;
+    if(index->bylabel[slot] < 0)
+      index->bylabel[slot] = i;
+    for(slot = hash_id(plugin->id) & index->mask; index->byid[slot] >= 0; slot = (slot + 1) & index->mask)
+      if(index->plugins[index->byid[slot]].id == plugin->id)
+        break;
+    if(index->byid[slot] < 0)
+      index->byid[slot] = i;
+  }
+  return 0;
+}
+
+/* the plugin with the label <name> (or the ID, if it is a number), or -1 */
+static int index_lookup(const ladspa_index_t *index, const char *name) {
+  char *end = NULL;
+  const unsigned long id = strtoul(name, &end, 10);
+  unsigned int slot;
+  int found;
+  if(!index->bylabel)
+    return -1;
+  if(*name >= '0' && *name <= '9' && end && !*end) {
+    for(slot = hash_id(id) & index->mask; (found = index->byid[slot]) >= 0; slot = (slot + 1) & index->mask)
+      if(index->plugins[found].id == id)
+        return found;
+    return -1;
+  }
+  for(slot = hash_label(name) & index->mask; (found = index->bylabel[slot]) >= 0; slot = (slot + 1) & index->mask)
+    if(!strcmp(index->plugins[found].label, name))
+      return found;
+  return -1;
+}
+
+/* ------------------------------------------------------------------ */
+
+/* read an index file (a missing or broken one is just empty) */
+static void index_read(ladspa_index_t *index, const char *filename) {
+  char line[LADSPA_CNTRL_PATHLEN + 128];
+  FILE *f = fopen(filename, "r");
+  int skip = 1; /* (the plugins of a library we couldn't add) */
+  if(!f)
+    return;
+  if(!fgets(line, sizeof(line), f) || strcmp(line, INDEX_HEADER)) {
+    fclose(f);
+    return;
+  }
+  while(fgets(line, sizeof(line), f)) {
+    index_plugin_t plugin;
+    long long mtime, size;
+    size_t length = strlen(line);
+    int offset = -1;
+    if(!length || line[length - 1] != '\n')
+      break;
+    line[length - 1] = 0;
+    if(sscanf(line, "directory %lld %n", &mtime, &offset) >= 1 && offset > 0) {
+      if(index_add_directory(index, line + offset, mtime) < 0)
+        break;
+    } else if(sscanf(line, "library %lld %lld %n", &mtime, &size, &offset) >= 2 && offset > 0) {
+      skip = (index_add_library(index, line + offset, mtime, size) < 0);
+    } else if(sscanf(line, "plugin %lu %lu %u %u %u %n", &plugin.id, &plugin.ports,
+                     &plugin.controls, &plugin.inputs, &plugin.outputs, &offset) >= 5 && offset > 0) {
+      plugin.label = line + offset;
+      if(!skip && index_add_plugin(index, &plugin) < 0)
+        break;
+    }
+  }
+  fclose(f);
+}
+
+/* write an index file (replacing the old one atomically) */
+static int index_write(const ladspa_index_t *index, const char *filename) {
+  char *tmpname = malloc(strlen(filename) + 8);
+  unsigned int i, p;
+  FILE *f = NULL;
+  int fd, err = -1;
+  if(!tmpname)
+    return -1;
+  sprintf(tmpname, "%s.XXXXXX", filename);
+  fd = mkstemp(tmpname);
+  if(fd < 0 || fchmod(fd, 0664) < 0 || !(f = fdopen(fd, "w"))) {
+    if(fd >= 0) {
+      close(fd);
+      unlink(tmpname);
+    }
+    free(tmpname);
+    return -1;
+  }
+  fputs(INDEX_HEADER, f);
+  for(i = 0; i < index->num_directories; i++)
+    fprintf(f, "directory %lld %s\n", index->directories[i].mtime, index->directories[i].path);
+  for(i = 0, p = 0; i < index->num_libraries; i++) {
+    fprintf(f, "library %lld %lld %s\n", index->libraries[i].mtime, index->libraries[i].size,
+            index->libraries[i].path);
+    for(; p < index->num_plugins && index->plugins[p].library == i; p++)
+      fprintf(f, "plugin %lu %lu %u %u %u %s\n", index->plugins[p].id, index->plugins[p].ports,
+              index->plugins[p].controls, index->plugins[p].inputs, index->plugins[p].outputs,
+              index->plugins[p].label);
+  }
+  if(fflush(f) == 0 && fsync(fileno(f)) == 0)
+    err = 0;
+  if(fclose(f) != 0)
+    err = -1;
+  if(!err && rename(tmpname, filename) < 0)
+    err = -1;
+  if(err)
+    unlink(tmpname);
+  free(tmpname);
+  return err;
+}
+
+/* ------------------------------------------------------------------ */
+
+/* the LADSPA_PATH, split at the colons (without trailing slashes) */
+static char **index_path(void) {
+  const char *path = getenv("LADSPA_PATH");
+  char *copy, *dir, *save = NULL;
+  char **dirs;
+  unsigned int count = 0;
+  if(!path || !*path)
+    path = INDEX_DEFAULT_PATH;
+  copy = strdup(path);
+  dirs = calloc(strlen(path) / 2 + 2, sizeof(char*));
+  if(!copy || !dirs) {
+    free(copy);
+    free(dirs);
+    return NULL;
+  }
+  for(dir = strtok_r(copy, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+    size_t length = strlen(dir);
+    while(length > 1 && dir[length - 1] == '/')
+      dir[--length] = 0;
+    dirs[count] = strdup(dir);
+    if(dirs[count])
+      count++;
+  }
+  free(copy);
+  return dirs;
+}
+static void index_path_free(char **dirs) {
+  unsigned int i;
+  if(!dirs)
+    return;
+  for(i = 0; dirs[i]; i++)
+    free(dirs[i]);
+  free(dirs);
+}
+
+static long long index_mtime(const struct stat *st) {
+  return st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+/* whether the index still tells what a scan of <dirs> would find in the first
+ * <libraries> libraries (and that nothing was added before them):
+ * the directories are the same (and none has changed), as are those libraries */
+static int index_current(const ladspa_index_t *index, char **dirs, unsigned int libraries) {
+  struct stat st;
+  unsigned int i;
+  for(i = 0; dirs[i]; i++) {
+    const long long mtime = (stat(dirs[i], &st) < 0)?-1:index_mtime(&st);
+    if(i >= index->num_directories || strcmp(index->directories[i].path, dirs[i])
+       || index->directories[i].mtime != mtime)
+      return 0;
+  }
+  if(i != index->num_directories)
+    return 0;
+  for(i = 0; i < libraries && i < index->num_libraries; i++) {
+    const index_library_t *library = &index->libraries[i];
+    if(stat(library->path, &st) < 0 || library->size != st.st_size || library->mtime != index_mtime(&st))
+      return 0;
+  }
+  return 1;
+}
+
+/* ask a library for its plugins (and add them to <index>) */
+static void index_load(ladspa_index_t *index, const char *path) {
+  LADSPA_Descriptor_Function descriptors;
+  const LADSPA_Descriptor *descriptor;
+  unsigned long i, p;
+  void *handle = dlopen(path, RTLD_LAZY | RTLD_LOCAL);
+  if(!handle)
+    return;
+  descriptors = (LADSPA_Descriptor_Function)dlsym(handle, "ladspa_descriptor");
+  for(i = 0; descriptors && (descriptor = descriptors(i)); i++) {
+    index_plugin_t plugin;
+    /* (a label has to fit into a line of the index) */
+    if(!descriptor->Label || strchr(descriptor->Label, '\n') || strlen(descriptor->Label) >= LADSPA_CNTRL_NAMELEN)
+      continue;
+    memset(&plugin, 0, sizeof(plugin));
+    plugin.id = descriptor->UniqueID;
+    plugin.label = (char*)descriptor->Label;
+    plugin.ports = descriptor->PortCount;
+    for(p = 0; p < descriptor->PortCount; p++) {
+      const LADSPA_PortDescriptor port = descriptor->PortDescriptors[p];
+      if(port & LADSPA_PORT_CONTROL)
+        plugin.controls++;
+      else if(port == (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO))
+        plugin.inputs++;
+      else if(port == (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO))
+        plugin.outputs++;
+    }
+    if(index_add_plugin(index, &plugin) < 0)
+      break;
+  }
+  dlclose(handle);
+}
+
+static int compare_names(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* the libraries of one directory, in alphabetical order (free() them, and the list) */
+static char **index_list(const char *dir, unsigned int *count) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  char **names = NULL;
+  unsigned int max = 0;
+  *count = 0;
+  if(!d)
+    return NULL;
+  while((entry = readdir(d))) {
+    const size_t length = strlen(entry->d_name);
+    if(length < 4 || strcmp(entry->d_name + length - 3, ".so"))
+      continue;
+    if(*count == max) {
+      char **more = realloc(names, (max = max ? 2 * max : 64) * sizeof(char*));
+      if(!more)
+        break;
+      names = more;
+    }
+    names[*count] = strdup(entry->d_name);
+    if(names[*count])
+      (*count)++;
+  }
+  closedir(d);
+  if(names)
+    qsort(names, *count, sizeof(char*), compare_names);
+  return names;
+}
+
+/* index the libraries along <dirs>, taking what hasn't changed from <old> */
+static int index_scan(ladspa_index_t *index, const ladspa_index_t *old, char **dirs) {
+  unsigned int d, n, i, p, count;
+  for(d = 0; dirs[d]; d++) {
+    struct stat st;
+    char **names;
+    /* (before the listing: a library that is added meanwhile makes the next lookup scan again) */
+    if(index_add_directory(index, dirs[d], (stat(dirs[d], &st) < 0)?-1:index_mtime(&st)) < 0)
+      return -1;
+    names = index_list(dirs[d], &count);
+    for(n = 0; n < count; n++) {
+      char *path = malloc(strlen(dirs[d]) + strlen(names[n]) + 2);
+      long long mtime;
+      if(!path)
+        break;
+      sprintf(path, "%s/%s", dirs[d], names[n]);
+      if(strlen(path) >= LADSPA_CNTRL_PATHLEN || strchr(path, '\n')
+         || stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+        free(path);
+        continue;
+      }
+      mtime = index_mtime(&st);
+      for(i = 0, p = 0; i < old->num_libraries; i++) {
+        if(!strcmp(old->libraries[i].path, path))
+          break;
+      }
+      if(index_add_library(index, path, mtime, st.st_size) < 0) {
+        free(path);
+        break;
+      }
+      if(i < old->num_libraries && old->libraries[i].mtime == mtime && old->libraries[i].size == st.st_size) {
+        /* unchanged: no need to load it */
+        for(p = 0; p < old->num_plugins; p++)
+          if(old->plugins[p].library == i)
+            index_add_plugin(index, &old->plugins[p]);
+      } else {
+        index_load(index, path);
+      }
+      free(path);
+    }
+    for(n = 0; n < count; n++)
+      free(names[n]);
+    free(names);
+  }
+  return index_hash(index);
+}
+
+/* ------------------------------------------------------------------ */
+
+int ladspa_index_find(const char *plugin, char **library, char **label) {
+  ladspa_index_t index, scanned;
+  char *filename = LADSPAcontrolFilename(INDEX_FILENAME);
+  char **dirs = index_path();
+  int found, err = -ENOENT;
+
+  memset(&index, 0, sizeof(index));
+  memset(&scanned, 0, sizeof(scanned));
+  if(!filename || !dirs) {
+    err = -ENOMEM;
+    goto done;
+  }
+  index_read(&index, filename);
+  if(index_hash(&index) < 0) {
+    err = -ENOMEM;
+    goto done;
+  }
+  /* a plugin that is found has to be found in the same place by a scan;
+   * one that is missing has to be missing everywhere */
+  found = index_lookup(&index, plugin);
+  if(!index_current(&index, dirs, (found < 0)?index.num_libraries:index.plugins[found].library + 1)) {
+    /* stale: bring the index up to date */
+    if(index_scan(&scanned, &index, dirs) < 0) {
+      err = -ENOMEM;
+      goto done;
+    }
+    if(index_write(&scanned, filename) < 0)
+      fprintf(stderr, "Failed to write LADSPA index:%s.\n", filename);
+    index_free(&index);
+    index = scanned;
+    memset(&scanned, 0, sizeof(scanned));
+    found = index_lookup(&index, plugin);
+  }
+  if(found >= 0) {
+    *library = strdup(index.libraries[index.plugins[found].library].path);
+    *label = strdup(index.plugins[found].label);
+    if(*library && *label) {
+      err = 0;
+    } else {
+      free(*library);
+      free(*label);
+      *library = *label = NULL;
+      err = -ENOMEM;
+    }
+  }
+ done:
+  index_free(&index);
+  index_free(&scanned);
+  index_path_free(dirs);
+  free(filename);
+  return err;
+}
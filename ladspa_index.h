@@ -0,0 +1,47 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IEMLADSPA_LADSPA_INDEX_H
+#define IEMLADSPA_LADSPA_INDEX_H
+
+/* an index of the LADSPA-plugins along the LADSPA_PATH
+ *
+ * finding a plugin by its label (or UniqueID) alone would mean loading every
+ * library along the LADSPA_PATH (running their constructors) and asking each
+ * of them for all of its plugins.
+ * instead, what each library contains (the labels, UniqueIDs and port layouts
+ * of its plugins) is kept in a small text file next to the controls files
+ * ('~/.config/ladspa.iem.at/ladspa.index'), along with the library's
+ * modification time and size, and the modification times of the directories
+ * (which change whenever a library is added or removed).
+ * a lookup reads the index and probes a hash table; the answer (even if the
+ * plugin is missing) stands as long as none of the directories and none of the
+ * libraries up to the one that was found have changed. otherwise the directories
+ * are scanned, and only the libraries that are new or have changed are loaded.
+ */
+
+/* find the LADSPA-plugin <plugin> (a label, or a UniqueID given as a decimal
+ * number) along the LADSPA_PATH (default: /usr/local/lib/ladspa:/usr/lib/ladspa);
+ * if several libraries have it, the first one along the path wins.
+ * on success, <*library> (the file) and <*label> are set (free() them) and 0 is
+ * returned; -ENOENT if there is no such plugin (or another negative error code) */
+int ladspa_index_find(const char *plugin, char **library, char **label);
+
+#endif /* IEMLADSPA_LADSPA_INDEX_H */
@@ -3,6 +3,7 @@
    warranty.
    ------------------------------------------------------------------*/
 
+#define _GNU_SOURCE /* dladdr() */
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -11,9 +12,14 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <strings.h>
+#include <stddef.h>
 #include <math.h>
+#include <sched.h>
+#include <signal.h>
 
 #include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include <ladspa.h>
 #include "ladspa_utils.h"
@@ -186,7 +192,7 @@ void * LADSPAload(const char * pcPluginFilename) {
             "Failed to load plugin \"%s\": %s\n",
             pcPluginFilename,
             dlerror());
-    exit(1);
+    return NULL;
   }
 
   return pvPluginHandle;
@@ -218,8 +224,8 @@ const LADSPA_Descriptor * LADSPAfind(void * pvLADSPAPluginLibrary,
               "Are you sure this is a LADSPA plugin file?\n",
               pcPluginLibraryFilename,
               pcError);
-      exit(1);
     }
+    return NULL;
   }
 
   for (lPluginIndex = 0;; lPluginIndex++) {
@@ -229,7 +235,7 @@ const LADSPA_Descriptor * LADSPAfind(void * pvLADSPAPluginLibrary,
               "Unable to find label \"%s\" in plugin library file \"%s\".\n",
               pcPluginLabel,
               pcPluginLibraryFilename);
-      exit(1);
+      return NULL;
     }
     if (strcmp(psDescriptor->Label, pcPluginLabel) == 0)
       return psDescriptor;
@@ -316,24 +322,215 @@ int LADSPADefault(const LADSPA_PortRangeHint * psPortRangeHint,
 
 /* ------------------------------------------------------------------ */
 
-void LADSPAcontrolUnMMAP(LADSPA_Control *control)
+/* the controls file as released before it had a version (version 1):
+ * the values were kept right in the port descriptions, with nothing to tell the format */
+typedef struct LADSPA_Control_Data_v1_ {
+	int index;
+	LADSPA_Data data;
+	int type;
+} LADSPA_Control_Data_v1;
+typedef struct LADSPA_Control_v1_ {
+	unsigned long length;
+	unsigned long id;
+	iemladspa_iochannels_t sourcechannels;
+	iemladspa_iochannels_t sinkchannels;
+	unsigned long num_controls;
+	unsigned long num_inchannels;
+	unsigned long num_outchannels;
+	LADSPA_Control_Data_v1 data[];
+} LADSPA_Control_v1;
+
+/* convert a controls file of version 1 into <image> (the defaults of the current version),
+ * keeping the settings, and write it back */
+static void LADSPAcontrolConvertV1(int fd, LADSPA_Control *image)
 {
-	munmap(control, control->length);
+	const unsigned long num_ports = image->num_controls + image->num_inchannels + image->num_outchannels;
+	const unsigned long length = sizeof(LADSPA_Control_v1) + num_ports*sizeof(LADSPA_Control_Data_v1);
+	LADSPA_Control_Input *input = LADSPAcontrolInput(image);
+	LADSPA_Control_v1 *old;
+	unsigned long i;
+	struct stat st;
+
+	if(fstat(fd, &st) < 0 || (unsigned long)st.st_size != length)
+		return;
+	old = malloc(length);
+	if(old == NULL)
+		return;
+	/* (files of other plugins or layouts are left alone, and refused later) */
+	if(pread(fd, old, length, 0) == (ssize_t)length && old->length == length && old->id == image->id
+	   && old->sourcechannels.in == image->sourcechannels.in && old->sourcechannels.out == image->sourcechannels.out
+	   && old->sinkchannels.in == image->sinkchannels.in && old->sinkchannels.out == image->sinkchannels.out
+	   && old->num_controls == image->num_controls) {
+		for(i = 0; i < image->num_controls; i++)
+			if(old->data[i].index == image->data[i].index && old->data[i].type == LADSPA_CNTRL_INPUT)
+				input->value[i] = old->data[i].data;
+		if(pwrite(fd, image, image->length, 0) != (ssize_t)image->length || ftruncate(fd, image->length) < 0)
+			fprintf(stderr, "Failed to convert controls file.\n");
+	}
+	free(old);
 }
 
-LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
-                                   const char *controls_filename,
-                                   iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels)
+/* convert a controls file of an older version into <image>
+ * (the versions between 1 and the current one were never released:
+ * files of them start over with the defaults) */
+static void LADSPAcontrolConvert(int fd, LADSPA_Control *image)
 {
-	const char * homePath;
-	char *filename;
-	unsigned long i, index, iindex, oindex;
-  unsigned int num_controls = 0, num_inchannels = 0, num_outchannels = 0;
+	unsigned int header[2]; /* magic, version */
+	if(pread(fd, header, sizeof(header), 0) != sizeof(header))
+		return;
+	if(header[0] != LADSPA_CNTRL_MAGIC) {
+		LADSPAcontrolConvertV1(fd, image);
+	} else if(header[1] < LADSPA_CNTRL_VERSION) {
+		if(pwrite(fd, image, image->length, 0) != (ssize_t)image->length || ftruncate(fd, image->length) < 0)
+			fprintf(stderr, "Failed to convert controls file.\n");
+	}
+}
+
+/* update the description of the plugin in a controls file that fits <image>
+ * (if the library has changed since it was written) */
+static void LADSPAcontrolRedescribe(int fd, const LADSPA_Control *image)
+{
+	const unsigned long size = image->length - image->meta;
+	char *buf = malloc(image->input > size ? image->input : size);
+	if(buf == NULL)
+		return;
+	if(pread(fd, buf, image->input, 0) == (ssize_t)image->input && !memcmp(buf, image, image->input)
+	   && pread(fd, buf, size, image->meta) == (ssize_t)size && memcmp(buf, (const char*)image + image->meta, size)) {
+		if(pwrite(fd, (const char*)image + image->meta, size, image->meta) != (ssize_t)size)
+			fprintf(stderr, "Failed to update controls file.\n");
+	}
+	free(buf);
+}
+
+/* the size of a controls file, and where its regions start */
+static unsigned long LADSPAcontrolLayout(unsigned long num_controls, unsigned long num_ports,
+                                         unsigned long *input, unsigned long *output, unsigned long *meta)
+{
+	const unsigned long align = LADSPA_CNTRL_ALIGN - 1;
+	*input  = (sizeof(LADSPA_Control) + num_ports*sizeof(LADSPA_Control_Data) + align) & ~align;
+	*output = (*input + sizeof(LADSPA_Control_Input) + num_controls*sizeof(LADSPA_Data) + align) & ~align;
+	*meta   = (*output + sizeof(LADSPA_Control_Output) + num_controls*sizeof(LADSPA_Data) + align) & ~align;
+	return (*meta + sizeof(LADSPA_Control_Meta) + num_controls*sizeof(LADSPA_Control_Port) + align) & ~align;
+}
+
+/* copy <src> into <dst> (of LADSPA_CNTRL_NAMELEN or _PATHLEN bytes); 0 if it doesn't fit */
+static int LADSPAcontrolCopyString(char *dst, size_t size, const char *src)
+{
+	if(src == NULL || strlen(src) >= size)
+		return 0;
+	strcpy(dst, src);
+	return 1;
+}
+
+/* describe the plugin of <control> for the mixer
+ * (leaving the description invalid if anything doesn't fit) */
+static void LADSPAcontrolDescribe(LADSPA_Control *control, const LADSPA_Descriptor *psDescriptor,
+                                  const char *library)
+{
+	LADSPA_Control_Meta *meta = (LADSPA_Control_Meta*)((char*)control + control->meta);
+	unsigned long i;
+	struct stat st;
+	Dl_info info;
+
+	meta->port_count = psDescriptor->PortCount;
+	for(i = 0; i < control->num_controls; i++) {
+		const unsigned long index = control->data[i].index;
+		meta->port[i].hint = psDescriptor->PortRangeHints[index];
+		if(!LADSPAcontrolCopyString(meta->port[i].name, sizeof(meta->port[i].name), psDescriptor->PortNames[index]))
+			return;
+	}
+	if(!LADSPAcontrolCopyString(meta->library, sizeof(meta->library), library)
+	   || !LADSPAcontrolCopyString(meta->label, sizeof(meta->label), psDescriptor->Label)
+	   || !LADSPAcontrolCopyString(meta->name, sizeof(meta->name), psDescriptor->Name))
+		return;
+	/* the file the library was found in (e.g. along the LADSPA_PATH) */
+	if(!dladdr((void*)psDescriptor->instantiate, &info)
+	   || !LADSPAcontrolCopyString(meta->path, sizeof(meta->path), info.dli_fname)
+	   || stat(meta->path, &st) < 0)
+		return;
+	meta->mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+	meta->size = st.st_size;
+	meta->valid = 1;
+}
 
+/* a controls file with the default settings */
+static LADSPA_Control *LADSPAcontrolDefaults(const LADSPA_Descriptor *psDescriptor,
+                                             const char *library,
+                                             iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels,
+                                             unsigned long num_controls, unsigned long num_inchannels, unsigned long num_outchannels)
+{
 	LADSPA_Control *default_controls;
-	LADSPA_Control *ptr;
-	int fd;
-	unsigned long length;
+	LADSPA_Control_Input *input;
+	LADSPA_Control_Output *output;
+	unsigned long i, index, iindex, oindex, offset_in, offset_out, offset_meta, length;
+
+	length = LADSPAcontrolLayout(num_controls, num_controls + num_inchannels + num_outchannels,
+	                             &offset_in, &offset_out, &offset_meta);
+	default_controls = calloc(1, length);
+	if(default_controls == NULL)
+		return NULL;
+	default_controls->magic = LADSPA_CNTRL_MAGIC;
+	default_controls->version = LADSPA_CNTRL_VERSION;
+	default_controls->length = length;
+	default_controls->id = psDescriptor->UniqueID;
+
+	default_controls->sourcechannels.in  = sourcechannels.in;
+	default_controls->sourcechannels.out = sourcechannels.out;
+	default_controls->sinkchannels.in    = sinkchannels.in;
+	default_controls->sinkchannels.out   = sinkchannels.out;
+
+	default_controls->num_controls    = num_controls;
+	default_controls->num_inchannels  = num_inchannels;
+	default_controls->num_outchannels = num_outchannels;
+	default_controls->input  = offset_in;
+	default_controls->output = offset_out;
+	default_controls->meta   = offset_meta;
+	input  = LADSPAcontrolInput(default_controls);
+	output = LADSPAcontrolOutput(default_controls);
+
+	for(i = 0, index=0, iindex=0, oindex=0; i < psDescriptor->PortCount; i++) {
+		if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_CONTROL) {
+			default_controls->data[0+index].index = i;
+
+			LADSPADefault(&psDescriptor->PortRangeHints[i], 44100,
+			              &input->value[index]);
+			output->value[index] = input->value[index];
+
+			if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_INPUT) {
+				default_controls->data[0+index].type = LADSPA_CNTRL_INPUT;
+			} else {
+				default_controls->data[0+index].type = LADSPA_CNTRL_OUTPUT;
+			}
+			index++;
+
+		} else if(psDescriptor->PortDescriptors[i] ==
+		          (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+			default_controls->data[num_controls+iindex].index = i;
+			iindex++;
+
+		} else if(psDescriptor->PortDescriptors[i] ==
+		          (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+			default_controls->data[num_controls+num_inchannels + oindex].index = i;
+			oindex++;
+		}
+	}
+	LADSPAcontrolDescribe(default_controls, psDescriptor, library);
+	return default_controls;
+}
+
+int LADSPAcontrolBackend(const char *name)
+{
+	if(!strcmp(name, "file"))
+		return LADSPA_CNTRL_BACKEND_FILE;
+	if(!strcmp(name, "shm"))
+		return LADSPA_CNTRL_BACKEND_SHM;
+	return -1;
+}
+
+char * LADSPAcontrolFilename(const char *controls_filename)
+{
+	const char * homePath;
+	char *filename;
 
 	/* Create config filename, if no path specified store in home directory */
 	if (controls_filename[0] == '/') {
@@ -354,11 +551,159 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 		}
 		sprintf(filename, "%s%s", homePath, subdir);
     if(mkpath(filename, 0770)) {
+      free(filename);
       return NULL;
     }
 
 		sprintf(filename, "%s%s%s", homePath, subdir, controls_filename);
 	}
+	return filename;
+}
+
+/* open the controls file (creating it with the <defaults>, or converting an old one) */
+static int LADSPAcontrolOpenFile(const char *filename, LADSPA_Control *defaults)
+{
+	int fd = open(filename, O_RDWR);
+	if(fd < 0) {
+		if(errno != ENOENT)
+			return -1;
+		/* If the file doesn't exist create it and populate
+		   it with default data. */
+		fd = open(filename, O_RDWR | O_CREAT, 0664);
+		if(fd < 0) {
+			fprintf(stderr, "Failed to open controls file:%s.\n",
+			        filename);
+			return -1;
+		}
+		/* Write the default data to the file. */
+		if(write(fd, defaults, defaults->length) < 0) {
+			close(fd);
+			return -1;
+		}
+	} else {
+		LADSPAcontrolConvert(fd, defaults);
+	}
+	return fd;
+}
+
+/* the shared memory object of a controls file:
+ * its basename (so it can be told in /dev/shm/) and a hash of its full path */
+static char *LADSPAcontrolShmName(const char *filename)
+{
+	const char *base = strrchr(filename, '/');
+	unsigned int hash = 2166136261u; /* FNV-1a */
+	const char *c;
+	char *name = malloc(128);
+	if(name == NULL)
+		return NULL;
+	for(c = filename; *c; c++)
+		hash = (hash ^ (unsigned char)*c) * 16777619u;
+	snprintf(name, 128, "/iemladspa.%.64s.%08x", base?base+1:filename, hash);
+	return name;
+}
+
+/* milliseconds to wait for somebody else to finish seeding the shared memory */
+#define LADSPA_CNTRL_SEED_MS 100
+
+/* open the shared memory of a controls file; the first one to get here seeds it
+ * from the file (which is created or converted as needed) */
+static int LADSPAcontrolOpenShm(const char *filename, LADSPA_Control *defaults)
+{
+	const unsigned long length = defaults->length;
+	const unsigned int magic = LADSPA_CNTRL_MAGIC;
+	char *name = LADSPAcontrolShmName(filename);
+	LADSPA_Control *image = NULL;
+	unsigned int found = 0;
+	int fd, filefd, i;
+
+	if(name == NULL)
+		return -1;
+	fd = shm_open(name, O_RDWR, 0);
+	if(fd < 0 && errno == ENOENT) {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0664);
+		if(fd >= 0) {
+			image = malloc(length);
+			filefd = LADSPAcontrolOpenFile(filename, defaults);
+			if(filefd >= 0)
+				LADSPAcontrolRedescribe(filefd, defaults);
+			/* (a file of another plugin or layout would be refused from now on,
+			 *  rather than the next time the shared memory is created) */
+			if(image == NULL || filefd < 0
+			   || pread(filefd, image, length, 0) != (ssize_t)length
+			   || memcmp(image, defaults, defaults->input)) {
+				fprintf(stderr, "%s doesn't fit the LADSPA-plugin.\n", filename);
+				if(filefd >= 0)
+					close(filefd);
+				free(image);
+				shm_unlink(name);
+				close(fd);
+				free(name);
+				return -1;
+			}
+			close(filefd);
+			/* the magic goes in last: it tells the others that we are done */
+			if(ftruncate(fd, length) < 0
+			   || pwrite(fd, (char*)image + sizeof(magic), length - sizeof(magic), sizeof(magic)) < 0
+			   || pwrite(fd, &magic, sizeof(magic), 0) != sizeof(magic)) {
+				free(image);
+				shm_unlink(name);
+				close(fd);
+				free(name);
+				return -1;
+			}
+			free(image);
+			free(name);
+			return fd;
+		}
+		if(errno == EEXIST)
+			fd = shm_open(name, O_RDWR, 0);
+	}
+	free(name);
+	if(fd < 0)
+		return -1;
+	/* (somebody else might still be seeding it) */
+	for(i = 0; i < LADSPA_CNTRL_SEED_MS; i++) {
+		if(pread(fd, &found, sizeof(found), 0) == sizeof(found) && found == magic)
+			break;
+		usleep(1000);
+	}
+	return fd;
+}
+
+void LADSPAcontrolUnMMAP(LADSPA_Control *control)
+{
+	munmap(control, control->length);
+}
+
+int LADSPAcontrolShmUnlink(const char *controls_filename)
+{
+	char *filename = LADSPAcontrolFilename(controls_filename);
+	char *name = filename?LADSPAcontrolShmName(filename):NULL;
+	int err = (name && !shm_unlink(name))?0:-1;
+	free(name);
+	free(filename);
+	return err;
+}
+
+LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
+                                   const char *library,
+                                   const char *controls_filename,
+                                   iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels,
+                                   int backend)
+{
+	char *filename;
+	unsigned long i;
+  unsigned int num_controls = 0, num_inchannels = 0, num_outchannels = 0;
+
+	LADSPA_Control *default_controls;
+	LADSPA_Control *ptr;
+	int fd;
+	unsigned long length;
+	struct stat st;
+
+	filename = LADSPAcontrolFilename(controls_filename);
+	if(filename == NULL)
+		return NULL;
 
 	/* Count the number of controls */
 	num_controls = 0;
@@ -376,97 +721,45 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 
 	if(num_controls == 0) {
 		fprintf(stderr, "No Controls on LADSPA Module.\n");
+		free(filename);
 		return NULL;
 	}
 
   if(num_inchannels != (sourcechannels.in  + sinkchannels.in)) {
 		fprintf(stderr, "LADSPA Module has %d channels but we need %d+%d.\n", num_inchannels, sourcechannels.in, sinkchannels.in);
+		free(filename);
 		return NULL;
   }
 
-	/* Calculate the required file-size */
-	length =                                          sizeof(LADSPA_Control)
-    + (num_inchannels+num_outchannels+num_controls)*sizeof(LADSPA_Control_Data)
-    ;
-
-	/* Open config file */
-	fd = open(filename, O_RDWR);
+	/* Create default controls stucture (which also tells the required file-size) */
+	default_controls = LADSPAcontrolDefaults(psDescriptor, library, sourcechannels, sinkchannels,
+	                                         num_controls, num_inchannels, num_outchannels);
+	if(default_controls == NULL) {
+		free(filename);
+		return NULL;
+	}
+	length = default_controls->length;
+
+	/* Open config file (or its copy in shared memory) */
+	if(backend == LADSPA_CNTRL_BACKEND_SHM)
+		fd = LADSPAcontrolOpenShm(filename, default_controls);
+	else
+		fd = LADSPAcontrolOpenFile(filename, default_controls);
+	if(fd >= 0)
+		LADSPAcontrolRedescribe(fd, default_controls);
+	free(default_controls);
 	if(fd < 0) {
-		if(errno == ENOENT){
-			/* If the file doesn't exist create it and populate
-         it with default data. */
-			fd = open(filename, O_RDWR | O_CREAT, 0664);
-			if(fd < 0) {
-				fprintf(stderr, "Failed to open controls file:%s.\n",
-                filename);
-				free(filename);
-				return NULL;
-			}
-			/* Create default controls stucture */
-			default_controls = malloc(length);
-			if(default_controls == NULL) {
-				free(filename);
-				return NULL;
-			}
-			default_controls->length = length;
-			default_controls->id = psDescriptor->UniqueID;
-
-      default_controls->sourcechannels.in  = sourcechannels.in;
-      default_controls->sourcechannels.out = sourcechannels.out;
-      default_controls->sinkchannels.in    = sinkchannels.in;
-      default_controls->sinkchannels.out   = sinkchannels.out;
-
-			default_controls->num_controls    = num_controls;
-			default_controls->num_inchannels  = num_inchannels;
-			default_controls->num_outchannels = num_outchannels;
-
-			for(i = 0, index=0, iindex=0, oindex=0; i < psDescriptor->PortCount; i++) {
-				if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_CONTROL) {
-          default_controls->data[0+index].index = i;
-
-          LADSPADefault(&psDescriptor->PortRangeHints[i], 44100,
-                        &default_controls->data[0+index].data);
-
-					if(psDescriptor->PortDescriptors[i]&LADSPA_PORT_INPUT) {
-						default_controls->data[0+index].type = LADSPA_CNTRL_INPUT;
-					} else {
-						default_controls->data[0+index].type = LADSPA_CNTRL_OUTPUT;
-					}
-					index++;
-
-				} else if(psDescriptor->PortDescriptors[i] ==
-                  (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
-					default_controls->data[num_controls+iindex].index = i;
-          iindex++;
-
-				} else if(psDescriptor->PortDescriptors[i] ==
-                  (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
-					default_controls->data[num_controls+num_inchannels + oindex].index = i;
-          oindex++;
-				}
-			}
-#if 0
-			if((default_controls->output == NULL) ||
-         (default_controls->input == NULL)) {
-        fprintf(stderr,
-                "LADSPA Plugin must have one audio channel\n");
-				free(default_controls);
-				free(filename);
-				return NULL;
-			}
-#endif
+		free(filename);
+		return NULL;
+	}
 
-			/* Write the default data to the file. */
-			if(write(fd, default_controls, length) < 0) {
-				free(default_controls);
-				free(filename);
-				return NULL;
-			}
-			free(default_controls);
-		} else {
-			free(filename);
-			return NULL;
-		}
+	/* (don't map beyond the end of the file) */
+	if(fstat(fd, &st) < 0 || (unsigned long)st.st_size < length) {
+		fprintf(stderr, "%s is the wrong length.\n",
+            filename);
+		close(fd);
+		free(filename);
+		return NULL;
 	}
 
 	/* MMap Configuration File */
@@ -480,10 +773,18 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 	}
 
 	/* Make sure we're mapped to the right file type. */
+	if(ptr->magic != LADSPA_CNTRL_MAGIC || ptr->version != LADSPA_CNTRL_VERSION) {
+		fprintf(stderr, "%s is not a controls file of version %d.\n",
+            filename, LADSPA_CNTRL_VERSION);
+		munmap(ptr, length);
+		free(filename);
+		return NULL;
+	}
+
 	if(ptr->length != length) {
 		fprintf(stderr, "%s is the wrong length.\n",
             filename);
-		LADSPAcontrolUnMMAP(ptr);
+		munmap(ptr, length);
 		free(filename);
 		return NULL;
 	}
@@ -516,3 +817,279 @@ LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
 	free(filename);
 	return ptr;
 }
+
+LADSPA_Control * LADSPAcontrolMMAPmeta(const char *library, const char *label,
+                                       const char *controls_filename,
+                                       iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels,
+                                       int backend)
+{
+	char *filename = LADSPAcontrolFilename(controls_filename);
+	char *name = NULL;
+	const LADSPA_Control_Meta *meta;
+	LADSPA_Control header, *ptr;
+	unsigned long i, num_ports, input, output, offset_meta, length;
+	struct stat st;
+	int fd = -1;
+
+	if(filename == NULL)
+		return NULL;
+	/* (only ever open what is there already: creating it needs the plugin) */
+	if(backend == LADSPA_CNTRL_BACKEND_SHM) {
+		name = LADSPAcontrolShmName(filename);
+		if(name)
+			fd = shm_open(name, O_RDWR, 0);
+		free(name);
+	} else {
+		fd = open(filename, O_RDWR);
+	}
+	free(filename);
+	if(fd < 0)
+		return NULL;
+
+	/* the header has to tell the very layout we would have created */
+	if(pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	   || header.magic != LADSPA_CNTRL_MAGIC || header.version != LADSPA_CNTRL_VERSION
+	   || header.sourcechannels.in != sourcechannels.in || header.sourcechannels.out != sourcechannels.out
+	   || header.sinkchannels.in != sinkchannels.in || header.sinkchannels.out != sinkchannels.out
+	   || header.num_inchannels != sourcechannels.in + sinkchannels.in
+	   || header.num_controls == 0 || header.num_controls > 0x10000
+	   || header.num_inchannels > 0x10000 || header.num_outchannels > 0x10000) {
+		close(fd);
+		return NULL;
+	}
+	num_ports = header.num_controls + header.num_inchannels + header.num_outchannels;
+	length = LADSPAcontrolLayout(header.num_controls, num_ports, &input, &output, &offset_meta);
+	if(header.length != length || header.input != input || header.output != output || header.meta != offset_meta
+	   || fstat(fd, &st) < 0 || (unsigned long)st.st_size < length) {
+		close(fd);
+		return NULL;
+	}
+	ptr = (LADSPA_Control*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(ptr == MAP_FAILED)
+		return NULL;
+
+	/* the description has to be of this very plugin, and up to date */
+	meta = LADSPAcontrolMeta(ptr);
+	if(!meta->valid
+	   || strncmp(meta->library, library, sizeof(meta->library))
+	   || strncmp(meta->label, label, sizeof(meta->label))
+	   || memchr(meta->label, 0, sizeof(meta->label)) == NULL
+	   || memchr(meta->name, 0, sizeof(meta->name)) == NULL
+	   || memchr(meta->path, 0, sizeof(meta->path)) == NULL
+	   || stat(meta->path, &st) < 0
+	   || meta->mtime != st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec
+	   || meta->size != st.st_size) {
+		munmap(ptr, length);
+		return NULL;
+	}
+	for(i = 0; i < num_ports; i++) {
+		if(ptr->data[i].index < 0 || (unsigned long)ptr->data[i].index >= meta->port_count
+		   || (i < ptr->num_controls && memchr(meta->port[i].name, 0, sizeof(meta->port[i].name)) == NULL)) {
+			munmap(ptr, length);
+			return NULL;
+		}
+	}
+	return ptr;
+}
+
+/* ------------------------------------------------------------------ */
+
+int LADSPAcontrolLatency(const LADSPA_Descriptor *psDescriptor,
+                         const LADSPA_Control *control)
+{
+	unsigned long i;
+	for(i = 0; i < control->num_controls; i++) {
+		const unsigned long index = control->data[i].index;
+		if(control->data[i].type != LADSPA_CNTRL_OUTPUT || index >= psDescriptor->PortCount)
+			continue;
+		if(!strcasecmp(psDescriptor->PortNames[index], "latency"))
+			return i;
+	}
+	return -1;
+}
+
+/* ------------------------------------------------------------------ */
+
+char * LADSPAcontrolPath(const char *controls_filename, int backend)
+{
+	char *filename = LADSPAcontrolFilename(controls_filename);
+	char *name, *path;
+	if(filename == NULL || backend != LADSPA_CNTRL_BACKEND_SHM)
+		return filename;
+	/* (where shm_open() keeps its objects) */
+	name = LADSPAcontrolShmName(filename);
+	free(filename);
+	if(name == NULL)
+		return NULL;
+	path = malloc(strlen(name) + sizeof("/dev/shm"));
+	if(path)
+		sprintf(path, "/dev/shm%s", name);
+	free(name);
+	return path;
+}
+
+int LADSPAcontrolWatch(const char *path)
+{
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(fd < 0)
+		return -1;
+	if(inotify_add_watch(fd, path, IN_ATTRIB | IN_MODIFY) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int LADSPAcontrolWatched(int fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	int found = 0;
+	while(read(fd, buf, sizeof(buf)) > 0)
+		found = 1;
+	return found;
+}
+
+void LADSPAcontrolNotify(const char *path)
+{
+	utimensat(AT_FDCWD, path, NULL, 0);
+}
+
+/* ------------------------------------------------------------------ */
+
+/* tries to take a consistent copy while the mixer is writing */
+#define LADSPA_CNTRL_SPINS 1000
+
+/* take the lock: become the writer, and make the sequence odd; return the (even) sequence it had
+ * a writer that is gone (e.g. it crashed in the middle of an update) doesn't count
+ * (but another thread of our own process does) */
+static unsigned int LADSPAcontrolLock(LADSPA_Control_Input *input)
+{
+	const unsigned int self = (unsigned int)getpid();
+	unsigned int seq, writer;
+	for(;;) {
+		writer = 0;
+		if(__atomic_compare_exchange_n(&input->writer, &writer, self, 0,
+		                               __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		if(writer != self && kill((pid_t)writer, 0) < 0 && ESRCH == errno
+		   && __atomic_compare_exchange_n(&input->writer, &writer, self, 0,
+		                                  __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+			break;
+		sched_yield();
+	}
+	/* (still odd if the previous writer died in the middle of an update) */
+	seq = __atomic_load_n(&input->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&input->seq, seq | 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return seq & ~1u;
+}
+static void LADSPAcontrolUnlock(LADSPA_Control_Input *input, unsigned int seq)
+{
+	__atomic_store_n(&input->seq, (seq | 1) + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&input->writer, 0, __ATOMIC_RELEASE);
+}
+
+void LADSPAcontrolWrite(LADSPA_Control *control, unsigned long index,
+                        LADSPA_Data value)
+{
+	LADSPA_Control_Input *input = LADSPAcontrolInput(control);
+	unsigned int seq;
+
+	if(index >= control->num_controls)
+		return;
+	seq = LADSPAcontrolLock(input);
+	input->value[index] = value;
+	LADSPAcontrolUnlock(input, seq);
+}
+
+void LADSPAcontrolBypass(LADSPA_Control *control, int bypass)
+{
+	LADSPA_Control_Input *input = LADSPAcontrolInput(control);
+	const unsigned int seq = LADSPAcontrolLock(input);
+	/* (the PCM reads it without taking the lock) */
+	__atomic_store_n(&input->bypass, (0 != bypass), __ATOMIC_RELAXED);
+	LADSPAcontrolUnlock(input, seq);
+}
+
+int LADSPAcontrolSnapshot(const LADSPA_Control *control,
+                          LADSPA_Data *values, LADSPA_Data *scratch,
+                          unsigned int *seq)
+{
+	const LADSPA_Control_Input *input = LADSPAcontrolInput(control);
+	unsigned long i;
+	int tries;
+
+	for(tries = 0; tries < 4; tries++) {
+		const unsigned int before = __atomic_load_n(&input->seq, __ATOMIC_ACQUIRE);
+		if(before == *seq)
+			return 1;
+		if(before & 1)
+			continue;
+		memcpy(scratch, input->value, control->num_controls * sizeof(LADSPA_Data));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&input->seq, __ATOMIC_RELAXED) != before)
+			continue;
+		for(i = 0; i < control->num_controls; i++)
+			if(control->data[i].type == LADSPA_CNTRL_INPUT)
+				values[i] = scratch[i];
+		*seq = before;
+		return 1;
+	}
+	return 0;
+}
+
+int LADSPAcontrolPersist(const LADSPA_Control *control, const char *filename,
+                         unsigned int *seq)
+{
+	const LADSPA_Control_Input *input = LADSPAcontrolInput(control);
+	const unsigned long length = control->length;
+	unsigned int before = 0;
+	char *copy, *tmpname;
+	int fd, tries, err = -1;
+
+	copy = malloc(length);
+	tmpname = malloc(strlen(filename) + 8);
+	if(copy == NULL || tmpname == NULL)
+		goto done;
+	/* (the mixer is never in the lock for long) */
+	for(tries = 0; tries < LADSPA_CNTRL_SPINS; tries++) {
+		before = __atomic_load_n(&input->seq, __ATOMIC_ACQUIRE);
+		if(before & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(copy, control, length);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if(__atomic_load_n(&input->seq, __ATOMIC_RELAXED) == before)
+			break;
+	}
+	if(tries == LADSPA_CNTRL_SPINS)
+		goto done;
+	/* (the writer might just be leaving: nobody holds the lock in the file) */
+	((LADSPA_Control_Input*)(copy + control->input))->writer = 0;
+
+	/* write it next to the file, and swap it in */
+	sprintf(tmpname, "%s.XXXXXX", filename);
+	fd = mkstemp(tmpname);
+	if(fd < 0)
+		goto done;
+	if(fchmod(fd, 0664) < 0 || write(fd, copy, length) != (ssize_t)length || fsync(fd) < 0) {
+		close(fd);
+		unlink(tmpname);
+		goto done;
+	}
+	close(fd);
+	if(rename(tmpname, filename) < 0) {
+		unlink(tmpname);
+		goto done;
+	}
+	*seq = before;
+	err = 0;
+ done:
+	if(err)
+		fprintf(stderr, "Failed to write controls file:%s.\n", filename);
+	free(tmpname);
+	free(copy);
+	return err;
+}
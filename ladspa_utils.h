@@ -12,7 +12,7 @@
    the library along the LADSPA_PATH, loads it with dlopen() and
    returns a plugin handle for use with findPluginDescriptor() or
    unloadLADSPAPluginLibrary(). Errors are handled by writing a
-   message to stderr and calling exit(1). It is alright (although
+   message to stderr and returning NULL. It is alright (although
    inefficient) to call this more than once for the same file. */
 void * LADSPAload(const char * pcPluginFilename);
 
@@ -21,7 +21,7 @@ void LADSPAunload(void * pvLADSPAPluginLibrary);
 
 /* This function locates a LADSPA plugin within a plugin library
    loaded with loadLADSPAPluginLibrary(). Errors are handled by
-   writing a message to stderr and calling exit(1). Note that the
+   writing a message to stderr and returning NULL. Note that the
    plugin library filename is only included to help provide
    informative error messages. */
 const LADSPA_Descriptor *
@@ -44,30 +44,168 @@ typedef struct _iemladspa_iochannels {
 
 
 
-/* MMAP to a controls file */
+/* MMAP to a controls file
+ *
+ * the file starts with a (read-only) header that describes the plugin's ports,
+ * followed by two regions that start on cache lines of their own:
+ * the inputs (written by the mixer) and the outputs (written by the PCM),
+ * so neither side keeps invalidating the other one's cache lines.
+ * the mixer writes the inputs under a sequence lock (see LADSPAcontrolWrite()),
+ * so the PCM can take a consistent snapshot of them (see LADSPAcontrolSnapshot()).
+ * the last region describes the plugin (names, ranges,...), so the mixer can do
+ * without loading it (see LADSPAcontrolMMAPmeta()).
+ * files of version 1 (released before the format had a magic number and a version,
+ * with the values in the port descriptions) are converted when they are opened.
+ * the versions in between were never released (files of them start over with the defaults). */
 #define LADSPA_CNTRL_INPUT	0
 #define LADSPA_CNTRL_OUTPUT	1
+#define LADSPA_CNTRL_MAGIC	0x6c6d6569 /* "ieml" */
+#define LADSPA_CNTRL_VERSION	4
+#define LADSPA_CNTRL_ALIGN	64         /* (a cache line) */
+#define LADSPA_CNTRL_NAMELEN	64         /* (including the terminating zero) */
+#define LADSPA_CNTRL_PATHLEN	256
 typedef struct LADSPA_Control_Data_ {
-	int index;
-	LADSPA_Data data;
-	int type;
+	int index; /* port of the ladspa-plugin */
+	int type;  /* LADSPA_CNTRL_INPUT/LADSPA_CNTRL_OUTPUT (controls only) */
 } LADSPA_Control_Data;
+/* written by the mixer */
+typedef struct LADSPA_Control_Input_ {
+	unsigned int seq;    /* odd while the mixer is writing */
+	unsigned int writer; /* pid of the mixer holding the lock (0: none) */
+	unsigned int bypass; /* !=0: the plugin is taken out of the signal path */
+	LADSPA_Data value[]; /* one per control (only the INPUT ones are used) */
+} LADSPA_Control_Input;
+/* written by the PCM */
+typedef struct LADSPA_Control_Output_ {
+	unsigned long latency; /* frames of delay through the PCM */
+	LADSPA_Data value[];   /* one per control (only the OUTPUT ones are used) */
+} LADSPA_Control_Output;
+/* written by whoever loaded the plugin to open the controls (the PCM, or a mixer
+ * that had to) */
+typedef struct LADSPA_Control_Port_ {
+	LADSPA_PortRangeHint hint;
+	char name[LADSPA_CNTRL_NAMELEN];
+} LADSPA_Control_Port;
+typedef struct LADSPA_Control_Meta_ {
+	unsigned int valid;    /* 0: the plugin couldn't be described (e.g. a name didn't fit) */
+	char library[LADSPA_CNTRL_PATHLEN]; /* the library (as configured) */
+	char path[LADSPA_CNTRL_PATHLEN];    /* the file it was loaded from */
+	long long mtime, size; /* of that file (when they change, this is stale) */
+	char label[LADSPA_CNTRL_NAMELEN];
+	char name[LADSPA_CNTRL_PATHLEN];
+	unsigned long port_count;
+	LADSPA_Control_Port port[]; /* one per control (in the order of data[]) */
+} LADSPA_Control_Meta;
 typedef struct LADSPA_Control_ {
+	unsigned int magic;
+	unsigned int version;
 	unsigned long length;
 	unsigned long id;
   iemladspa_iochannels_t sourcechannels; /* source device (e.g. microphone) channels */
   iemladspa_iochannels_t sinkchannels;   /* sink device (e.g. speaker) channels */
 
-	unsigned long num_controls;    /* number of controls in ladspa-plugin (input only?) */
+	unsigned long num_controls;    /* number of controls in ladspa-plugin (input and output) */
 
 	unsigned long num_inchannels;  /* number of input ports in ladspa-plugin */  // DEPRECATED, use sourcechannels.in+sinkchannels.in
   unsigned long num_outchannels; /* number of output ports in ladspa-plugin */ // DEPRECATED, use sourcechannels.out+sinkchannels.out
 
+  unsigned long input;           /* offset of the LADSPA_Control_Input (in bytes) */
+  unsigned long output;          /* offset of the LADSPA_Control_Output (in bytes) */
+  unsigned long meta;            /* offset of the LADSPA_Control_Meta (in bytes) */
+
 	LADSPA_Control_Data data[]; /* controls, inchannels, outchannels */
 } LADSPA_Control;
+
+static inline LADSPA_Control_Input *LADSPAcontrolInput(const LADSPA_Control *control) {
+  return (LADSPA_Control_Input*)((char*)control + control->input);
+}
+static inline LADSPA_Control_Output *LADSPAcontrolOutput(const LADSPA_Control *control) {
+  return (LADSPA_Control_Output*)((char*)control + control->output);
+}
+static inline const LADSPA_Control_Meta *LADSPAcontrolMeta(const LADSPA_Control *control) {
+  return (const LADSPA_Control_Meta*)((const char*)control + control->meta);
+}
+
+/* where the controls live while they are in use
+ * FILE: the controls file itself is mapped
+ * SHM:  a copy in POSIX shared memory (tmpfs) is mapped; the first one to open it
+ *       seeds it from the controls file, and whoever changes the settings writes
+ *       them back (see LADSPAcontrolPersist()), so the realtime path never touches
+ *       the filesystem */
+#define LADSPA_CNTRL_BACKEND_FILE	0
+#define LADSPA_CNTRL_BACKEND_SHM	1
+/* the backend called <name> ("file" or "shm"), or -1 */
+int LADSPAcontrolBackend(const char *name);
+
+/* the full path of a controls file (relative names live in ~/.config/ladspa.iem.at/,
+   which is created if needed); free() it, NULL on failure */
+char * LADSPAcontrolFilename(const char *controls_filename);
+
+/* <library> is the name the plugin was loaded by (see LADSPAload()) */
 LADSPA_Control * LADSPAcontrolMMAP(const LADSPA_Descriptor *psDescriptor,
+                                   const char *library,
                                    const char *controls_filename,
-                                   iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels);
+                                   iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels,
+                                   int backend);
+/* MMAP to a controls file that describes the plugin <label> of <library>,
+   without loading it. Return NULL (without complaining) if there is no such
+   file yet, or if its description is missing or stale (the library changed
+   since): the plugin has to be loaded then. */
+LADSPA_Control * LADSPAcontrolMMAPmeta(const char *library, const char *label,
+                                       const char *controls_filename,
+                                       iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels,
+                                       int backend);
 void LADSPAcontrolUnMMAP(LADSPA_Control *control);
+/* Remove the shared memory of a controls file (the next one to open it
+   seeds it from the file again). Return 0 on success, -1 otherwise. */
+int LADSPAcontrolShmUnlink(const char *controls_filename);
+
+/* Write a consistent copy of the controls to <filename> (replacing it
+   atomically, so a crash never leaves half a file behind), and store the
+   sequence number of the settings that were written in <*seq>.
+   Blocks on the filesystem: never call it from a realtime thread.
+   Return 0 on success, -1 otherwise. */
+int LADSPAcontrolPersist(const LADSPA_Control *control, const char *filename,
+                         unsigned int *seq);
+
+/* Change notifications
+ * stores into the mapping are invisible to the kernel, so whoever changes the
+ * controls (the mixer; the PCM when it publishes a new latency) touches the mapped
+ * object afterwards, which wakes up everybody who watches it (via inotify).
+ * (touching blocks on the filesystem: never do it from a realtime thread) */
+/* the object a controls file is mapped from (the file itself, or its shared
+   memory); free() it, NULL on failure */
+char * LADSPAcontrolPath(const char *controls_filename, int backend);
+/* a (non-blocking) file descriptor that becomes readable when <path> is
+   touched, or -1; close() it */
+int LADSPAcontrolWatch(const char *path);
+/* read the pending notifications from the <fd> returned by
+   LADSPAcontrolWatch(); return whether there were any */
+int LADSPAcontrolWatched(int fd);
+/* touch <path> */
+void LADSPAcontrolNotify(const char *path);
+
+/* Set the value of input control <index> (for the mixer).
+   Concurrent writers are serialized by the sequence lock. */
+void LADSPAcontrolWrite(LADSPA_Control *control, unsigned long index,
+                        LADSPA_Data value);
+/* Switch the bypass (for the mixer), under the same lock. */
+void LADSPAcontrolBypass(LADSPA_Control *control, int bypass);
+
+/* Copy the values of the input controls into <values> (num_controls of
+   them), if they changed since <*seq> (as returned by the previous
+   call), and update <*seq>. <scratch> holds as many values.
+   Never waits for the mixer (so it is safe to call from a realtime
+   thread): return 0 if a consistent copy couldn't be taken (<values>
+   are left untouched), 1 otherwise. */
+int LADSPAcontrolSnapshot(const LADSPA_Control *control,
+                          LADSPA_Data *values, LADSPA_Data *scratch,
+                          unsigned int *seq);
+
+/* Find the output control port named "latency" (where plugins report
+   their delay in frames). Return its index into control->data[] (and
+   the values), or -1 if the plugin has none. */
+int LADSPAcontrolLatency(const LADSPA_Descriptor *psDescriptor,
+                         const LADSPA_Control *control);
 
 #endif
@@ -0,0 +1,316 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* cost of the whole transfer path, without a soundcard
+ *
+ * usage: pcm_bench <library> <module> [frames]
+ *
+ * the LADSPA-plugin is set up as the PCM would do it, and iemladspa_transfer()
+ * is fed with synthetic (interleaved) channel areas, for every sample format,
+ * channel layout, stream mode and period size (16..8192).
+ * each line shows the time per frame, the frames per second and the CPU cycles
+ * per sample (of the plugin's inputs), and the cache and branch misses per
+ * period (if perf events are available; '-' otherwise).
+ * about <frames> frames (default: 262144) are transferred per line.
+ */
+
+/* we need the internals of the PCM */
+#include "pcm_iemladspa.c"
+
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#define BENCH_RATE 48000
+#define BENCH_MINPERIOD 16
+#define BENCH_MAXPERIOD 8192
+
+static const snd_pcm_format_t s_formats[] = { SND_PCM_FORMAT_S16, SND_PCM_FORMAT_FLOAT };
+
+/* which streams are open, and whether the application side is MONO */
+typedef struct _bench_mode {
+  const char *name;
+  int playback, capture;
+  int mono;
+} bench_mode_t;
+static const bench_mode_t s_modes[] = {
+  { "playback",      1, 0, 0 },
+  { "capture",       0, 1, 0 },
+  { "duplex",        1, 1, 0 },
+  { "playback-mono", 1, 0, 1 },
+  { "capture-mono",  0, 1, 1 },
+  { "duplex-mono",   1, 1, 1 },
+};
+
+/* hardware counters: cycles, cache misses, branch misses */
+#define BENCH_COUNTERS 3
+typedef struct _bench_perf {
+  int fd[BENCH_COUNTERS];
+} bench_perf_t;
+
+static int perf_open(uint32_t type, uint64_t config, int group) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = (group < 0);
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+}
+static void bench_perf_open(bench_perf_t *perf) {
+  static const uint64_t configs[BENCH_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+  };
+  int k;
+  perf->fd[0] = perf_open(PERF_TYPE_HARDWARE, configs[0], -1);
+  /* the others are only counted along with the cycles */
+  for(k = 1; k < BENCH_COUNTERS; k++)
+    perf->fd[k] = (perf->fd[0] >= 0)?perf_open(PERF_TYPE_HARDWARE, configs[k], perf->fd[0]):-1;
+}
+static void bench_perf_close(bench_perf_t *perf) {
+  int k;
+  for(k = 0; k < BENCH_COUNTERS; k++)
+    if(perf->fd[k] >= 0)
+      close(perf->fd[k]);
+}
+static void bench_perf_start(bench_perf_t *perf) {
+  if(perf->fd[0] < 0)
+    return;
+  ioctl(perf->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+  ioctl(perf->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+/* read the counters (-1: not available) */
+static void bench_perf_stop(bench_perf_t *perf, double *counts) {
+  int k;
+  if(perf->fd[0] >= 0)
+    ioctl(perf->fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+  for(k = 0; k < BENCH_COUNTERS; k++) {
+    uint64_t count;
+    counts[k] = -1.;
+    if(perf->fd[k] >= 0 && read(perf->fd[k], &count, sizeof(count)) == sizeof(count))
+      counts[k] = count;
+  }
+}
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* interleaved channel areas (and the memory behind them) */
+typedef struct _bench_areas {
+  snd_pcm_channel_area_t *areas;
+  void *data;
+} bench_areas_t;
+static int bench_areas_alloc(bench_areas_t *a, unsigned int channels, unsigned int frames,
+                             snd_pcm_format_t format) {
+  const unsigned int width = snd_pcm_format_physical_width(format);
+  unsigned int c;
+  a->areas = calloc(channels, sizeof(*a->areas));
+  a->data = calloc((size_t)frames * channels, width / 8);
+  if(!a->areas || !a->data)
+    return 0;
+  for(c = 0; c < channels; c++) {
+    a->areas[c].addr = a->data;
+    a->areas[c].first = c * width;
+    a->areas[c].step = channels * width;
+  }
+  /* some noise that doesn't trip the silence gate (or any denormal paths) */
+  for(c = 0; c < frames * channels; c++) {
+    const float v = ((c * 7919) % 2000) / 2000.f - .5f;
+    if(SND_PCM_FORMAT_FLOAT == format)
+      ((float*)a->data)[c] = v;
+    else
+      ((int16_t*)a->data)[c] = (int16_t)(v * 32767);
+  }
+  return 1;
+}
+static void bench_areas_free(bench_areas_t *a) {
+  free(a->areas);
+  free(a->data);
+}
+
+/* the plugin's audio inputs */
+static unsigned int bench_plugin_channels(const char *library, const char *module) {
+  void *lib = LADSPAload(library);
+  const LADSPA_Descriptor *klass = lib ? LADSPAfind(lib, library, module) : NULL;
+  unsigned int channels = 0;
+  unsigned long i;
+  if(!klass) {
+    if(lib)
+      LADSPAunload(lib);
+    return 0;
+  }
+  for(i = 0; i < klass->PortCount; i++)
+    if(klass->PortDescriptors[i] == (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO))
+      channels++;
+  LADSPAunload(lib);
+  return channels;
+}
+
+/* time the transfers of one setup; returns 0 if it cannot be set up */
+static int bench_run(const iemladspa_pluginconf_t *conf, iemladspa_iochannels_t layout,
+                     const bench_mode_t *mode, snd_pcm_format_t format,
+                     snd_pcm_uframes_t period, unsigned long frames, bench_perf_t *perf) {
+  const int streams[2] = { mode->playback?SND_PCM_STREAM_PLAYBACK:-1, mode->capture?SND_PCM_STREAM_CAPTURE:-1 };
+  iemladspa_iochannels_t sourcechannels = { layout.in, layout.in }, sinkchannels = { layout.out, layout.out };
+  bench_areas_t src[2], dst[2];
+  snd_pcm_iemladspa_t *iemladspa;
+  unsigned long done, periods = frames / period + 1;
+  double t, counts[BENCH_COUNTERS];
+  int k, ok = 1;
+
+  unlink(conf->controls);
+  iemladspa = iemladspa_mergeplugin_create(conf, conf, 1, NULL, sourcechannels, sinkchannels);
+  if(!iemladspa)
+    return 0;
+  iemladspa->worker.cpu = -1;
+  memset(src, 0, sizeof(src));
+  memset(dst, 0, sizeof(dst));
+
+  /* open the streams, as SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa) would */
+  for(k = 0; k < 2; k++) {
+    iemladspa_stream_t *stream;
+    unsigned int channels;
+    if(streams[k] < 0)
+      continue;
+    stream = &iemladspa->streamdir[streams[k]];
+    channels = (SND_PCM_STREAM_PLAYBACK == streams[k]) ? layout.in : layout.out;
+    stream->enabled = 1;
+    stream->ext.version = SND_PCM_EXTPLUG_VERSION;
+    stream->ext.name = "alsaiemladspa";
+    stream->ext.callback = &iemladspa_callback;
+    stream->ext.private_data = iemladspa;
+    stream->ext.stream = streams[k];
+    stream->ext.format = stream->ext.slave_format = format;
+    stream->ext.channels = mode->mono ? 1 : channels;
+    stream->ext.slave_channels = channels;
+    stream->ext.rate = BENCH_RATE;
+    iemladspa->usecount++;
+  }
+  /* hw_params and prepare */
+  for(k = 0; k < 2 && ok; k++) {
+    iemladspa_stream_t *stream;
+    if(streams[k] < 0)
+      continue;
+    stream = &iemladspa->streamdir[streams[k]];
+    ok = iemladspa_configure(&stream->ext, period) >= 0 && iemladspa_init(&stream->ext) >= 0
+      && bench_areas_alloc(&src[k], stream->plan.alsa_inchannels, period, format)
+      && bench_areas_alloc(&dst[k], stream->plan.alsa_outchannels, period, format);
+  }
+
+  if(ok) {
+    /* one round to get everything into the caches */
+    for(k = 0; k < 2; k++)
+      if(streams[k] >= 0)
+        iemladspa_transfer(&iemladspa->streamdir[streams[k]].ext, dst[k].areas, 0, src[k].areas, 0, period);
+
+    bench_perf_start(perf);
+    t = bench_now();
+    for(done = 0; done < periods; done++)
+      for(k = 0; k < 2; k++)
+        if(streams[k] >= 0)
+          iemladspa_transfer(&iemladspa->streamdir[streams[k]].ext, dst[k].areas, 0, src[k].areas, 0, period);
+    t = bench_now() - t;
+    bench_perf_stop(perf, counts);
+
+    frames = periods * period;
+    printf("  %-8s %3u %3u %-13s %5lu %9.2f %11.0f", snd_pcm_format_name(format), layout.in, layout.out,
+           mode->name, period, t * 1e9 / frames, frames / t);
+    if(counts[0] >= 0)
+      printf(" %8.2f", counts[0] / ((double)frames * iemladspa->layout.num_inchannels));
+    else
+      printf(" %8s", "-");
+    for(k = 1; k < BENCH_COUNTERS; k++) {
+      if(counts[k] >= 0)
+        printf(" %10.1f", counts[k] / periods);
+      else
+        printf(" %10s", "-");
+    }
+    printf("\n");
+    fflush(stdout);
+  }
+
+  for(k = 0; k < 2; k++) {
+    bench_areas_free(&src[k]);
+    bench_areas_free(&dst[k]);
+  }
+  /* the last close frees the instance */
+  for(k = 0; k < 2; k++)
+    if(streams[k] >= 0)
+      iemladspa_close(&iemladspa->streamdir[streams[k]].ext);
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  iemladspa_pluginconf_t conf;
+  iemladspa_iochannels_t layouts[3];
+  unsigned int num_layouts = 0, channels, f, l, m;
+  unsigned long frames = 1 << 18;
+  snd_pcm_uframes_t period;
+  char controls[64];
+  bench_perf_t perf;
+
+  if(argc < 3 || (argc > 3 && (frames = strtoul(argv[3], NULL, 10)) < 1)) {
+    fprintf(stderr, "usage: %s <library> <module> [frames]\n", argv[0]);
+    return 1;
+  }
+  memset(&conf, 0, sizeof(conf));
+  conf.library = argv[1];
+  conf.module = argv[2];
+  snprintf(controls, sizeof(controls), "/tmp/iemladspa-bench-%d.bin", (int)getpid());
+  conf.controls = controls;
+
+  /* split the plugin's channels evenly, and as lopsided as possible */
+  channels = bench_plugin_channels(conf.library, conf.module);
+  if(channels < 2) {
+    fprintf(stderr, "%s needs at least 2 audio inputs\n", conf.module);
+    return 1;
+  }
+  layouts[num_layouts].in = channels / 2;
+  layouts[num_layouts++].out = channels - channels / 2;
+  if(channels > 2) {
+    layouts[num_layouts].in = 1;
+    layouts[num_layouts++].out = channels - 1;
+    layouts[num_layouts].in = channels - 1;
+    layouts[num_layouts++].out = 1;
+  }
+
+  bench_perf_open(&perf);
+  printf("# plugin=%s:%s; rate=%d; kernels=%s; perf=%s\n", conf.library, conf.module, BENCH_RATE,
+         sample_kernels()->name, (perf.fd[0] >= 0)?"yes":"no");
+  printf("# %-8s %3s %3s %-13s %5s %9s %11s %8s %10s %10s\n", "format", "in", "out", "mode", "period",
+         "ns/frame", "frames/s", "cyc/smp", "cmiss/per", "bmiss/per");
+  for(f = 0; f < sizeof(s_formats) / sizeof(*s_formats); f++)
+    for(l = 0; l < num_layouts; l++)
+      for(m = 0; m < sizeof(s_modes) / sizeof(*s_modes); m++)
+        for(period = BENCH_MINPERIOD; period <= BENCH_MAXPERIOD; period *= 2)
+          if(!bench_run(&conf, layouts[l], &s_modes[m], s_formats[f], period, frames, &perf))
+            fprintf(stderr, "cannot set up %s %u+%u %s %lu\n", snd_pcm_format_name(s_formats[f]),
+                    layouts[l].in, layouts[l].out, s_modes[m].name, period);
+  bench_perf_close(&perf);
+  unlink(controls);
+  return 0;
+}
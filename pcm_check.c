@@ -0,0 +1,1302 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* conformance checks of the transfer path, without a soundcard
+ *
+ * usage: pcm_check <library>
+ *
+ * <library> are the reference plugins (iemladspa_reference.so, see reference_plugins.c).
+ * the plugins are set up as the PCM would do it, and fed through iemladspa_transfer():
+ *   kernels  : every optimized kernel set yields the very same bits as the scalar one
+ *   roundtrip: samples make it through a passthrough in every format and stream mode,
+ *              with interleaved and planar areas (within the precision of a float)
+ *   dupe     : MONO playback data ends up on every channel
+ *   mixdown  : MONO capture data is the sum of all channels
+ *   mute     : the inputs of a stream that isn't open are silent
+ *   blocks   : a blocksize delays the output by exactly the published latency,
+ *              whatever the transfers look like
+ *   resample : a plugin at its own rate gets the signal there and back, delayed by the
+ *              published latency, without the output ever running dry
+ *   gate     : the plugin doesn't run (and the output is silent) while the input is
+ *   controls : control values and the reported latency make it to and from the plugin,
+ *              controls files of the previous release are converted with their settings,
+ *              and the plugin is described for the mixer;
+ *              the lock of the controls outlives a mixer that is busy, but not one that is gone
+ *   replicate: the copies of a mono chain run in parallel, each on its own channel,
+ *              with the settings of the first copy, whose output controls are published
+ *   parts    : runs that are longer than the buffers between the plugins are split up
+ *   bypass   : a bypassed plugin is taken out of the signal path, and comes back after its latency
+ *   shm      : controls kept in shared memory are written back to the file on close
+ *   notify   : changing the controls wakes up whoever watches them (in either backend)
+ * prints one line per check; the exit code is the number of failed checks.
+ */
+
+/* we need the internals of the PCM */
+#include "pcm_iemladspa.c"
+
+#include <math.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define CHECK_RATE 48000
+#define CHECK_PERIOD 100 /* (not a multiple of any vector size) */
+
+static const snd_pcm_format_t s_formats[] = {
+  SND_PCM_FORMAT_S16, SND_PCM_FORMAT_S24, SND_PCM_FORMAT_S24_3LE,
+  SND_PCM_FORMAT_S32, SND_PCM_FORMAT_FLOAT, SND_PCM_FORMAT_FLOAT64
+};
+#define NUM_FORMATS (sizeof(s_formats) / sizeof(*s_formats))
+
+static const char *s_library;
+static char s_controls[64];
+static int s_backend = LADSPA_CNTRL_BACKEND_FILE;
+static int s_thread = 0;
+static unsigned int s_blocksize = 0;
+static unsigned int s_plugin_rate = 0;
+static unsigned int s_failures = 0;
+
+static void check(int ok, const char *fmt, ...) {
+  va_list ap;
+  printf("%-4s ", ok?"ok":"FAIL");
+  va_start(ap, fmt);
+  vprintf(fmt, ap);
+  va_end(ap);
+  printf("\n");
+  fflush(stdout);
+  if(!ok)
+    s_failures++;
+}
+
+/* deterministic noise in [-1, 1) */
+static double check_noise(unsigned int *state) {
+  *state = *state * 1664525u + 1013904223u;
+  return (*state >> 8) / 8388608. - 1.;
+}
+
+/* full scale of a format (1 for the floats) */
+static double format_scale(snd_pcm_format_t format) {
+  switch(format) {
+  case SND_PCM_FORMAT_S16:     return 32767.;
+  case SND_PCM_FORMAT_S24:
+  case SND_PCM_FORMAT_S24_3LE: return 8388607.;
+  case SND_PCM_FORMAT_S32:     return 2147483647.;
+  default:                     return 1.;
+  }
+}
+/* how far a sample may be off after a trip through a float (in its own units) */
+static double format_tolerance(snd_pcm_format_t format) {
+  switch(format) {
+  case SND_PCM_FORMAT_S16:
+  case SND_PCM_FORMAT_S24:
+  case SND_PCM_FORMAT_S24_3LE: return 1.;
+  case SND_PCM_FORMAT_S32:     return 256.;
+  default:                     return 0.;
+  }
+}
+/* a noise sample, exactly representable in <format> and in a float */
+static double format_noise(snd_pcm_format_t format, unsigned int *state) {
+  const double v = check_noise(state);
+  switch(format) {
+  case SND_PCM_FORMAT_S32:
+    return floor(v * 8388607.) * 256.;
+  case SND_PCM_FORMAT_FLOAT:
+  case SND_PCM_FORMAT_FLOAT64:
+    return (float)v;
+  default:
+    return floor(v * format_scale(format));
+  }
+}
+
+/* channel areas (and the memory behind them) */
+typedef struct _check_areas {
+  snd_pcm_channel_area_t *areas;
+  void *data;
+  unsigned int channels, frames;
+  snd_pcm_format_t format;
+} check_areas_t;
+static int check_areas_alloc(check_areas_t *a, unsigned int channels, unsigned int frames,
+                             snd_pcm_format_t format, int planar) {
+  const unsigned int width = snd_pcm_format_physical_width(format);
+  unsigned int c;
+  a->channels = channels;
+  a->frames = frames;
+  a->format = format;
+  a->areas = calloc(channels, sizeof(*a->areas));
+  a->data = calloc((size_t)frames * channels, width / 8);
+  if(!a->areas || !a->data)
+    return 0;
+  for(c = 0; c < channels; c++) {
+    a->areas[c].addr = a->data;
+    a->areas[c].first = planar ? c * frames * width : c * width;
+    a->areas[c].step = planar ? width : channels * width;
+  }
+  return 1;
+}
+static void check_areas_free(check_areas_t *a) {
+  free(a->areas);
+  free(a->data);
+  memset(a, 0, sizeof(*a));
+}
+/* the (unscaled) value of a sample */
+static double sample_get(const check_areas_t *a, unsigned int c, unsigned int i) {
+  const unsigned char *p = area_address(&a->areas[c], i);
+  int32_t v;
+  switch(a->format) {
+  case SND_PCM_FORMAT_S16:     return *(const int16_t*)p;
+  case SND_PCM_FORMAT_S24:     return (int32_t)((uint32_t)*(const int32_t*)p << 8) >> 8;
+  case SND_PCM_FORMAT_S24_3LE:
+    v = p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+    return (int32_t)((uint32_t)v << 8) >> 8;
+  case SND_PCM_FORMAT_S32:     return *(const int32_t*)p;
+  case SND_PCM_FORMAT_FLOAT:   return *(const float*)p;
+  case SND_PCM_FORMAT_FLOAT64: return *(const double*)p;
+  default:                     return 0.;
+  }
+}
+static void sample_set(check_areas_t *a, unsigned int c, unsigned int i, double value) {
+  unsigned char *p = area_address(&a->areas[c], i);
+  const int32_t v = (int32_t)value;
+  switch(a->format) {
+  case SND_PCM_FORMAT_S16:     *(int16_t*)p = v; break;
+  case SND_PCM_FORMAT_S24:
+  case SND_PCM_FORMAT_S32:     *(int32_t*)p = v; break;
+  case SND_PCM_FORMAT_S24_3LE: p[0] = v; p[1] = v >> 8; p[2] = v >> 16; break;
+  case SND_PCM_FORMAT_FLOAT:   *(float*)p = value; break;
+  case SND_PCM_FORMAT_FLOAT64: *(double*)p = value; break;
+  default: break;
+  }
+}
+static void check_areas_noise(check_areas_t *a, unsigned int seed) {
+  unsigned int c, i;
+  for(c = 0; c < a->channels; c++)
+    for(i = 0; i < a->frames; i++)
+      sample_set(a, c, i, format_noise(a->format, &seed));
+}
+/* largest difference between two sets of areas (of the same format) */
+static double check_areas_diff(const check_areas_t *a, unsigned int ca,
+                               const check_areas_t *b, unsigned int cb, unsigned int channels) {
+  double diff = 0.;
+  unsigned int c, i;
+  for(c = 0; c < channels; c++)
+    for(i = 0; i < a->frames; i++)
+      diff = fmax(diff, fabs(sample_get(a, ca + c, i) - sample_get(b, cb + c, i)));
+  return diff;
+}
+
+/* a PCM with the streams opened, as SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa) would do it */
+typedef struct _check_pcm {
+  snd_pcm_iemladspa_t *iemladspa;
+  int enabled[2];
+  check_areas_t src[2], dst[2];
+} check_pcm_t;
+
+/* open the streams of the (created) pcm->iemladspa, with <channels> channels each */
+static int check_pcm_setup(check_pcm_t *pcm, unsigned int channels,
+                           int playback, int capture, int mono, snd_pcm_format_t format, int planar) {
+  int k, ok = 1;
+  if(!pcm->iemladspa)
+    return 0;
+  pcm->iemladspa->worker.enabled = s_thread;
+  pcm->iemladspa->fifo.blocksize = s_blocksize;
+  pcm->iemladspa->resampling.rate = s_plugin_rate;
+  pcm->iemladspa->resampling.taps = 32;
+  pcm->iemladspa->worker.cpu = -1;
+  pcm->enabled[SND_PCM_STREAM_PLAYBACK] = playback;
+  pcm->enabled[SND_PCM_STREAM_CAPTURE] = capture;
+
+  for(k = 0; k < 2; k++) {
+    iemladspa_stream_t *stream = &pcm->iemladspa->streamdir[k];
+    if(!pcm->enabled[k])
+      continue;
+    stream->enabled = 1;
+    stream->ext.version = SND_PCM_EXTPLUG_VERSION;
+    stream->ext.name = "alsaiemladspa";
+    stream->ext.callback = &iemladspa_callback;
+    stream->ext.private_data = pcm->iemladspa;
+    stream->ext.stream = k;
+    stream->ext.format = stream->ext.slave_format = format;
+    stream->ext.channels = mono ? 1 : channels;
+    stream->ext.slave_channels = channels;
+    stream->ext.rate = CHECK_RATE;
+    pcm->iemladspa->usecount++;
+  }
+  /* hw_params and prepare */
+  for(k = 0; k < 2 && ok; k++) {
+    iemladspa_stream_t *stream = &pcm->iemladspa->streamdir[k];
+    if(!pcm->enabled[k])
+      continue;
+    ok = iemladspa_configure(&stream->ext, CHECK_PERIOD) >= 0 && iemladspa_init(&stream->ext) >= 0
+      && check_areas_alloc(&pcm->src[k], stream->plan.alsa_inchannels, CHECK_PERIOD, format, planar)
+      && check_areas_alloc(&pcm->dst[k], stream->plan.alsa_outchannels, CHECK_PERIOD, format, planar);
+  }
+  return ok;
+}
+/* open <module> with <channels> in- and outputs per stream;
+ * returns 0 if it cannot be set up */
+static int check_pcm_open(check_pcm_t *pcm, const char *module, unsigned int channels,
+                          int playback, int capture, int mono, snd_pcm_format_t format, int planar) {
+  iemladspa_iochannels_t sourcechannels = { channels, channels }, sinkchannels = { channels, channels };
+  iemladspa_pluginconf_t conf;
+
+  memset(pcm, 0, sizeof(*pcm));
+  memset(&conf, 0, sizeof(conf));
+  conf.library = s_library;
+  conf.module = module;
+  conf.controls = s_controls;
+  conf.backend = s_backend;
+  pcm->iemladspa = iemladspa_mergeplugin_create(&conf, &conf, 1, NULL, sourcechannels, sinkchannels);
+  return check_pcm_setup(pcm, channels, playback, capture, mono, format, planar);
+}
+/* open a chain of the mono <modules> (with controls files <controls>), replicated
+ * for each of the <channels> in- and outputs per stream, on a pool of <threads> threads */
+static int check_pcm_open_replicated(check_pcm_t *pcm, const char **modules, const char **controls,
+                                     unsigned int length, unsigned int channels, long threads) {
+  iemladspa_iochannels_t sourcechannels = { channels, channels }, sinkchannels = { channels, channels };
+  iemladspa_pluginconf_t *confs = calloc(length, sizeof(iemladspa_pluginconf_t));
+  iemladspa_graphconf_t graphconf;
+  unsigned int num_plugins = length, p;
+
+  memset(pcm, 0, sizeof(*pcm));
+  memset(&graphconf, 0, sizeof(graphconf));
+  if(!confs)
+    return 0;
+  for(p = 0; p < length; p++) {
+    confs[p].library = s_library;
+    confs[p].module = modules[p];
+    confs[p].controls = controls[p];
+    confs[p].backend = s_backend;
+  }
+  if(iemladspa_replicate_chain(&confs, &num_plugins, &graphconf, 2 * channels) < 0) {
+    iemladspa_pluginconfs_free(confs, num_plugins);
+    free(graphconf.outputs);
+    return 0;
+  }
+  graphconf.threads = threads;
+  pcm->iemladspa = iemladspa_mergeplugin_create(s_controls, confs, num_plugins, &graphconf,
+                                                sourcechannels, sinkchannels);
+  iemladspa_pluginconfs_free(confs, num_plugins);
+  free(graphconf.outputs);
+  return check_pcm_setup(pcm, channels, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+}
+static void check_pcm_close(check_pcm_t *pcm) {
+  int k;
+  for(k = 0; k < 2; k++) {
+    check_areas_free(&pcm->src[k]);
+    check_areas_free(&pcm->dst[k]);
+  }
+  /* the last close frees the instance */
+  for(k = 0; k < 2; k++)
+    if(pcm->enabled[k] && pcm->iemladspa)
+      iemladspa_close(&pcm->iemladspa->streamdir[k].ext);
+  /* (the next one starts with the defaults) */
+  unlink(s_controls);
+  LADSPAcontrolShmUnlink(s_controls);
+}
+/* one period of <stream>; returns whether all of it was transferred */
+static int check_pcm_transfer(check_pcm_t *pcm, snd_pcm_stream_t stream) {
+  return CHECK_PERIOD == iemladspa_transfer(&pcm->iemladspa->streamdir[stream].ext,
+                                            pcm->dst[stream].areas, 0, pcm->src[stream].areas, 0,
+                                            CHECK_PERIOD);
+}
+/* set an input control (as the mixer does) */
+static void check_pcm_set(check_pcm_t *pcm, unsigned int index, LADSPA_Data value) {
+  LADSPAcontrolWrite(pcm->iemladspa->plugins[0].control_data, index, value);
+}
+/* an output control, and the latency (as published by the PCM) */
+static LADSPA_Data check_pcm_get(check_pcm_t *pcm, unsigned int index) {
+  return LADSPAcontrolOutput(pcm->iemladspa->plugins[0].control_data)->value[index];
+}
+static unsigned long check_pcm_latency(check_pcm_t *pcm) {
+  return LADSPAcontrolOutput(pcm->iemladspa->plugins[0].control_data)->latency;
+}
+
+/* the (de)interleaving kernels of a set for <format> */
+static int check_kernels_get(const sample_kernels_t *kernels, snd_pcm_format_t format,
+                             deinterleave_fun_t **de, reinterleave_fun_t **re) {
+  switch(format) {
+  case SND_PCM_FORMAT_FLOAT:   *de = kernels->deinterleaveFLOAT;   *re = kernels->reinterleaveFLOAT;   break;
+  case SND_PCM_FORMAT_S16:     *de = kernels->deinterleaveS16;     *re = kernels->reinterleaveS16;     break;
+  case SND_PCM_FORMAT_S24:     *de = kernels->deinterleaveS24;     *re = kernels->reinterleaveS24;     break;
+  case SND_PCM_FORMAT_S24_3LE: *de = kernels->deinterleaveS24_3LE; *re = kernels->reinterleaveS24_3LE; break;
+  case SND_PCM_FORMAT_S32:     *de = kernels->deinterleaveS32;     *re = kernels->reinterleaveS32;     break;
+  case SND_PCM_FORMAT_FLOAT64: *de = kernels->deinterleaveFLOAT64; *re = kernels->reinterleaveFLOAT64; break;
+  default: return 0;
+  }
+  return 1;
+}
+
+/* kernels: the optimized kernels against the scalar ones, for odd channel and frame counts */
+static void check_kernels(void) {
+  const sample_kernels_t * const *list = sample_kernels_list();
+  static const unsigned int frames[] = { 1, 3, 7, 8, 15, 64, 67, 1000 };
+  const unsigned int maxframes = 1000, maxchannels = 33;
+  unsigned char *in = malloc((size_t)maxframes * maxchannels * sizeof(double));
+  unsigned char *ref = malloc((size_t)maxframes * maxchannels * sizeof(double));
+  unsigned char *out = malloc((size_t)maxframes * maxchannels * sizeof(double));
+  float *fin = malloc((size_t)maxframes * maxchannels * sizeof(float));
+  float *fref = malloc((size_t)maxframes * maxchannels * sizeof(float));
+  float *fout = malloc((size_t)maxframes * maxchannels * sizeof(float));
+  unsigned int k, f, channels, n, i;
+
+  for(k = 1; list[k]; k++) {
+    for(f = 0; f < NUM_FORMATS; f++) {
+      const snd_pcm_format_t format = s_formats[f];
+      const size_t width = snd_pcm_format_physical_width(format) / 8;
+      deinterleave_fun_t *de, *de_ref;
+      reinterleave_fun_t *re, *re_ref;
+      int same_de = 1, same_re = 1;
+      unsigned int seed = 1;
+
+      check_kernels_get(&sample_kernels_scalar, format, &de_ref, &re_ref);
+      check_kernels_get(list[k], format, &de, &re);
+
+      for(channels = 1; channels <= maxchannels; channels++) {
+        for(n = 0; n < sizeof(frames) / sizeof(*frames); n++) {
+          const size_t samples = (size_t)frames[n] * channels;
+          /* any bits (deinterleaving), and floats beyond full scale (reinterleaving) */
+          for(i = 0; i < samples * width; i++)
+            in[i] = check_noise(&seed) * 128;
+          for(i = 0; i < samples; i++)
+            fin[i] = check_noise(&seed) * 1.25;
+          if(SND_PCM_FORMAT_FLOAT == format || SND_PCM_FORMAT_FLOAT64 == format) {
+            /* no NaNs */
+            for(i = 0; i < samples; i++) {
+              if(SND_PCM_FORMAT_FLOAT == format)
+                ((float*)in)[i] = fin[i];
+              else
+                ((double*)in)[i] = fin[i];
+            }
+          }
+          de_ref(in, fref, frames[n], channels);
+          de(in, fout, frames[n], channels);
+          same_de = same_de && !memcmp(fref, fout, samples * sizeof(float));
+          re_ref(fin, ref, frames[n], channels);
+          re(fin, out, frames[n], channels);
+          same_re = same_re && !memcmp(ref, out, samples * width);
+        }
+      }
+      check(same_de, "kernels %s deinterleave %s", list[k]->name, snd_pcm_format_name(format));
+      check(same_re, "kernels %s reinterleave %s", list[k]->name, snd_pcm_format_name(format));
+    }
+  }
+  if(!list[1])
+    check(1, "kernels (scalar only)");
+  free(in); free(ref); free(out);
+  free(fin); free(fref); free(fout);
+}
+
+/* roundtrip: passthrough in every format and stream mode */
+static void check_roundtrip(void) {
+  static const char *modes[] = { "playback", "capture", "duplex" };
+  static const unsigned int channels[] = { 1, 2, 4, 8 };
+  unsigned int f, c, m, planar;
+  for(f = 0; f < NUM_FORMATS; f++) {
+    const snd_pcm_format_t format = s_formats[f];
+    for(planar = 0; planar < 2; planar++) {
+      for(m = 0; m < 3; m++) {
+        for(c = 0; c < sizeof(channels) / sizeof(*channels); c++) {
+          check_pcm_t pcm;
+          char module[32];
+          double diff = 0.;
+          int k, round, ok;
+          snprintf(module, sizeof(module), "passthrough_%u", 2 * channels[c]);
+          ok = check_pcm_open(&pcm, module, channels[c], m != 1, m != 0, 0, format, planar);
+          for(k = 0; k < 2 && ok; k++)
+            if(pcm.enabled[k])
+              check_areas_noise(&pcm.src[k], k + 1);
+          /* in duplex mode, the capture output is from the playback's run:
+           * with the same input twice, the second round has to match it */
+          for(round = 0; round < 2; round++)
+            for(k = 0; k < 2 && ok; k++)
+              if(pcm.enabled[k])
+                ok = check_pcm_transfer(&pcm, k);
+          for(k = 0; k < 2 && ok; k++)
+            if(pcm.enabled[k])
+              diff = fmax(diff, check_areas_diff(&pcm.src[k], 0, &pcm.dst[k], 0, channels[c]));
+          check(ok && diff <= format_tolerance(format), "roundtrip %s %s %s %u (off by %g)",
+                snd_pcm_format_name(format), planar?"planar":"interleaved", modes[m], channels[c], diff);
+          check_pcm_close(&pcm);
+        }
+      }
+    }
+  }
+}
+
+/* dupe: MONO playback data on all channels */
+static void check_dupe(void) {
+  unsigned int f, c;
+  for(f = 0; f < NUM_FORMATS; f++) {
+    const snd_pcm_format_t format = s_formats[f];
+    check_pcm_t pcm;
+    double diff = 0.;
+    int ok = check_pcm_open(&pcm, "passthrough_8", 4, 1, 0, 1, format, 0);
+    if(ok) {
+      check_areas_noise(&pcm.src[SND_PCM_STREAM_PLAYBACK], 3);
+      ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+      for(c = 0; c < 4; c++)
+        diff = fmax(diff, check_areas_diff(&pcm.src[SND_PCM_STREAM_PLAYBACK], 0,
+                                           &pcm.dst[SND_PCM_STREAM_PLAYBACK], c, 1));
+    }
+    check(ok && diff <= format_tolerance(format), "dupe %s (off by %g)", snd_pcm_format_name(format), diff);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* mixdown: MONO capture data is the sum of all channels
+ * (the expected sum is converted by the scalar kernels, as they are checked to be exact) */
+static void check_mixdown(void) {
+  const unsigned int channels = 4;
+  unsigned int f, c, i;
+  for(f = 0; f < NUM_FORMATS; f++) {
+    const snd_pcm_format_t format = s_formats[f];
+    check_pcm_t pcm;
+    check_areas_t expected;
+    float planar[CHECK_PERIOD * 4], mix[CHECK_PERIOD];
+    deinterleave_fun_t *de;
+    reinterleave_fun_t *re;
+    int ok;
+
+    memset(&expected, 0, sizeof(expected));
+    ok = check_pcm_open(&pcm, "passthrough_8", channels, 0, 1, 1, format, 0)
+      && check_areas_alloc(&expected, 1, CHECK_PERIOD, format, 0);
+    if(ok) {
+      check_areas_t *src = &pcm.src[SND_PCM_STREAM_CAPTURE];
+      check_areas_noise(src, 4);
+      /* a quarter of full scale, so the sum doesn't clip */
+      for(c = 0; c < channels; c++)
+        for(i = 0; i < CHECK_PERIOD; i++)
+          sample_set(src, c, i, floor(sample_get(src, c, i) / 4));
+      ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_CAPTURE);
+
+      check_kernels_get(&sample_kernels_scalar, format, &de, &re);
+      de(src->data, planar, CHECK_PERIOD, channels);
+      for(i = 0; i < CHECK_PERIOD; i++) {
+        mix[i] = planar[i];
+        for(c = 1; c < channels; c++)
+          mix[i] += planar[c * CHECK_PERIOD + i];
+      }
+      re(mix, expected.data, CHECK_PERIOD, 1);
+      ok = ok && !memcmp(expected.data, pcm.dst[SND_PCM_STREAM_CAPTURE].data,
+                         CHECK_PERIOD * snd_pcm_format_physical_width(format) / 8);
+    }
+    check(ok, "mixdown %s", snd_pcm_format_name(format));
+    check_areas_free(&expected);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* mute: with a matrix that sums up all inputs, only the open stream is heard
+ * (the inputs of the other stream are filled with garbage first) */
+static void check_mute(void) {
+  const unsigned int channels = 2, n = 2 * channels;
+  int k;
+  for(k = 0; k < 2; k++) {
+    check_pcm_t pcm;
+    check_areas_t *src, *dst;
+    double diff = 0.;
+    unsigned int c, j, i;
+    int ok = check_pcm_open(&pcm, "matrix_4", channels, k == SND_PCM_STREAM_PLAYBACK,
+                            k == SND_PCM_STREAM_CAPTURE, 0, SND_PCM_FORMAT_FLOAT, 0);
+    if(ok) {
+      snd_pcm_iemladspa_t *iemladspa = pcm.iemladspa;
+      float *inbuf = iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data;
+      src = &pcm.src[k];
+      dst = &pcm.dst[k];
+      for(j = 0; j < n * n; j++)
+        check_pcm_set(&pcm, j, 1.f);
+      for(i = 0; i < n * CHECK_PERIOD; i++)
+        inbuf[i] = 1000.f;
+      check_areas_noise(src, 5);
+      ok = check_pcm_transfer(&pcm, k);
+      for(j = 0; j < channels; j++) {
+        for(i = 0; i < CHECK_PERIOD; i++) {
+          float sum = 0.f;
+          for(c = 0; c < channels; c++)
+            sum += sample_get(src, c, i);
+          diff = fmax(diff, fabs(sum - sample_get(dst, j, i)));
+        }
+      }
+    }
+    check(ok && diff < 1e-5, "mute %s-only (off by %g)", k?"capture":"playback", diff);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* blocks: with a blocksize that doesn't divide the period, the output is the input
+ * delayed by exactly the published latency (blocksize - gcd(period, blocksize)),
+ * also across partial transfers, which make the FIFO run short blocks;
+ * every frame carries its own number, so none may be lost or repeated */
+static void check_blocks(void) {
+  static const unsigned int blocksizes[] = { 64, 40, 50 };
+  static const unsigned int sizes[] = { 100, 100, 37, 63, 100, 51, 49, 100, 13, 99, 100, 1, 100, 100 };
+  const unsigned int num_sizes = sizeof(sizes) / sizeof(*sizes);
+  unsigned int b;
+  for(b = 0; b < sizeof(blocksizes) / sizeof(*blocksizes); b++) {
+    const unsigned long expected = blocksizes[b] - gcd(CHECK_PERIOD, blocksizes[b]);
+    check_pcm_t pcm;
+    unsigned long latency = 0, frame = 0;
+    long delay = -1;
+    unsigned int round, t, i, errors = 0;
+    int short_block = 0;
+    int ok;
+    s_blocksize = blocksizes[b];
+    ok = check_pcm_open(&pcm, "passthrough_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+    s_blocksize = 0;
+    if(ok) {
+      check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+      latency = check_pcm_latency(&pcm);
+      for(round = 0; round < 4 && ok; round++) {
+        for(t = 0; t < num_sizes && ok; t++) {
+          const unsigned int n = sizes[t];
+          LADSPA_Data ran;
+          for(i = 0; i < n; i++) {
+            sample_set(src, 0, i, frame + i + 1.);
+            sample_set(src, 1, i, -(frame + i + 1.));
+          }
+          ok = n == iemladspa_transfer(&pcm.iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].ext,
+                                       dst->areas, 0, src->areas, 0, n);
+          for(i = 0; i < n && ok; i++, frame++) {
+            const double want = (frame < latency) ? 0. : frame - latency + 1.;
+            /* (the first frame is the impulse) */
+            if(delay < 0 && sample_get(dst, 0, i) == 1.)
+              delay = frame;
+            if(sample_get(dst, 0, i) != want || sample_get(dst, 1, i) != -want)
+              errors++;
+          }
+          /* (the plugin counts the frames it ran on) */
+          ran = check_pcm_get(&pcm, 1);
+          if((unsigned long)ran % blocksizes[b])
+            short_block = 1;
+        }
+      }
+    }
+    check(ok && expected == latency && delay == (long)latency && !errors && short_block,
+          "blocks of %u in periods of %u (latency %lu/%lu, delayed by %ld, %u frames off, short blocks: %d)",
+          blocksizes[b], CHECK_PERIOD, latency, expected, delay, errors, short_block);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* resample: a plugin at another rate passes DC and a sine (within the precision of
+ * the resamplers), delayed by the published latency; over many periods
+ * (of varying size), the resampled output never runs dry */
+static void check_resample(void) {
+  static const unsigned int rates[] = { 16000, 44100 };
+  static const unsigned int sizes[] = { 100, 100, 100, 37, 63, 1, 99 };
+  const unsigned int num_sizes = sizeof(sizes) / sizeof(*sizes);
+  const double freq = 200., amp = 0.5;
+  unsigned int r;
+  for(r = 0; r < sizeof(rates) / sizeof(*rates); r++) {
+    check_pcm_t pcm;
+    unsigned long latency = 0, frame = 0, settled = 0;
+    double dc = 1., sine = 1.;
+    unsigned int round, t, i;
+    int ok;
+    s_plugin_rate = rates[r];
+    ok = check_pcm_open(&pcm, "passthrough_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+    s_plugin_rate = 0;
+    ok = ok && pcm.iemladspa->resampling.active;
+    if(ok) {
+      check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+      latency = check_pcm_latency(&pcm);
+      /* (the filters need to fill up before the output is steady) */
+      settled = 2 * latency + 2 * 32 * CHECK_RATE / rates[r];
+      dc = sine = 0.;
+      for(round = 0; round < 100 && ok; round++) {
+        for(t = 0; t < num_sizes && ok; t++) {
+          const unsigned int n = sizes[t];
+          for(i = 0; i < n; i++) {
+            sample_set(src, 0, i, amp);
+            sample_set(src, 1, i, amp * sin(2 * M_PI * freq * (frame + i) / CHECK_RATE));
+          }
+          ok = n == iemladspa_transfer(&pcm.iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].ext,
+                                       dst->areas, 0, src->areas, 0, n);
+          for(i = 0; i < n; i++, frame++) {
+            if(frame < settled)
+              continue;
+            /* (running dry would leave silence) */
+            dc = fmax(dc, fabs(amp - sample_get(dst, 0, i)));
+            sine = fmax(sine, fabs(amp * sin(2 * M_PI * freq * ((double)frame - latency) / CHECK_RATE)
+                                   - sample_get(dst, 1, i)));
+          }
+        }
+      }
+    }
+    check(ok && latency && dc < 1e-3 && sine < 1e-2,
+          "resample %u>%u>%u (latency %lu, %lu frames, DC off by %g, sine off by %g)",
+          CHECK_RATE, rates[r], CHECK_RATE, latency, frame, dc, sine);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* gate: a silent period doesn't run the (passthrough) plugin, a loud one does */
+static void check_gate(void) {
+  check_pcm_t pcm;
+  check_areas_t *src, *dst;
+  double loud = 1., silent = 1., again = 1.;
+  LADSPA_Data start, ran_loud = 0, ran_silent = 1, ran_again = 0;
+  int ok = check_pcm_open(&pcm, "passthrough_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    snd_pcm_iemladspa_t *iemladspa = pcm.iemladspa;
+    iemladspa->gate.enabled = 1;
+    iemladspa->gate.threshold = 0.f;
+    iemladspa->gate.tail_ms = 0;
+    src = &pcm.src[SND_PCM_STREAM_PLAYBACK];
+    dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    start = check_pcm_get(&pcm, 1);
+
+    check_areas_noise(src, 6);
+    ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    loud = check_areas_diff(src, 0, dst, 0, 2);
+    ran_loud = check_pcm_get(&pcm, 1) - start;
+
+    memset(src->data, 0, CHECK_PERIOD * 2 * sizeof(float));
+    memset(dst->data, 0x55, CHECK_PERIOD * 2 * sizeof(float));
+    ok = ok && check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    silent = check_areas_diff(src, 0, dst, 0, 2);
+    ran_silent = check_pcm_get(&pcm, 1) - start - ran_loud;
+
+    check_areas_noise(src, 7);
+    ok = ok && check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    again = check_areas_diff(src, 0, dst, 0, 2);
+    ran_again = check_pcm_get(&pcm, 1) - start - ran_loud;
+  }
+  /* (the first run also publishes what the plugin did when it was warmed up) */
+  check(ok && !loud && !silent && !again && ran_loud >= CHECK_PERIOD && !ran_silent && CHECK_PERIOD == ran_again,
+        "gate (ran %g/%g/%g frames, off by %g/%g/%g)", ran_loud, ran_silent, ran_again, loud, silent, again);
+  check_pcm_close(&pcm);
+}
+
+/* a controls file of version 1 (as released, without a version) for gain_4 with 2+2 channels,
+ * with the 'Gain' at 0.25 */
+static int check_write_v1(unsigned long id) {
+  typedef struct { int index; LADSPA_Data data; int type; } data_v1_t;
+  struct {
+    unsigned long length, id;
+    iemladspa_iochannels_t sourcechannels, sinkchannels;
+    unsigned long num_controls, num_inchannels, num_outchannels;
+    data_v1_t data[9];
+  } v1;
+  FILE *f;
+  int j, ok;
+
+  /* 'Gain' (port 8), then 4 audio in- and 4 outputs */
+  memset(&v1, 0, sizeof(v1));
+  v1.length = offsetof(typeof(v1), data) + sizeof(v1.data);
+  v1.id = id;
+  v1.sourcechannels.in = v1.sourcechannels.out = v1.sinkchannels.in = v1.sinkchannels.out = 2;
+  v1.num_controls = 1;
+  v1.num_inchannels = v1.num_outchannels = 4;
+  v1.data[0].index = 8;
+  v1.data[0].data = 0.25f;
+  v1.data[0].type = LADSPA_CNTRL_INPUT;
+  for(j = 0; j < 8; j++)
+    v1.data[1 + j].index = j;
+  f = fopen(s_controls, "wb");
+  ok = f && fwrite(&v1, v1.length, 1, f) == 1;
+  if(f)
+    fclose(f);
+  return ok;
+}
+/* ... of version 2 (never released: the regions on cache lines of their own, but no description) */
+static int check_write_v2(unsigned long id) {
+  struct {
+    unsigned int magic, version;
+    unsigned long length, id;
+    iemladspa_iochannels_t sourcechannels, sinkchannels;
+    unsigned long num_controls, num_inchannels, num_outchannels, input, output;
+    LADSPA_Control_Data data[9];
+  } v2;
+  const unsigned long align = LADSPA_CNTRL_ALIGN - 1;
+  LADSPA_Control_Input *input;
+  char *buf;
+  FILE *f;
+  int j, ok;
+
+  memset(&v2, 0, sizeof(v2));
+  v2.magic = LADSPA_CNTRL_MAGIC;
+  v2.version = 2;
+  v2.id = id;
+  v2.sourcechannels.in = v2.sourcechannels.out = v2.sinkchannels.in = v2.sinkchannels.out = 2;
+  v2.num_controls = 1;
+  v2.num_inchannels = v2.num_outchannels = 4;
+  v2.input = (sizeof(v2) + align) & ~align;
+  v2.output = (v2.input + sizeof(LADSPA_Control_Input) + sizeof(LADSPA_Data) + align) & ~align;
+  v2.length = (v2.output + sizeof(LADSPA_Control_Output) + sizeof(LADSPA_Data) + align) & ~align;
+  v2.data[0].index = 8;
+  v2.data[0].type = LADSPA_CNTRL_INPUT;
+  for(j = 0; j < 8; j++)
+    v2.data[1 + j].index = j;
+  buf = calloc(1, v2.length);
+  if(!buf)
+    return 0;
+  memcpy(buf, &v2, sizeof(v2));
+  input = (LADSPA_Control_Input*)(buf + v2.input);
+  input->seq = 42;
+  input->value[0] = 0.25f;
+  f = fopen(s_controls, "wb");
+  ok = f && fwrite(buf, v2.length, 1, f) == 1;
+  if(f)
+    fclose(f);
+  free(buf);
+  return ok;
+}
+
+/* migration: a controls file of version 1 is converted, keeping its settings;
+ * one of a version that was never released starts over with the defaults */
+static void check_migration(void) {
+  void *lib = LADSPAload(s_library);
+  const LADSPA_Descriptor *klass = lib ? LADSPAfind(lib, s_library, "gain_4") : NULL;
+  const unsigned long id = klass ? klass->UniqueID : 0;
+  unsigned int old;
+  if(lib)
+    LADSPAunload(lib);
+  check(klass != NULL, "migration: found the plugin");
+  if(!klass)
+    return;
+
+  for(old = 1; old <= 2; old++) {
+    const double gain = (1 == old) ? 0.25 : 1.;
+    check_pcm_t pcm;
+    unsigned int version = 0;
+    double diff = 1.;
+    int ok = (1 == old) ? check_write_v1(id) : check_write_v2(id);
+
+    ok = ok && check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+    if(ok) {
+      check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+      unsigned int c, i;
+      version = pcm.iemladspa->plugins[0].control_data->version;
+      check_areas_noise(src, 9);
+      ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+      diff = 0.;
+      for(c = 0; c < 2; c++)
+        for(i = 0; i < CHECK_PERIOD; i++)
+          diff = fmax(diff, fabs(sample_get(src, c, i) * gain - sample_get(dst, c, i)));
+    }
+    check(ok && LADSPA_CNTRL_VERSION == version && !diff, "controls migration from version %u (version %u, gain %g, off by %g)",
+          old, version, gain, diff);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* lock: a mixer that holds the lock of the controls is waited for as long as it lives,
+ * and the lock is taken over once it is gone (even in the middle of an update) */
+static void *check_lock_write(void *control) {
+  LADSPAcontrolWrite(control, 0, 0.5f);
+  return NULL;
+}
+static void check_lock(void) {
+  check_pcm_t pcm;
+  pthread_t thread;
+  LADSPA_Data before = 0, after = 0;
+  unsigned int seq = 0;
+  int ok, waited = 0, started = 0;
+  pid_t child = -1;
+
+  ok = check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    LADSPA_Control *control = pcm.iemladspa->plugins[0].control_data;
+    LADSPA_Control_Input *input = LADSPAcontrolInput(control);
+    child = fork();
+    if(!child) {
+      pause();
+      _exit(0);
+    }
+    if(child > 0) {
+      /* the child took the lock, and is in the middle of an update */
+      input->writer = (unsigned int)child;
+      input->seq |= 1;
+      started = !pthread_create(&thread, NULL, check_lock_write, control);
+    }
+    if(started) {
+      usleep(50000);
+      before = input->value[0];
+      waited = (1 == before);
+      kill(child, SIGKILL);
+      waitpid(child, NULL, 0);
+      pthread_join(thread, NULL);
+      after = input->value[0];
+      seq = input->seq;
+    }
+  }
+  check(ok && started && waited && 0.5 == after && !(seq & 1) && !LADSPAcontrolInput(pcm.iemladspa->plugins[0].control_data)->writer,
+        "controls lock: waits for a live writer (%g), takes over from a dead one (%g)", before, after);
+  check_pcm_close(&pcm);
+}
+
+/* describe: the controls file tells the mixer about the plugin,
+ * as long as it is the configured one */
+static void check_describe(void) {
+  iemladspa_iochannels_t channels = { 2, 2 };
+  const LADSPA_Control_Meta *meta = NULL;
+  LADSPA_Control *control = NULL, *other = NULL, *moved = NULL;
+  check_pcm_t pcm;
+  int ok = check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    control = LADSPAcontrolMMAPmeta(s_library, "gain_4", s_controls, channels, channels, LADSPA_CNTRL_BACKEND_FILE);
+    other = LADSPAcontrolMMAPmeta(s_library, "gain_2", s_controls, channels, channels, LADSPA_CNTRL_BACKEND_FILE);
+    moved = LADSPAcontrolMMAPmeta("elsewhere.so", "gain_4", s_controls, channels, channels, LADSPA_CNTRL_BACKEND_FILE);
+  }
+  if(control)
+    meta = LADSPAcontrolMeta(control);
+  check(meta && !other && !moved && !strcmp(meta->label, "gain_4") && !strcmp(meta->port[0].name, "Gain")
+        && 2. == meta->port[0].hint.UpperBound,
+        "controls describe the plugin (%s)", meta?meta->port[0].name:"-");
+  if(control)
+    LADSPAcontrolUnMMAP(control);
+  if(other)
+    LADSPAcontrolUnMMAP(other);
+  if(moved)
+    LADSPAcontrolUnMMAP(moved);
+  check_pcm_close(&pcm);
+}
+
+/* controls: the gain is applied, the FIR's latency is published (and it passes DC) */
+static void check_controls(void) {
+  check_pcm_t pcm;
+  double diff = 1.;
+  unsigned int c, i;
+  int ok = check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    check_pcm_set(&pcm, 0, 0.5f);
+    check_areas_noise(src, 8);
+    ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    diff = 0.;
+    for(c = 0; c < 2; c++)
+      for(i = 0; i < CHECK_PERIOD; i++)
+        diff = fmax(diff, fabs(sample_get(src, c, i) * 0.5 - sample_get(dst, c, i)));
+  }
+  check(ok && !diff, "controls gain (off by %g)", diff);
+  check_pcm_close(&pcm);
+
+  diff = 1.;
+  ok = check_pcm_open(&pcm, "fir_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    check_pcm_set(&pcm, 0, 65);
+    for(c = 0; c < 2; c++)
+      for(i = 0; i < CHECK_PERIOD; i++)
+        sample_set(src, c, i, 0.5);
+    ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK) && check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    diff = 0.;
+    for(c = 0; c < 2; c++)
+      for(i = 0; i < CHECK_PERIOD; i++)
+        diff = fmax(diff, fabs(0.5 - sample_get(dst, c, i)));
+    ok = ok && (32 == check_pcm_latency(&pcm));
+  }
+  check(ok && diff < 1e-4, "controls fir (latency %lu, off by %g)",
+        pcm.iemladspa?check_pcm_latency(&pcm):0, diff);
+  check_pcm_close(&pcm);
+}
+
+/* replicate: a chain of gain_1 and passthrough_1, copied for each of 16 channels
+ * (so the copies run on the pool); every channel gets the gain,
+ * and only the first copy of the passthrough publishes what it counted */
+static void check_replicate(void) {
+  static const char *modules[] = { "gain_1", "passthrough_1" };
+  const char *controls[2];
+  const unsigned int channels = 8, periods = 4;
+  char second[80];
+  check_pcm_t pcm;
+  double diff = 1.;
+  LADSPA_Data frames = 0;
+  unsigned long latency = 1;
+  unsigned int c, i, n;
+  int ok;
+
+  snprintf(second, sizeof(second), "%s.1", s_controls);
+  controls[0] = s_controls;
+  controls[1] = second;
+  ok = check_pcm_open_replicated(&pcm, modules, controls, 2, channels, 3);
+  ok = ok && pcm.iemladspa->graph && pcm.iemladspa->graph->deque;
+  if(ok) {
+    check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    const LADSPA_Control_Output *published = LADSPAcontrolOutput(pcm.iemladspa->plugins[1].control_data);
+    check_pcm_set(&pcm, 0, 0.5f);
+    diff = 0.;
+    for(n = 0; n < periods && ok; n++) {
+      check_areas_noise(src, 20 + n);
+      ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+      for(c = 0; c < channels; c++)
+        for(i = 0; i < CHECK_PERIOD; i++)
+          diff = fmax(diff, fabs(sample_get(src, c, i) * 0.5 - sample_get(dst, c, i)));
+    }
+    frames = published->value[1];
+    latency = check_pcm_latency(&pcm);
+  }
+  /* (the warmup ran it on a period of silence before) */
+  check(ok && !diff && (periods + 1) * CHECK_PERIOD == frames && !latency,
+        "replicate %u channels (published %g frames, latency %lu, off by %g)",
+        2 * channels, frames, latency, diff);
+  check_pcm_close(&pcm);
+  unlink(second);
+  LADSPAcontrolShmUnlink(second);
+}
+
+/* parts: a run longer than the buffers between the plugins is done in parts
+ * (rather than skipped) */
+static void check_parts(void) {
+  static const char *modules[] = { "gain_1", "passthrough_1" };
+  const char *controls[2];
+  const unsigned int channels = 2, frames = 7 * CHECK_PERIOD / 2;
+  char second[80];
+  check_pcm_t pcm;
+  LADSPA_Data *buf = NULL, *inports[4], *outports[4];
+  unsigned int state = 11, c, i;
+  double diff = 1.;
+  int ok;
+
+  snprintf(second, sizeof(second), "%s.1", s_controls);
+  controls[0] = s_controls;
+  controls[1] = second;
+  ok = check_pcm_open_replicated(&pcm, modules, controls, 2, channels, 0)
+    && (buf = calloc(4 * 2 * frames, sizeof(LADSPA_Data)));
+  if(ok) {
+    for(c = 0; c < 2 * channels; c++) {
+      inports[c] = buf + c * frames;
+      outports[c] = buf + (2 * channels + c) * frames;
+      for(i = 0; i < frames; i++)
+        inports[c][i] = check_noise(&state);
+    }
+    iemladspa_run(pcm.iemladspa, inports, outports, frames);
+    diff = 0.;
+    for(c = 0; c < 2 * channels; c++)
+      for(i = 0; i < frames; i++)
+        diff = fmax(diff, fabs(inports[c][i] - outports[c][i]));
+  }
+  check(ok && !diff, "a run of %u frames in parts of %lu (off by %g)",
+        frames, ok ? pcm.iemladspa->graph->wires.frames : 0, diff);
+  free(buf);
+  check_pcm_close(&pcm);
+  unlink(second);
+  LADSPAcontrolShmUnlink(second);
+}
+
+/* bypass: while fir_4 is bypassed, the input is passed through as it is;
+ * once it is back, the input is passed on for the plugin's latency,
+ * and then faded over to what the plugin (compared against one that was never bypassed) puts out */
+static void check_bypass(void) {
+  const unsigned int channels = 2, periods = 8;
+  char controls[sizeof(s_controls)], reference[sizeof(s_controls)];
+  check_pcm_t pcm, ref;
+  unsigned long latency = 0, since = 0;
+  double dry = 1., waited = 1., wet = 1.;
+  unsigned int n, c, i;
+  int ok, active = 0, bypassed;
+
+  /* (the reference gets controls of its own) */
+  memcpy(controls, s_controls, sizeof(controls));
+  snprintf(reference, sizeof(reference), "%.*s.ref", (int)sizeof(reference) - 5, s_controls);
+  ok = check_pcm_open(&pcm, "fir_4", channels, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  memcpy(s_controls, reference, sizeof(s_controls));
+  ok = check_pcm_open(&ref, "fir_4", channels, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0) && ok;
+  memcpy(s_controls, controls, sizeof(s_controls));
+  if(ok) {
+    check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    LADSPA_Control *control = pcm.iemladspa->plugins[0].control_data;
+    check_pcm_set(&pcm, 0, 65);
+    check_pcm_set(&ref, 0, 65);
+    dry = waited = wet = 0.;
+    /* wet, bypassed, and wet again */
+    for(n = 0; n < 3 * periods && ok; n++) {
+      if(n == periods)
+        LADSPAcontrolBypass(control, 1);
+      if(n == 2 * periods) {
+        LADSPAcontrolBypass(control, 0);
+        latency = check_pcm_latency(&pcm);
+        since = 0;
+      }
+      check_areas_noise(src, 30 + n);
+      memcpy(ref.src[SND_PCM_STREAM_PLAYBACK].data, src->data, CHECK_PERIOD * channels * sizeof(float));
+      /* (once the plugin is faded out) */
+      bypassed = __atomic_load_n(&pcm.iemladspa->bypass.active, __ATOMIC_RELAXED);
+      ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK) && check_pcm_transfer(&ref, SND_PCM_STREAM_PLAYBACK);
+      if(n >= periods && n < 2 * periods && bypassed) {
+        active = 1;
+        dry = fmax(dry, check_areas_diff(src, 0, dst, 0, channels));
+      }
+      if(n < 2 * periods)
+        continue;
+      for(i = 0; i < CHECK_PERIOD; i++, since++) {
+        for(c = 0; c < channels; c++) {
+          if(since < latency)
+            waited = fmax(waited, fabs(sample_get(src, c, i) - sample_get(dst, c, i)));
+          else if(since >= latency + BYPASS_FADE)
+            wet = fmax(wet, fabs(sample_get(&ref.dst[SND_PCM_STREAM_PLAYBACK], c, i) - sample_get(dst, c, i)));
+        }
+      }
+    }
+  }
+  check(ok && active && !dry && latency && waited < 1e-6 && !wet && since > latency + BYPASS_FADE,
+        "bypass (latency %lu, dry off by %g, then %g while waiting, wet off by %g)",
+        latency, dry, waited, wet);
+  check_pcm_close(&ref);
+  unlink(reference);
+  LADSPAcontrolShmUnlink(reference);
+  check_pcm_close(&pcm);
+}
+
+/* worker: in duplex, the worker keeps running when the capture stream is (re)configured
+ * after the playback stream (which runs the plugin) has been prepared */
+static void check_worker(void) {
+  check_pcm_t pcm;
+  int ok, opened, reconfigured = 0;
+  s_thread = 1;
+  ok = check_pcm_open(&pcm, "gain_4", 2, 1, 1, 0, SND_PCM_FORMAT_FLOAT, 0);
+  s_thread = 0;
+  opened = ok && pcm.iemladspa->worker.running;
+  if(ok)
+    reconfigured = iemladspa_configure(&pcm.iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].ext, CHECK_PERIOD) >= 0
+      && iemladspa_init(&pcm.iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].ext) >= 0
+      && pcm.iemladspa->worker.running;
+  check(opened && reconfigured, "worker survives the other stream's hw_params (%d/%d)", opened, reconfigured);
+  check_pcm_close(&pcm);
+}
+
+/* stats: a record has a single writer (until it is done, or gone),
+ * and the load includes the time spent by the worker thread */
+static void check_stats(void) {
+  char *name = stats_name(s_controls);
+  stats_t *a = name?stats_map(name, 1):NULL, *b = name?stats_map(name, 1):NULL;
+  stats_meter_t first, second;
+  stats_stream_t copy;
+  int claimed = 0, refused = 0, taken = 0, stale = 0, consistent = 0;
+  unsigned int load = 0;
+  pid_t child;
+
+  memset(&first, 0, sizeof(first));
+  memset(&second, 0, sizeof(second));
+  if(a && b) {
+    stats_meter_config(&first, &a->stream[0], CHECK_RATE, CHECK_PERIOD);
+    stats_meter_config(&second, &b->stream[0], CHECK_RATE, CHECK_PERIOD);
+    claimed = (NULL != first.shared);
+    refused = (NULL == second.shared);
+    stats_meter_close(&first);
+    stats_meter_config(&second, &b->stream[0], CHECK_RATE, CHECK_PERIOD);
+    taken = (NULL != second.shared);
+    /* the worker thread spent half of the period on it */
+    stats_meter_start(&second);
+    stats_meter_lap(&second, STATS_RUN);
+    stats_meter_offload(&second, CHECK_PERIOD * 500000000ULL / CHECK_RATE);
+    stats_meter_stop(&second, CHECK_PERIOD);
+    if(stats_read(a, 0, &copy))
+      load = copy.load;
+    stats_meter_close(&second);
+    /* a writer that died in the middle of an update */
+    child = fork();
+    if(!child)
+      _exit(0);
+    if(child > 0 && waitpid(child, NULL, 0) == child) {
+      a->stream[1].writer = (uint32_t)child;
+      a->stream[1].seq = 1;
+      stats_meter_config(&first, &a->stream[1], CHECK_RATE, CHECK_PERIOD);
+      stale = (NULL != first.shared);
+      consistent = stats_read(b, 1, &copy) && CHECK_PERIOD == copy.period;
+      stats_meter_close(&first);
+    }
+  }
+  check(claimed && refused && taken, "stats: a single writer (%d/%d/%d)", claimed, refused, taken);
+  check(stale && consistent, "stats: taken over from a dead writer (%d/%d)", stale, consistent);
+  check(load >= 490 && load < 600, "stats: the worker's time counts towards the load (%u)", load);
+  stats_unmap(a);
+  stats_unmap(b);
+  if(name)
+    stats_unlink(name);
+  free(name);
+}
+
+/* shm: a gain set in shared memory is written back to the controls file,
+ * and used by the next one that opens the file */
+static void check_shm(void) {
+  check_pcm_t pcm;
+  double diff = 1.;
+  unsigned int c, i;
+  int ok;
+
+  s_backend = LADSPA_CNTRL_BACKEND_SHM;
+  ok = check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0)
+    && iemladspa_persist_start(pcm.iemladspa) >= 0;
+  if(ok)
+    check_pcm_set(&pcm, 0, 0.5f);
+  s_backend = LADSPA_CNTRL_BACKEND_FILE;
+  /* (keep the file, but forget the shared memory) */
+  for(c = 0; c < 2; c++) {
+    check_areas_free(&pcm.src[c]);
+    check_areas_free(&pcm.dst[c]);
+    if(pcm.enabled[c] && pcm.iemladspa)
+      iemladspa_close(&pcm.iemladspa->streamdir[c].ext);
+  }
+  LADSPAcontrolShmUnlink(s_controls);
+
+  ok = ok && check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+  if(ok) {
+    check_areas_t *src = &pcm.src[SND_PCM_STREAM_PLAYBACK], *dst = &pcm.dst[SND_PCM_STREAM_PLAYBACK];
+    check_areas_noise(src, 10);
+    ok = check_pcm_transfer(&pcm, SND_PCM_STREAM_PLAYBACK);
+    diff = 0.;
+    for(c = 0; c < 2; c++)
+      for(i = 0; i < CHECK_PERIOD; i++)
+        diff = fmax(diff, fabs(sample_get(src, c, i) * 0.5 - sample_get(dst, c, i)));
+  }
+  check(ok && !diff, "controls in shared memory (off by %g)", diff);
+  check_pcm_close(&pcm);
+}
+
+/* notify: a watcher is woken up by a change (once), and not without one */
+static void check_notify(void) {
+  static const char *backends[] = { "file", "shm" };
+  int backend;
+  for(backend = 0; backend < 2; backend++) {
+    check_pcm_t pcm;
+    char *path = NULL;
+    int fd = -1, before = -1, woken = -1, after = -1;
+    int ok;
+    s_backend = backend;
+    ok = check_pcm_open(&pcm, "gain_4", 2, 1, 0, 0, SND_PCM_FORMAT_FLOAT, 0);
+    s_backend = LADSPA_CNTRL_BACKEND_FILE;
+    if(ok) {
+      path = LADSPAcontrolPath(s_controls, backend);
+      fd = path?LADSPAcontrolWatch(path):-1;
+    }
+    if(fd >= 0) {
+      before = LADSPAcontrolWatched(fd);
+      check_pcm_set(&pcm, 0, 0.5f);
+      LADSPAcontrolNotify(path);
+      woken = LADSPAcontrolWatched(fd);
+      after = LADSPAcontrolWatched(fd);
+      close(fd);
+    }
+    check(0 == before && 1 == woken && 0 == after, "notify %s (%d/%d/%d)",
+          backends[backend], before, woken, after);
+    free(path);
+    check_pcm_close(&pcm);
+  }
+}
+
+/* index: a plugin is found by its label or its UniqueID alone (and then from the index);
+ * a plugin that is missing doesn't make every lookup scan again,
+ * and a library added earlier along the path takes over */
+static void check_index(void) {
+  char home[] = "/tmp/iemladspa-check-XXXXXX";
+  char *dir = strdup(s_library), *slash = strrchr(dir, '/');
+  char *oldhome = getenv("HOME") ? strdup(getenv("HOME")) : NULL;
+  char *oldpath = getenv("LADSPA_PATH") ? strdup(getenv("LADSPA_PATH")) : NULL;
+  char *library[3] = { NULL, NULL, NULL }, *label[3] = { NULL, NULL, NULL };
+  char *index = NULL, id[32], early[64], path[1024], shadow[128];
+  void *lib = LADSPAload(s_library);
+  const LADSPA_Descriptor *klass = lib ? LADSPAfind(lib, s_library, "gain_4") : NULL;
+  int err[3] = { -1, -1, -1 }, missing = 0, indexed = 0, rescanned = 1;
+  struct stat before, after;
+  unsigned int i;
+
+  snprintf(id, sizeof(id), "%lu", klass ? klass->UniqueID : 0);
+  if(lib)
+    LADSPAunload(lib);
+  if(slash && mkdtemp(home)) {
+    *slash = 0;
+    snprintf(early, sizeof(early), "%s/early", home);
+    snprintf(path, sizeof(path), "%s:%s", early, dir);
+    snprintf(shadow, sizeof(shadow), "%s/shadow.so", early);
+    mkdir(early, 0755);
+    setenv("HOME", home, 1);
+    setenv("LADSPA_PATH", path, 1);
+    err[0] = ladspa_index_find("gain_4", &library[0], &label[0]);
+    index = LADSPAcontrolFilename("ladspa.index");
+    indexed = index && !stat(index, &before);
+    err[1] = ladspa_index_find(id, &library[1], &label[1]);
+    missing = ladspa_index_find("no_such_plugin", &library[2], &label[2]);
+    missing = missing ? missing : ladspa_index_find("no_such_plugin", &library[2], &label[2]);
+    rescanned = !indexed || stat(index, &after) || before.st_ino != after.st_ino;
+    /* (directory mtimes are only as fine as the kernel's clock ticks) */
+    usleep(20000);
+    if(!symlink(s_library, shadow))
+      err[2] = ladspa_index_find("gain_4", &library[2], &label[2]);
+    unlink(shadow);
+    rmdir(early);
+    if(index) {
+      unlink(index);
+      *strrchr(index, '/') = 0;
+      rmdir(index);
+      *strrchr(index, '/') = 0;
+      rmdir(index);
+    }
+    rmdir(home);
+    if(oldhome)
+      setenv("HOME", oldhome, 1);
+    if(oldpath)
+      setenv("LADSPA_PATH", oldpath, 1);
+    else
+      unsetenv("LADSPA_PATH");
+  }
+  check(!err[0] && !strcmp(library[0], s_library) && !strcmp(label[0], "gain_4") && indexed,
+        "index: found by label (%s)", library[0] ? library[0] : "-");
+  check(!err[1] && !strcmp(library[1], s_library) && !strcmp(label[1], "gain_4"),
+        "index: found by id (%s)", id);
+  check(-ENOENT == missing && !rescanned, "index: unknown plugin (%d, rescanned: %d)", missing, rescanned);
+  check(!err[2] && !strcmp(library[2], shadow), "index: the first library along the path wins (%s)",
+        library[2] ? library[2] : "-");
+  for(i = 0; i < 3; i++) {
+    free(library[i]);
+    free(label[i]);
+  }
+  free(index);
+  free(oldhome);
+  free(oldpath);
+  free(dir);
+}
+
+int main(int argc, char **argv)
+{
+  if(argc < 2) {
+    fprintf(stderr, "usage: %s <library>\n", argv[0]);
+    return 1;
+  }
+  s_library = argv[1];
+  snprintf(s_controls, sizeof(s_controls), "/tmp/iemladspa-check-%d.bin", (int)getpid());
+  unlink(s_controls);
+
+  printf("# kernels=%s\n", sample_kernels()->name);
+  check_kernels();
+  check_roundtrip();
+  check_dupe();
+  check_mixdown();
+  check_mute();
+  check_gate();
+  check_blocks();
+  check_resample();
+  check_controls();
+  check_bypass();
+  check_migration();
+  check_lock();
+  check_describe();
+  check_replicate();
+  check_parts();
+  check_worker();
+  check_stats();
+  check_shm();
+  check_notify();
+  check_index();
+
+  printf("# %u failed\n", s_failures);
+  return (s_failures > 255) ? 255 : s_failures;
+}
@@ -20,6 +20,10 @@
  * along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE
+#endif
+
 /* nomenclature of in/out,...
  *    inchannel    : read-only "input" data (as produced by a microphone or an application, before being passed to us)
  *    outchannel   : write-only "output" data (will be send to soundcard or an application, generated by us)
@@ -34,6 +38,12 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <time.h>
 #include <alsa/asoundlib.h>
 #include <alsa/pcm.h>
 #include <alsa/pcm_external.h>
@@ -41,6 +51,11 @@
 #include <linux/soundcard.h>
 #include <ladspa.h>
 #include "ladspa_utils.h"
+#include "ladspa_index.h"
+#include "sample_utils.h"
+#include "resample.h"
+#include "workpool.h"
+#include "stats.h"
 
 #if 0
 # define DEBUG printf("%s:%d %s\t", __FILE__, __LINE__, __FUNCTION__), printf
@@ -48,6 +63,7 @@
 # define DEBUG(...)
 #endif
 
+/* a view into the arena */
 typedef struct _iemladspa_audiobuf {
   unsigned int frames;
   unsigned int channels;
@@ -55,21 +71,263 @@ typedef struct _iemladspa_audiobuf {
   float *data;
 } iemladspa_audiobuf_t;
 
+/* a single aligned, pre-faulted (and optionally locked) block of memory
+ * that holds all the audio buffers of an instance */
+typedef struct _iemladspa_arena {
+  void  *data;
+  size_t size;
+  int    lock;   /* whether to mlock() the memory */
+  int    locked; /* whether the memory is actually locked */
+} iemladspa_arena_t;
+
+/* memory layout of the ALSA channel areas on one side of a transfer */
+typedef enum {
+  AREAS_UNKNOWN = 0,
+  AREAS_INTERLEAVED, /* plain interleaved samples */
+  AREAS_PLANAR,      /* each channel is a contiguous block of samples */
+  AREAS_COMPLEX      /* anything else */
+} iemladspa_areashape_t;
+
+typedef struct _iemladspa_areas {
+  /* the areas the shape was determined for */
+  const void *addr;
+  unsigned int first;
+  unsigned int step;
+  iemladspa_areashape_t shape;
+} iemladspa_areas_t;
+
+/* everything a transfer needs to know that doesn't change between periods
+ * (built at hw_params time by iemladspa_plan_build()) */
+typedef struct _iemladspa_plan {
+  int valid;
+  int runner;                 /* whether this stream runs the plugin */
+  deinterleave_fun_t *deinterleave;
+  reinterleave_fun_t *reinterleave;
+  snd_pcm_format_t informat, outformat;
+  unsigned int alsa_inchannels, alsa_outchannels;
+  unsigned int inchannels, outchannels;         /* our channels of the ladspa-plugin */
+  unsigned int chanoffset_in, chanoffset_out;   /* index of our first channel in the de-interleaved data */
+  int dupe;                   /* MONO input: duplicate into all inchannels */
+  int mixdown;                /* MONO output: mix down all outchannels */
+  int zerocopy_in, zerocopy_out; /* FLOAT without up/down-mixing: ports may be connected to the areas */
+  /* unused input channels (first, count) of the ladspa-plugin, that are connected to silence */
+  unsigned int mute_in[2][2];
+  unsigned int num_mute_in;
+  snd_pcm_uframes_t frames;   /* maximum number of frames per transfer (the period or sub-block size) */
+} iemladspa_plan_t;
+
 typedef struct _iemladspa_stream {
   iemladspa_audiobuf_t buf;
-  iemladspa_audiobuf_t mono;
+  iemladspa_audiobuf_t scratch; /* interleaved copy of odd-shaped channel areas */
   snd_pcm_extplug_t    ext;
   int enabled;
+  snd_pcm_uframes_t period_size;
+  iemladspa_plan_t plan;
+  iemladspa_areas_t src, dst;
+  stats_meter_t meter;         /* timing of the transfers */
 } iemladspa_stream_t;
 
-typedef struct snd_pcm_iemladspa {
-  iemladspa_stream_t streamdir[SND_PCM_STREAM_LAST+1];
-  int stream_direction;
-
+/* FIFO for running the plugin in fixed-size blocks */
+typedef struct _iemladspa_fifo {
+  unsigned int blocksize; /* run the plugin in blocks of this size (0: run with any size) */
+  unsigned int latency;   /* frames of delay added by the FIFO */
+  unsigned int infill;    /* frames waiting in 'in' */
+  unsigned int outfill;   /* frames waiting in 'out' */
+  iemladspa_audiobuf_t in;  /* <blocksize> frames per channel */
+  iemladspa_audiobuf_t out; /* 2*<blocksize> frames per channel */
+  LADSPA_Data **inports;
+  LADSPA_Data **outports;
+} iemladspa_fifo_t;
+
+/* lock-free single-producer/single-consumer ring of planar FLOAT frames */
+typedef struct _iemladspa_ring {
+  iemladspa_audiobuf_t buf; /* <channels> channels of <frames> (a power of two) frames each */
+  unsigned long rpos __attribute__((aligned(64))); /* total frames read (only written by the consumer) */
+  unsigned long wpos __attribute__((aligned(64))); /* total frames written (only written by the producer) */
+} iemladspa_ring_t;
+
+/* DSP worker thread, running the plugin one period behind the transfers */
+typedef struct _iemladspa_worker {
+  int enabled;
+  int priority;           /* SCHED_FIFO priority (0: keep the default scheduling) */
+  int cpu;                /* CPU to pin the thread to (-1: any) */
+  unsigned int latency;   /* frames of delay added by the worker (one period) */
+  long debt;              /* >0: late frames to drop from 'out'; <0: frames missing from 'out' */
+  int running;
+  int stop;
+  pthread_t thread;
+  sem_t wakeup;
+  int have_sem;
+  iemladspa_ring_t in;    /* transfer -> worker */
+  iemladspa_ring_t out;   /* worker -> transfer */
+  LADSPA_Data **inports;
+  LADSPA_Data **outports;
+} iemladspa_worker_t;
+
+/* writes the controls kept in shared memory back to their files,
+ * once the mixer has stopped changing them */
+typedef struct _iemladspa_persist {
+  int running;
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} iemladspa_persist_t;
+
+/* silence gate: stop running the plugin while its input is silent */
+typedef struct _iemladspa_gate {
+  int enabled;
+  float threshold;        /* samples within +-threshold count as silence */
+  unsigned int tail_ms;   /* keep running the plugin this long after the input fell silent */
+  unsigned long tail;     /* the same in frames (including the latency of FIFO and worker) */
+  unsigned long quiet;    /* frames of silent input so far */
+  int closed;             /* the plugin is not run, the output is silence */
+} iemladspa_gate_t;
+
+/* taking the plugin out of the signal path (as requested via the controls file) */
+typedef struct _iemladspa_bypass {
+  int active;             /* fully bypassed: the transfers copy their input to their output
+                           * (set by the runner, read by both streams: accessed atomically) */
+  /* (the runner's own) */
+  unsigned long dry;      /* position of the crossfade: 0 (plugin output) ... FADE (input) */
+  unsigned long wait;     /* frames to wait for fresh plugin output before fading it in */
+} iemladspa_bypass_t;
+
+/* running the plugin at a sample rate of its own */
+typedef struct _iemladspa_resampling {
+  unsigned int rate;        /* the plugin's sample rate (0: the device's) */
+  unsigned int taps;        /* filter taps per phase (quality vs. latency) */
+  int active;               /* the device runs at another rate than the plugin */
+  unsigned int latency;     /* frames of delay added by the filters and the FIFO (at the device rate) */
+  resampler_t down, up;     /* device -> plugin rate, and back */
+  iemladspa_audiobuf_t filters; /* the coefficients and histories of both resamplers */
+  iemladspa_audiobuf_t in;  /* the plugin's input (at its rate) */
+  iemladspa_audiobuf_t out; /* the plugin's output (at its rate) */
+  iemladspa_audiobuf_t fifo;/* output resampled to the device rate, waiting to be handed out */
+  unsigned long fill;       /* frames waiting in 'fifo' */
+  LADSPA_Data **inports;
+  LADSPA_Data **outports;
+} iemladspa_resampling_t;
+
+/* the channels of the de-interleaved data (as seen by the LADSPA-plugin) */
+typedef struct _iemladspa_layout {
+  iemladspa_iochannels_t sourcechannels;
+  iemladspa_iochannels_t sinkchannels;
+  unsigned long num_inchannels;  /* sourcechannels.in +sinkchannels.in */
+  unsigned long num_outchannels; /* sourcechannels.out+sinkchannels.out */
+} iemladspa_layout_t;
+
+/* a LADSPA-plugin in the chain */
+typedef struct _iemladspa_plugin {
   void *library;
   const LADSPA_Descriptor *klass;
   LADSPA_Control *control_data;
   LADSPA_Handle *plugininstance;
+  LADSPA_Data **connected; /* what the audio in- and output ports are currently connected to */
+  int shared_controls;     /* 'control_data' belongs to another plugin (we are a replica) */
+  const struct _iemladspa_plugin *original; /* (replicas: the plugin whose settings we use) */
+  LADSPA_Data *latency;    /* where the plugin reports its delay (NULL: it doesn't) */
+  LADSPA_Data *controls;   /* the control ports (private, also for replicas, which may run in parallel):
+                            * a snapshot of the mixer's settings, and what the plugin reports */
+  LADSPA_Data *scratch;    /* (for taking the snapshot) */
+  unsigned int seq;        /* the settings' sequence number the snapshot was taken at */
+  char *persist;           /* the controls file to write the settings back to
+                            * (NULL: the controls are mapped from it directly) */
+  unsigned int persisted;  /* the settings' sequence number when they were last written back */
+  unsigned int pending;    /* ... when we last looked */
+  unsigned int waited;     /* looks since they were last written back */
+  char *notify;            /* the object the controls are mapped from (touched to wake up the mixers) */
+} iemladspa_plugin_t;
+
+/* a connection in the graph:
+ * an input channel of the PCM, or an audio output of a node */
+typedef struct _iemladspa_wireref {
+  int node;          /* -1: input of the PCM; -2: none (silence) */
+  unsigned int port;
+} iemladspa_wireref_t;
+
+/* where to find a LADSPA-plugin (as given in the configuration) */
+typedef struct _iemladspa_pluginconf {
+  const char *library;        /* NULL: look the module up in the index */
+  const char *module;
+  const char *controls;
+  char *default_controls;
+  char *found_library, *found_module; /* (as found in the index) */
+  int backend;                /* LADSPA_CNTRL_BACKEND_* */
+  /* graph nodes only */
+  const char *name;
+  unsigned int num_inputs;
+  iemladspa_wireref_t *inputs;
+  const struct _iemladspa_pluginconf *original; /* replicas: share the controls of this node */
+} iemladspa_pluginconf_t;
+
+typedef struct _iemladspa_graphconf {
+  unsigned int num_outputs;
+  iemladspa_wireref_t *outputs;
+  long threads;
+  int priority;
+} iemladspa_graphconf_t;
+
+struct _iemladspa_graph;
+
+/* a LADSPA-plugin in the graph */
+typedef struct _iemladspa_node {
+  workpool_task_t task;        /* must be the first member */
+  struct _iemladspa_graph *graph;
+  iemladspa_plugin_t *plugin;
+  unsigned int num_inputs, num_outputs;
+  unsigned int *inputs;        /* the wire feeding each audio input */
+  unsigned int first_output;   /* the wire of the first audio output */
+  unsigned int num_dependencies;
+  unsigned int num_dependents;
+  struct _iemladspa_node **dependents;
+  unsigned int pending;        /* dependencies that haven't run yet (accessed atomically) */
+  unsigned long latency;       /* frames of delay from the PCM's inputs to our outputs (longest path) */
+  LADSPA_Data **inports, **outports;
+} iemladspa_node_t;
+
+/* a DAG of LADSPA-plugins
+ * the wires are numbered: inputs of the PCM first, followed by the outputs of all nodes */
+typedef struct _iemladspa_graph {
+  unsigned int num_nodes;
+  iemladspa_node_t *nodes;
+  unsigned int num_inputs;     /* input channels of the PCM */
+  unsigned int num_wires;
+  unsigned int num_outputs;    /* output channels of the PCM */
+  int *outputs;                /* the wire feeding each output channel (-1: silence) */
+  iemladspa_audiobuf_t wires;  /* the outputs of the nodes */
+  LADSPA_Data **inports;       /* the inputs of the PCM (for the current run) */
+  unsigned long frames;        /* frames of the current run */
+  unsigned int remaining;      /* nodes that haven't run yet (accessed atomically) */
+  int pooled;                  /* whether we are using the thread pool */
+  workpool_deque_t *deque;     /* where we queue the nodes that are ready to run */
+} iemladspa_graph_t;
+
+typedef struct snd_pcm_iemladspa {
+  iemladspa_stream_t streamdir[SND_PCM_STREAM_LAST+1];
+  int stream_direction;
+
+  iemladspa_plugin_t *plugins; /* the LADSPA-plugins, run one after the other */
+  unsigned int num_plugins;
+  iemladspa_layout_t layout;
+  LADSPA_Data **inports;  /* where the audio input ports are connected to */
+  LADSPA_Data **outports; /* where the audio output ports are connected to */
+  iemladspa_audiobuf_t chain[2]; /* ping-pong buffers between the plugins */
+  LADSPA_Data **chainports[2];
+  LADSPA_Data **runports[2];     /* the in- and outputs of a part of a run (see iemladspa_run()) */
+  iemladspa_graph_t *graph;      /* run the plugins as a graph (rather than a chain) */
+  iemladspa_fifo_t fifo;
+  iemladspa_worker_t worker;
+  iemladspa_persist_t persist;
+  iemladspa_gate_t gate;
+  iemladspa_bypass_t bypass;
+  iemladspa_resampling_t resampling;
+  iemladspa_arena_t arena;
+  float *zeros;           /* read-only (and thus shared) zero pages: muted inputs, closed gate */
+  size_t zerosize;
+  long subblock;          /* largest transfer, in frames (0: the period size; SUBBLOCK_AUTO: fit the L2 cache) */
+  unsigned long plugin_latency; /* frames of delay the plugins report (at the device rate) */
+  stats_t *stats;         /* where the timing of the transfers is published (NULL: nowhere) */
 
   unsigned int usecount;
   const void   *key;
@@ -153,472 +411,2492 @@ static void print_pcm_config(snd_config_t*config, const char*name) {
   printf("\n");
 }
 
-static void audiobuffer_free(iemladspa_audiobuf_t *iemladspa) {
-  if(iemladspa->data)free(iemladspa->data);
-  iemladspa->data=NULL;
-  iemladspa->frames=0;
-  iemladspa->channels=0;
-  iemladspa->size=0;
-}
+#define ARENA_ALIGN 64
 
-static int audiobuffer_resize(iemladspa_audiobuf_t *buf, unsigned int frames, unsigned int channels) {
-  size_t size=frames*channels;
-  if(size > buf->size) {
-    float*data=NULL;
-    size*=2; /* over-allocation */
-    data=realloc(buf->data, size*sizeof(float));
-    if(!data) {
-      audiobuffer_free(buf);
+static void arena_free(iemladspa_arena_t *arena) {
+  if(arena->locked)
+    munlock(arena->data, arena->size);
+  free(arena->data);
+  arena->data=NULL;
+  arena->size=0;
+  arena->locked=0;
+}
+/* make sure the arena holds at least <size> bytes
+ * the memory is zeroed (which also faults in all the pages) */
+static int arena_reserve(iemladspa_arena_t *arena, size_t size) {
+  if(size > arena->size) {
+    void*data=NULL;
+    if(posix_memalign(&data, ARENA_ALIGN, size))
       return 0;
+    arena_free(arena);
+    arena->data=data;
+    arena->size=size;
+    if(arena->lock) {
+      arena->locked = !mlock(arena->data, arena->size);
+      DEBUG("mlock(%lu) %s\n", size, arena->locked?"succeeded":"failed");
     }
-    buf->data=data;
-    buf->size = size;
-  }
-  if(frames != buf->frames || channels != buf->channels) {
-    /* frames/channels have changed, clear the buffer */
-    memset(buf->data, 0, size*sizeof(float));
   }
-  buf->frames=frames;
-  buf->channels=channels;
+  memset(arena->data, 0, arena->size);
   return 1;
 }
-static inline void reinterleaveFLOAT(float *src, void *dst_, int frames, int channels)
-{
-  float*dst=(float*)dst_;
-  int i, j;
-  for(i = 0; i < frames; i++){
-    for(j = 0; j < channels; j++){
-      dst[i*channels + j] = src[i + frames*j];
-    }
-  }
+/* bytes needed for a buffer of <frames> frames of <channels> FLOAT samples */
+static size_t audiobuffer_bytes(unsigned int frames, unsigned int channels) {
+  size_t size = (size_t)frames * channels * sizeof(float);
+  return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
 }
-static inline void deinterleaveFLOAT(void *src_, float *dst, int frames, int channels)
-{
-  float*src=(float*)src_;
-  int i, j;
-  for(i = 0; i < frames; i++){
-    for(j = 0; j < channels; j++){
-      dst[i + frames*j] = src[i*channels + j];
-    }
+/* carve a buffer for <frames> frames of <channels> channels from the arena at <*offset>
+ * (if <arena> is NULL, just advance <*offset>) */
+static void audiobuffer_carve(iemladspa_audiobuf_t *buf, iemladspa_arena_t *arena, size_t *offset,
+                              unsigned int frames, unsigned int channels) {
+  if(arena) {
+    buf->data=(float*)((char*)arena->data + *offset);
+    buf->frames=frames;
+    buf->channels=channels;
+    buf->size=(size_t)frames*channels;
   }
+  *offset += audiobuffer_bytes(frames, channels);
 }
-static inline void reinterleaveS16(float *src, void *dst_, int frames, int channels)
-{
-  signed short*dst=(signed short*)dst_;
-  int i, j;
-  for(i = 0; i < frames; i++){
-    for(j = 0; j < channels; j++){
-      int v = src[i + frames*j] * 32767.;
-      if(v > 32767)
-        v=32767;
-      else if (v < -32767)
-        v=-32767;
-      dst[i*channels + j] = v;
-    }
+/* (re)map <size> bytes of zeros
+ * a read-only anonymous mapping is backed by the kernel's zero page,
+ * so it costs no memory (and no cache) however large it is */
+static int zeros_map(snd_pcm_iemladspa_t *iemladspa, size_t size) {
+  if(iemladspa->zeros && iemladspa->zerosize >= size)
+    return 1;
+  if(iemladspa->zeros)
+    munmap(iemladspa->zeros, iemladspa->zerosize);
+  iemladspa->zeros = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(MAP_FAILED == iemladspa->zeros) {
+    iemladspa->zeros = NULL;
+    iemladspa->zerosize = 0;
+    return 0;
   }
+  iemladspa->zerosize = size;
+  return 1;
 }
-
-static inline void deinterleaveS16(void *src_, float *dst, int frames, int channels)
-{
-  signed short*src=(signed short*)src_;
-  const float scale = 1./32767.;
-  int i, j;
-  for(i = 0; i < frames; i++){
-    for(j = 0; j < channels; j++){
-      dst[i + frames*j] = src[i*channels + j] * scale;
-    }
-  }
+static void zeros_free(snd_pcm_iemladspa_t *iemladspa) {
+  if(iemladspa->zeros)
+    munmap(iemladspa->zeros, iemladspa->zerosize);
+  iemladspa->zeros = NULL;
+  iemladspa->zerosize = 0;
 }
 
-/* duplicate the MONO src-channel into <channels> dst-channels */
-static inline void samples_duplicate(float*src, float*dst, int frames, int channels) {
+/* mute <channels> int <dst> */
+static inline void samples_mute(float*dst, int frames, int channels) {
   int frame, channel;
-  DEBUG("dupe %d/%d\n", frames, channels);
+  DEBUG("mute %d/%d\n", frames, channels);
   for(channel=0; channel<channels; channel++) {
     float*out=dst+frames*channel;
-    float*in =src;
     for(frame=0; frame<frames; frame++) {
-      *out++=*in++;
+      *out++=0.f;
     }
   }
 }
-/* mix <channels> src-channels into a MONO dst-channel */
-static inline void samples_mixdown(float*src, float*dst, int frames, int channels) {
-  int frame, channel;
-  float*in,*out;
-  DEBUG("mix  %d/%d\n", frames, channels);
 
-  out=dst;
-  for(frame=0; frame<frames; frame++) {
-    *out++=0.f;
+/* whether all <frames> samples in <src> are within +-<threshold>
+ * (the input is scanned in small chunks, so we can stop at the first loud one) */
+static inline int samples_silent(const float*src, unsigned long frames, float threshold) {
+  unsigned long frame = 0;
+  while(frame < frames) {
+    const unsigned long end = (frames - frame > 64)?frame + 64:frames;
+    float peak = 0.f;
+    for(; frame < end; frame++) {
+      const float a = (src[frame] < 0.f)?-src[frame]:src[frame];
+      peak = (a > peak)?a:peak;
+    }
+    if(peak > threshold)
+      return 0;
   }
+  return 1;
+}
 
-  for(channel=0; channel<channels; channel++) {
-    in=src+frames*channel;
-    out=dst;
-    for(frame=0; frame<frames; frame++) {
-      *out++ += *in++;
-    }
+/* get the (de)interleaving kernels for a sample format
+ * returns 0 if the format is not supported */
+static int iemladspa_get_kernels(snd_pcm_format_t format,
+                                 deinterleave_fun_t**deinterleave,
+                                 reinterleave_fun_t**reinterleave) {
+  const sample_kernels_t*kernels = sample_kernels();
+  deinterleave_fun_t*de = NULL;
+  reinterleave_fun_t*re = NULL;
+  switch(format) {
+  case SND_PCM_FORMAT_FLOAT:
+    de=kernels->deinterleaveFLOAT;
+    re=kernels->reinterleaveFLOAT;
+    break;
+  case SND_PCM_FORMAT_S16:
+    de=kernels->deinterleaveS16;
+    re=kernels->reinterleaveS16;
+    break;
+  case SND_PCM_FORMAT_S24:
+    de=kernels->deinterleaveS24;
+    re=kernels->reinterleaveS24;
+    break;
+  case SND_PCM_FORMAT_S24_3LE:
+    de=kernels->deinterleaveS24_3LE;
+    re=kernels->reinterleaveS24_3LE;
+    break;
+  case SND_PCM_FORMAT_S32:
+    de=kernels->deinterleaveS32;
+    re=kernels->reinterleaveS32;
+    break;
+  case SND_PCM_FORMAT_FLOAT64:
+    de=kernels->deinterleaveFLOAT64;
+    re=kernels->reinterleaveFLOAT64;
+    break;
+  default:
+    return 0;
   }
+  if(deinterleave)*deinterleave=de;
+  if(reinterleave)*reinterleave=re;
+  return 1;
 }
 
-/* mute <channels> int <dst> */
-static inline void samples_mute(float*dst, int frames, int channels) {
-  int frame, channel;
-  DEBUG("mute %d/%d\n", frames, channels);
-  for(channel=0; channel<channels; channel++) {
-    float*out=dst+frames*channel;
-    for(frame=0; frame<frames; frame++) {
-      *out++=0.f;
+/* address of frame <offset> in a channel area
+ * (first&step are given in bits, hence we divide by 8) */
+static inline void*area_address(const snd_pcm_channel_area_t*area, snd_pcm_uframes_t offset) {
+  return area->addr + (area->first + area->step * offset)/8;
+}
+/* determine how the <channels> areas are laid out
+ * (the result is cached, as the areas hardly ever change between transfers) */
+static iemladspa_areashape_t areas_shape(iemladspa_areas_t*cache, const snd_pcm_channel_area_t*areas,
+                                         unsigned int channels, snd_pcm_format_t format) {
+  const unsigned int width = snd_pcm_format_physical_width(format);
+  unsigned int c;
+  if(cache->shape && cache->addr == areas[0].addr
+     && cache->first == areas[0].first && cache->step == areas[0].step)
+    return cache->shape;
+
+  cache->addr  = areas[0].addr;
+  cache->first = areas[0].first;
+  cache->step  = areas[0].step;
+  cache->shape = AREAS_COMPLEX;
+  if(areas[0].first % 8)
+    return cache->shape;
+
+  for(c=0; c<channels; c++) {
+    if(areas[c].addr != areas[0].addr
+       || areas[c].step != channels * width
+       || areas[c].first != areas[0].first + c * width)
+      break;
+  }
+  if(c == channels) {
+    cache->shape = AREAS_INTERLEAVED;
+    return cache->shape;
+  }
+
+  for(c=0; c<channels; c++) {
+    if(areas[c].step != width || areas[c].first % 8)
+      break;
+  }
+  if(c == channels)
+    cache->shape = AREAS_PLANAR;
+  return cache->shape;
+}
+/* prepare an interleaved scratch buffer for <channels> samples of <format>,
+ * and describe it as channel areas */
+static int areas_scratch(iemladspa_audiobuf_t*scratch, snd_pcm_channel_area_t*areas,
+                         unsigned int frames, unsigned int channels, snd_pcm_format_t format) {
+  const unsigned int width = snd_pcm_format_physical_width(format);
+  unsigned int c;
+  /* the scratch buffer counts floats, samples are at most 64bit */
+  if((size_t)frames * channels * 2 > scratch->size)
+    return 0;
+  for(c=0; c<channels; c++) {
+    areas[c].addr  = scratch->data;
+    areas[c].first = c * width;
+    areas[c].step  = channels * width;
+  }
+  return 1;
+}
+
+/* read <frames> frames of <channels> ALSA channel areas into planar FLOAT <dst>
+ * - interleaved and non-interleaved areas are converted directly
+ * - anything else is first copied into an interleaved scratch buffer */
+static void areas_deinterleave(iemladspa_audiobuf_t*scratch, deinterleave_fun_t*deinterleave,
+                               iemladspa_areashape_t shape,
+                               const snd_pcm_channel_area_t*areas, snd_pcm_uframes_t offset,
+                               snd_pcm_format_t format,
+                               float*dst, unsigned int frames, unsigned int channels) {
+  unsigned int c;
+  if(AREAS_INTERLEAVED == shape) {
+    deinterleave(area_address(areas, offset), dst, frames, channels);
+  } else if(AREAS_PLANAR == shape) {
+    for(c=0; c<channels; c++)
+      deinterleave(area_address(areas+c, offset), dst + c*frames, frames, 1);
+  } else {
+    snd_pcm_channel_area_t tmp[channels];
+    if(!areas_scratch(scratch, tmp, frames, channels, format))
+      return;
+    snd_pcm_areas_copy(tmp, 0, areas, offset, channels, frames, format);
+    deinterleave(scratch->data, dst, frames, channels);
+  }
+}
+/* write <frames> frames of planar FLOAT <src> into <channels> ALSA channel areas */
+static void areas_reinterleave(iemladspa_audiobuf_t*scratch, reinterleave_fun_t*reinterleave,
+                               float*src, unsigned int frames, unsigned int channels,
+                               iemladspa_areashape_t shape,
+                               const snd_pcm_channel_area_t*areas, snd_pcm_uframes_t offset,
+                               snd_pcm_format_t format) {
+  unsigned int c;
+  if(AREAS_INTERLEAVED == shape) {
+    reinterleave(src, area_address(areas, offset), frames, channels);
+  } else if(AREAS_PLANAR == shape) {
+    for(c=0; c<channels; c++)
+      reinterleave(src + c*frames, area_address(areas+c, offset), frames, 1);
+  } else {
+    snd_pcm_channel_area_t tmp[channels];
+    if(!areas_scratch(scratch, tmp, frames, channels, format))
+      return;
+    reinterleave(src, scratch->data, frames, channels);
+    snd_pcm_areas_copy(areas, offset, tmp, 0, channels, frames, format);
+  }
+}
+/* the MONO paths work in chunks of this many frames,
+ * so the converted samples are still in the cache when they are duplicated/mixed */
+#define FUSE_FRAMES 256
+
+/* read <frames> frames of a MONO ALSA channel area into <channels> planar FLOAT channels of <dst>
+ * (each sample is read once, and each output sample written once) */
+static void areas_deinterleave_dupe(iemladspa_audiobuf_t*scratch, deinterleave_fun_t*deinterleave,
+                                    iemladspa_areashape_t shape,
+                                    const snd_pcm_channel_area_t*areas, snd_pcm_uframes_t offset,
+                                    snd_pcm_format_t format,
+                                    float*dst, unsigned int frames, unsigned int channels) {
+  const unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+  char*src;
+  unsigned int done, n, c;
+  if(AREAS_COMPLEX == shape) {
+    snd_pcm_channel_area_t tmp;
+    if(!areas_scratch(scratch, &tmp, frames, 1, format))
+      return;
+    snd_pcm_areas_copy(&tmp, 0, areas, offset, 1, frames, format);
+    src = (char*)scratch->data;
+  } else {
+    src = (char*)area_address(areas, offset);
+  }
+  for(done = 0; done < frames; done += n) {
+    n = (frames - done < FUSE_FRAMES)?(frames - done):FUSE_FRAMES;
+    deinterleave(src + done*bytes, dst + done, n, 1);
+    for(c = 1; c < channels; c++)
+      memcpy(dst + c*frames + done, dst + done, n*sizeof(float));
+  }
+}
+/* mix <channels> planar FLOAT channels of <src> down into a MONO ALSA channel area
+ * (each sample is read once, and each output sample written once) */
+static void areas_reinterleave_mixdown(iemladspa_audiobuf_t*scratch, reinterleave_fun_t*reinterleave,
+                                       float*src, unsigned int frames, unsigned int channels,
+                                       iemladspa_areashape_t shape,
+                                       const snd_pcm_channel_area_t*areas, snd_pcm_uframes_t offset,
+                                       snd_pcm_format_t format) {
+  const unsigned int bytes = snd_pcm_format_physical_width(format) / 8;
+  float mix[FUSE_FRAMES];
+  snd_pcm_channel_area_t tmp;
+  char*dst;
+  unsigned int done, n, c, i;
+  if(AREAS_COMPLEX == shape) {
+    if(!areas_scratch(scratch, &tmp, frames, 1, format))
+      return;
+    dst = (char*)scratch->data;
+  } else {
+    dst = (char*)area_address(areas, offset);
+  }
+  for(done = 0; done < frames; done += n) {
+    n = (frames - done < FUSE_FRAMES)?(frames - done):FUSE_FRAMES;
+    for(i = 0; i < n; i++)
+      mix[i] = src[done + i];
+    for(c = 1; c < channels; c++) {
+      const float*in = src + c*frames + done;
+      for(i = 0; i < n; i++)
+        mix[i] += in[i];
     }
+    reinterleave(mix, dst + done*bytes, n, 1);
   }
+  if(AREAS_COMPLEX == shape)
+    snd_pcm_areas_copy(areas, offset, &tmp, 0, 1, frames, format);
+}
+
+/* store the address of frame <offset> of each of the (planar FLOAT) areas in <ports> */
+static void areas_ladspa(const snd_pcm_channel_area_t*areas, snd_pcm_uframes_t offset,
+                         unsigned int channels, LADSPA_Data**ports) {
+  unsigned int c;
+  for(c=0; c<channels; c++)
+    ports[c]=(LADSPA_Data*)area_address(areas+c, offset);
 }
 
-typedef void reinterleave_fun_t(float *src, void *dst_, int frames, int channels);
-typedef void deinterleave_fun_t(void *src_, float *dst, int frames, int channels);
+/* whether any of the input ports shares memory with any of the output ports */
+static int ports_overlap(LADSPA_Data**inports, unsigned int inchannels,
+                         LADSPA_Data**outports, unsigned int outchannels) {
+  unsigned int i, o;
+  for(i=0; i<inchannels; i++)
+    for(o=0; o<outchannels; o++)
+      if(inports[i] == outports[o])
+        return 1;
+  return 0;
+}
 
-static inline void connect_port(snd_pcm_iemladspa_t *iemladspa,
+static inline void connect_port(iemladspa_plugin_t *plugin,
                                 unsigned long Port,
                                 LADSPA_Data * DataLocation,
                                 const char*name) {
   //printf("connect %s\t %lu to %p\n", name, Port, DataLocation);
-  iemladspa->klass->connect_port(iemladspa->plugininstance, Port, DataLocation);
+  plugin->klass->connect_port(plugin->plugininstance, Port, DataLocation);
 }
 
-static snd_pcm_sframes_t iemladspa_transfer(snd_pcm_extplug_t *ext,
-                                            const snd_pcm_channel_area_t *dst_areas,
-                                            snd_pcm_uframes_t dst_offset,
-                                            const snd_pcm_channel_area_t *src_areas,
-                                            snd_pcm_uframes_t src_offset,
-                                            snd_pcm_uframes_t size)
-{
-  DEBUG("transfer: stream=%d\tchannels=%d\tslavechannels=%d\n", ext->stream, ext->channels, ext->slave_channels);
-
-  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)(ext->private_data);
-  const int playback = (SND_PCM_STREAM_PLAYBACK == ext->stream);
-
-  /* input/output channels for the alsa-plugin (transfer call) */
-  const unsigned int alsa_inchannels  = ( playback)?ext->channels:ext->slave_channels;
-  const unsigned int alsa_outchannels = (!playback)?ext->channels:ext->slave_channels;
-
-  /* input/output channels for the ladspa-plugin */
-  const unsigned int inchannels  = (playback)?(iemladspa->control_data->sourcechannels.in ):(iemladspa->control_data->sinkchannels.in);
-  const unsigned int outchannels = (playback)?(iemladspa->control_data->sourcechannels.out):(iemladspa->control_data->sinkchannels.out);
-
-  /* offset in samples to jump to the correct channel in the de-interleaved data */
-  const unsigned long bufoffset_in_src  = 0;
-  const unsigned long bufoffset_in_snk  = (iemladspa->control_data->sourcechannels.in  * size);
-  const unsigned long bufoffset_out_src = 0;
-  const unsigned long bufoffset_out_snk = (iemladspa->control_data->sourcechannels.out * size);
-
-  const unsigned long bufoffset_in  = (playback)? bufoffset_in_snk :bufoffset_in_src;
-  const unsigned long bufoffset_out = (playback)? bufoffset_out_snk:bufoffset_out_src;
+/* the stream that runs the plugin:
+ * PLAYBACK (or CAPTURE if we don't have PLAYBACK) */
+static inline int iemladspa_is_runner(snd_pcm_iemladspa_t *iemladspa, snd_pcm_stream_t stream) {
+  return (SND_PCM_STREAM_PLAYBACK == stream) || (!iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled);
+}
 
-  /* LADSPA-port offset (to skip control-ports in port_connect */
-  const unsigned long dataoffset_in  = iemladspa->control_data->num_controls;
-  const unsigned long dataoffset_out = dataoffset_in + iemladspa->control_data->num_inchannels;
+/* feed the gate with the next <frames> frames of input
+ * the gate closes once the input has been silent for longer than the tail
+ * (so reverbs and the like can decay), and opens again with the first loud frame;
+ * returns whether it is closed (so the plugin needs not run) */
+static int iemladspa_gate_update(iemladspa_gate_t*gate, LADSPA_Data**inports, unsigned int channels,
+                                 unsigned long frames) {
+  unsigned int j;
+  if(!gate->enabled)
+    return 0;
+  for(j = 0; j < channels; j++) {
+    if(!samples_silent(inports[j], frames, gate->threshold)) {
+      gate->quiet = 0;
+      gate->closed = 0;
+      return 0;
+    }
+  }
+  gate->closed = (gate->quiet >= gate->tail);
+  if(!gate->closed)
+    gate->quiet += frames;
+  return gate->closed;
+}
 
+/* run a single plugin on <frames> frames */
+static void iemladspa_plugin_run(iemladspa_plugin_t *plugin,
+                                 LADSPA_Data**inports, LADSPA_Data**outports,
+                                 unsigned long frames) {
+  const unsigned long dataoffset_in  = plugin->control_data->num_controls;
+  const unsigned long dataoffset_out = dataoffset_in + plugin->control_data->num_inchannels;
   int j;
+  LADSPA_Data**connected_in  = plugin->connected;
+  LADSPA_Data**connected_out = plugin->connected + plugin->control_data->num_inchannels;
 
-  /* Calculate buffer locations */
-  /* first&step are given in bits, hence we device by 8
-   */
-  void *src = (src_areas->addr +
-               (src_areas->first + src_areas->step * src_offset)/8);
-  void *dst = (dst_areas->addr +
-               (dst_areas->first + dst_areas->step * dst_offset)/8);
-
-  deinterleave_fun_t*deinterleave = NULL;
-  reinterleave_fun_t*reinterleave = NULL;
-  switch(ext->format) {
-  case SND_PCM_FORMAT_FLOAT:
-    deinterleave=deinterleaveFLOAT;
-    reinterleave=reinterleaveFLOAT;
-    break;
-  case SND_PCM_FORMAT_S16:
-    deinterleave=deinterleaveS16;
-    reinterleave=reinterleaveS16;
-    break;
-  default:
-    break;
+  /* only (re)connect ports that have moved since the last run */
+  for(j = 0; j < plugin->control_data->num_inchannels; j++) {
+    if(connected_in[j] == inports[j])
+      continue;
+    connect_port(plugin,
+                 plugin->control_data->data[dataoffset_in + j].index,
+                 inports[j],
+                 "inport "
+                 );
+    connected_in[j] = inports[j];
+  }
+  for(j = 0; j < plugin->control_data->num_outchannels; j++) {
+    if(connected_out[j] == outports[j])
+      continue;
+    connect_port(plugin,
+                 plugin->control_data->data[dataoffset_out+ j].index,
+                 outports[j],
+                 "outport");
+    connected_out[j] = outports[j];
   }
 
-  if(!deinterleave || !reinterleave)return size;
-
-  /* make sure out deinterleaving buffers are large enough */
-  audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf , size,
-                     iemladspa->control_data->sourcechannels.in +iemladspa->control_data->sinkchannels.in);
-  audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf, size,
-                     iemladspa->control_data->sourcechannels.out+iemladspa->control_data->sinkchannels.out);
+  plugin->klass->run(plugin->plugininstance, frames);
+}
 
-  /* NOTE: swap source and destination memory space when deinterleaved.
-     then swap it back during the interleave call below */
+static inline LADSPA_Data*graph_wire(iemladspa_graph_t*graph, unsigned int wire) {
+  if(wire < graph->num_inputs)
+    return graph->inports[wire];
+  return graph->wires.data + (wire - graph->num_inputs) * graph->frames;
+}
 
-  if(!playback | (alsa_inchannels == inchannels)) {
-    /* in CAPTURE mode, we always have the correct number of input channels;
-     * deinterleave the data into *channels.in channels
-     */
-    deinterleave(src,
-                 iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data + bufoffset_in,
-                 size, inchannels);
-  } else if (1==alsa_inchannels) {
-    /* if we are in PLAYBACK mode, the client-application might send us data in MONO;
-     * deinterleave the data into a MONO buffer, then blow it up to *channels.in
-     */
-    audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].mono, size, 1);
- 
-    /* "deinterleave" */
-    deinterleave(src,
-                 iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].mono.data,
-                 size, 1);
-
-    /* dupe */
-    samples_duplicate(iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].mono.data,
-                      iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data + bufoffset_in,
-                      size, inchannels);
-  } else {
-    // this should never happen
+/* run a node of the graph, and queue its dependents once they are ready */
+static void iemladspa_node_run(workpool_task_t *task, workpool_deque_t *deque) {
+  iemladspa_node_t*node = (iemladspa_node_t*)task;
+  iemladspa_graph_t*graph = node->graph;
+  unsigned int j, ready = 0;
+
+  for(j = 0; j < node->num_inputs; j++)
+    node->inports[j] = graph_wire(graph, node->inputs[j]);
+  for(j = 0; j < node->num_outputs; j++)
+    node->outports[j] = graph_wire(graph, node->first_output + j);
+  iemladspa_plugin_run(node->plugin, node->inports, node->outports, graph->frames);
+
+  for(j = 0; j < node->num_dependents; j++) {
+    iemladspa_node_t*dependent = node->dependents[j];
+    if(__atomic_sub_fetch(&dependent->pending, 1, __ATOMIC_ACQ_REL))
+      continue;
+    if(deque && workpool_push(deque, &dependent->task))
+      ready++;
+    else
+      iemladspa_node_run(&dependent->task, deque);
   }
+  /* we are going to take one of them ourselves */
+  if(ready > 1)
+    workpool_wake(ready - 1);
+  workpool_done(&graph->remaining);
+}
 
+/* run all nodes of the graph on <frames> frames (independent nodes concurrently),
+ * and collect the outputs once they are all done */
+static void iemladspa_graph_run(iemladspa_graph_t*graph,
+                                LADSPA_Data**inports, LADSPA_Data**outports,
+                                unsigned long frames) {
+  unsigned int k, roots = 0;
+
+  graph->inports = inports;
+  graph->frames = frames;
+  for(k = 0; k < graph->num_nodes; k++)
+    graph->nodes[k].pending = graph->nodes[k].num_dependencies;
+  __atomic_store_n(&graph->remaining, graph->num_nodes, __ATOMIC_RELEASE);
+
+  for(k = 0; k < graph->num_nodes; k++) {
+    iemladspa_node_t*node = &graph->nodes[k];
+    if(node->num_dependencies)
+      continue;
+    if(graph->deque && workpool_push(graph->deque, &node->task))
+      roots++;
+    else
+      iemladspa_node_run(&node->task, graph->deque);
+  }
+  if(graph->deque) {
+    if(roots > 1)
+      workpool_wake(roots - 1);
+    workpool_help(graph->deque, &graph->remaining);
+  }
 
-  /* only run when
-   *   - stream is in playback mode (if we are opened with PLAYBACK)
-   *   - stream is in capture mode (if we don't have PLAYBACK)
-   */
-  if((playback) || (!iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled)) {
-    /* MUTE all unused input channels */
-    if(!iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].enabled) {
-      samples_mute(iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data + bufoffset_in_src,
-		   size, iemladspa->control_data->sourcechannels.in);
-    }
-    if(!iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled) {
-      samples_mute(iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data + bufoffset_in_snk,
-		   size, iemladspa->control_data->sourcechannels.in);
+  for(k = 0; k < graph->num_outputs; k++) {
+    if(graph->outputs[k] < 0) {
+      memset(outports[k], 0, frames * sizeof(float));
+    } else {
+      LADSPA_Data*wire = graph_wire(graph, graph->outputs[k]);
+      if(wire != outports[k])
+        memmove(outports[k], wire, frames * sizeof(float));
     }
+  }
+}
 
-    for(j = 0; j < iemladspa->control_data->num_inchannels; j++) {
-      connect_port(iemladspa,
-                   iemladspa->control_data->data[dataoffset_in + j].index,
-                   iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf.data + j*size,
-                   "inport "
-                   );
-    }
-    for(j = 0; j < iemladspa->control_data->num_outchannels; j++) {
-      connect_port(iemladspa,
-                   iemladspa->control_data->data[dataoffset_out+ j].index,
-                   iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data + j*size,
-                   "outport");
-    }
+static void iemladspa_graph_free(iemladspa_graph_t*graph) {
+  unsigned int k;
+  if(!graph)
+    return;
+  if(graph->deque)
+    workpool_deque_put(graph->deque);
+  if(graph->pooled)
+    workpool_release();
+  for(k = 0; graph->nodes && k < graph->num_nodes; k++) {
+    free(graph->nodes[k].inputs);
+    free(graph->nodes[k].dependents);
+    free(graph->nodes[k].inports);
+    free(graph->nodes[k].outports);
+  }
+  free(graph->nodes);
+  free(graph->outputs);
+  free(graph);
+}
 
-    iemladspa->klass->run(iemladspa->plugininstance, size);
+/* run the chain of plugins on <frames> frames (that fit into the buffers between them)
+ * the plugins pass their data on in the ping-pong buffers;
+ * plugins that are not INPLACE_BROKEN write right over their input */
+static void iemladspa_run_part(snd_pcm_iemladspa_t *iemladspa,
+                               LADSPA_Data**inports, LADSPA_Data**outports,
+                               unsigned long frames) {
+  const unsigned int last = iemladspa->num_plugins - 1;
+  const unsigned int channels = iemladspa->layout.num_outchannels;
+  LADSPA_Data**in = inports;
+  unsigned int k, j;
+  int cur = 0;
+
+  if(iemladspa->graph) {
+    iemladspa_graph_run(iemladspa->graph, inports, outports, frames);
+    return;
   }
 
-  /* MUTE all unused input channels */
-  if(!iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].enabled) {
-    samples_mute(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data + bufoffset_out_src,
-		 size, iemladspa->control_data->sourcechannels.out);
+  for(k = 0; k < last; k++) {
+    /* never write into our own input */
+    if(in != inports && LADSPA_IS_INPLACE_BROKEN(iemladspa->plugins[k].klass->Properties))
+      cur = !cur;
+    for(j = 0; j < channels; j++)
+      iemladspa->chainports[cur][j] = iemladspa->chain[cur].data + j*frames;
+    iemladspa_plugin_run(&iemladspa->plugins[k], in, iemladspa->chainports[cur], frames);
+    in = iemladspa->chainports[cur];
   }
-  if(!iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled) {
-    samples_mute(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data + bufoffset_out_snk,
-		 size, iemladspa->control_data->sourcechannels.out);
-  }
-
-  if(playback | (alsa_outchannels == outchannels)) {
-    /* in PLAYBACK mode, we always have the correct number of output channels;
-     * interleave the data into sinkchannels.out channels
-     */
-    reinterleave(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data + bufoffset_out,
-                 dst,
-                 size, outchannels);
-  } else if (1==alsa_outchannels) {
-    /* if we are in CAPTURE mode, the client-application might receive data in MONO;
-     * mix the data into *channels.out, then interleave it into a MONO buffer
-     */
-    audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].mono, size, 1);
-
-    /* mixdown */
-    samples_mixdown(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data + bufoffset_out,
-                    iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].mono.data,
-                    size, outchannels);
-
-    /* "reinterleave" */
-    reinterleave(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].mono.data,
-                 dst,
-                 size, 1);
-  } else {
-    // this should never happen
+  iemladspa_plugin_run(&iemladspa->plugins[last], in, outports, frames);
+}
+/* run the plugins on <frames> frames
+ * the buffers between the plugins hold a period (or a block), which is what we
+ * usually get; anything longer (e.g. a transfer of more than a period) is run
+ * in parts that fit */
+static void iemladspa_run(snd_pcm_iemladspa_t *iemladspa,
+                          LADSPA_Data**inports, LADSPA_Data**outports,
+                          unsigned long frames) {
+  unsigned long room = frames, done, n;
+  unsigned int j;
+
+  if(iemladspa->graph)
+    room = iemladspa->graph->wires.frames;
+  else if(iemladspa->num_plugins > 1)
+    room = iemladspa->chain[0].frames;
+  if(frames <= room) {
+    iemladspa_run_part(iemladspa, inports, outports, frames);
+    return;
+  }
+
+  for(done = 0; done < frames; done += n) {
+    n = (frames - done < room) ? frames - done : room;
+    for(j = 0; j < iemladspa->layout.num_inchannels; j++)
+      iemladspa->runports[0][j] = inports[j] + done;
+    for(j = 0; j < iemladspa->layout.num_outchannels; j++)
+      iemladspa->runports[1][j] = outports[j] + done;
+    iemladspa_run_part(iemladspa, iemladspa->runports[0], iemladspa->runports[1], n);
   }
-  iemladspa->stream_direction = ext->stream;
-  return size;
 }
 
-static int iemladspa_close(snd_pcm_extplug_t *ext) {
-  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t*)ext->private_data;
+/* run the plugin on whatever is waiting in the input FIFO,
+ * and append the result to the output FIFO */
+static void iemladspa_fifo_run(snd_pcm_iemladspa_t *iemladspa) {
+  iemladspa_fifo_t*fifo = &iemladspa->fifo;
+  const unsigned int blocksize = fifo->blocksize;
+  int j;
+  if(!fifo->infill)
+    return;
+  for(j = 0; j < iemladspa->layout.num_inchannels; j++)
+    fifo->inports[j] = fifo->in.data + j*blocksize;
+  for(j = 0; j < iemladspa->layout.num_outchannels; j++)
+    fifo->outports[j] = fifo->out.data + j*2*blocksize + fifo->outfill;
 
-  /* check whether we are the last user of iemladspa */
-  if((--(iemladspa->usecount))>0)
-    return 0;
+  iemladspa_run(iemladspa, fifo->inports, fifo->outports, fifo->infill);
 
-  if(iemladspa->plugininstance) {
-    if(iemladspa->klass->deactivate) {
-      iemladspa->klass->deactivate(iemladspa->plugininstance);
-    }
+  fifo->outfill += fifo->infill;
+  fifo->infill = 0;
+}
 
-    /* TODO: Figure out why this segfaults */
-    if(iemladspa->klass->cleanup) {
-      iemladspa->klass->cleanup(iemladspa->plugininstance);
-    } else {
-      free(iemladspa->plugininstance);
-    }
+/* run the plugin on <frames> frames, in blocks of 'blocksize' (if set)
+ *
+ * if the transfers line up with the blocks, the blocks are processed in place;
+ * otherwise the data is passed through FIFOs, which add 'latency' frames of delay
+ * (see iemladspa_hw_params()).
+ * if a transfer doesn't fit the expected alignment (e.g. a partial transfer),
+ * the waiting frames are processed as a short block, so we never run dry
+ */
+static void iemladspa_process_blocks(snd_pcm_iemladspa_t *iemladspa,
+                              LADSPA_Data**inports, LADSPA_Data**outports,
+                              unsigned long frames) {
+  iemladspa_fifo_t*fifo = &iemladspa->fifo;
+  const unsigned int blocksize = fifo->blocksize;
+  const unsigned int inchannels  = iemladspa->layout.num_inchannels;
+  const unsigned int outchannels = iemladspa->layout.num_outchannels;
+  unsigned long done = 0;
+  unsigned int j;
+
+  if(!blocksize) {
+    iemladspa_run(iemladspa, inports, outports, frames);
+    return;
   }
-  iemladspa->plugininstance = NULL;
 
+  if(!fifo->infill && !fifo->outfill) {
+    for(; done + blocksize <= frames; done += blocksize) {
+      for(j = 0; j < inchannels; j++)
+        fifo->inports[j] = inports[j] + done;
+      for(j = 0; j < outchannels; j++)
+        fifo->outports[j] = outports[j] + done;
+      iemladspa_run(iemladspa, fifo->inports, fifo->outports, blocksize);
+    }
+  }
 
-  if(iemladspa->control_data)
-    LADSPAcontrolUnMMAP(iemladspa->control_data);
-  iemladspa->control_data=NULL;
-  if(iemladspa->library)
-    LADSPAunload(iemladspa->library);
-  iemladspa->library=NULL;
-
-  s_mergeplugin_list = linked_list_delete(s_mergeplugin_list, iemladspa->key);
-  free(iemladspa);
-  return 0;
-}
+  while(done < frames) {
+    unsigned long n = blocksize - fifo->infill;
+    if(n > frames - done)
+      n = frames - done;
 
-static int iemladspa_init(snd_pcm_extplug_t *ext)
-{
-  const unsigned int default_frames=65536;
-  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)ext->private_data;
-  int i;
+    for(j = 0; j < inchannels; j++)
+      memcpy(fifo->in.data + j*blocksize + fifo->infill, inports[j] + done, n*sizeof(float));
+    fifo->infill += n;
 
-  if(!iemladspa->plugininstance) {
-    /* Instantiate a LADSPA Plugin */
-    iemladspa->plugininstance=iemladspa->klass->instantiate(iemladspa->klass, ext->rate);
+    if(fifo->infill == blocksize || fifo->outfill < n)
+      iemladspa_fifo_run(iemladspa);
 
-    if(iemladspa->plugininstance == NULL) {
-      return -1;
-    }
-    if(iemladspa->klass->activate) {
-      iemladspa->klass->activate(iemladspa->plugininstance);
+    for(j = 0; j < outchannels; j++) {
+      float*out = fifo->out.data + j*2*blocksize;
+      memcpy(outports[j] + done, out, n*sizeof(float));
+      memmove(out, out + n, (fifo->outfill - n)*sizeof(float));
     }
+    fifo->outfill -= n;
+    done += n;
   }
+}
 
-  /* Connect controls to the LADSPA Plugin */
-  for(i = 0; i < iemladspa->control_data->num_controls; i++) {
-    iemladspa->klass->connect_port(iemladspa->plugininstance,
-                                   iemladspa->control_data->data[i].index,
-                                   &iemladspa->control_data->data[i].data);
+/* run the plugin at its own rate on <frames> frames (at the device rate)
+ *
+ * the input is resampled to the plugin's rate, and its output back to ours.
+ * the upsampler never produces fewer frames than went into the downsampler
+ * (in total), so there is always enough output; the few frames it produces
+ * in excess wait in a FIFO for the next call.
+ */
+static void iemladspa_resample_process(snd_pcm_iemladspa_t *iemladspa,
+                                       LADSPA_Data**inports, LADSPA_Data**outports,
+                                       unsigned long frames) {
+  iemladspa_resampling_t*rs = &iemladspa->resampling;
+  const unsigned int outchannels = iemladspa->layout.num_outchannels;
+  unsigned long n;
+  unsigned int j;
+
+  n = resampler_process(&rs->down, (const float*const*)inports, frames, rs->in.data, rs->in.frames);
+  if(n) {
+    for(j = 0; j < iemladspa->layout.num_inchannels; j++)
+      rs->inports[j] = rs->in.data + j*rs->in.frames;
+    for(j = 0; j < outchannels; j++)
+      rs->outports[j] = rs->out.data + j*rs->out.frames;
+    iemladspa_process_blocks(iemladspa, rs->inports, rs->outports, n);
+    rs->fill += resampler_process(&rs->up, (const float*const*)rs->outports, n,
+                                  rs->fifo.data + rs->fill, rs->fifo.frames);
   }
 
-  audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf,
-                     default_frames,
-                     iemladspa->control_data->sourcechannels.in+iemladspa->control_data->sinkchannels.in);
-  audiobuffer_resize(&iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf,
-                     default_frames,
-                     iemladspa->control_data->sourcechannels.out+iemladspa->control_data->sinkchannels.out);
+  n = (rs->fill < frames) ? rs->fill : frames;
+  for(j = 0; j < outchannels; j++) {
+    float*fifo = rs->fifo.data + j*rs->fifo.frames;
+    memcpy(outports[j], fifo, n*sizeof(float));
+    memmove(fifo, fifo + n, (rs->fill - n)*sizeof(float));
+    /* (cannot happen) */
+    if(n < frames)
+      memset(outports[j] + n, 0, (frames - n)*sizeof(float));
+  }
+  rs->fill -= n;
+}
 
-  return 0;
+/* hand the mixer's latest settings to the plugins
+ * (so they see one consistent set per run, and never the file the mixer writes to) */
+static void iemladspa_controls_snapshot(snd_pcm_iemladspa_t *iemladspa) {
+  unsigned int k;
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    /* (if the mixer is busy, the previous settings are kept for another run) */
+    if(!plugin->shared_controls)
+      LADSPAcontrolSnapshot(plugin->control_data, plugin->controls, plugin->scratch, &plugin->seq);
+  }
+  /* replicas get the settings of their original (which comes before them),
+   * but keep what they report to themselves */
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    const LADSPA_Control*control = plugin->control_data;
+    unsigned long i;
+    if(!plugin->shared_controls)
+      continue;
+    for(i = 0; i < control->num_controls; i++)
+      if(LADSPA_CNTRL_INPUT == control->data[i].type)
+        plugin->controls[i] = plugin->original->controls[i];
+  }
+}
+/* publish the values of the plugins' output controls (only those that changed) */
+static void iemladspa_controls_publish(snd_pcm_iemladspa_t *iemladspa) {
+  unsigned int k;
+  unsigned long i;
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    const LADSPA_Control*control = plugin->control_data;
+    LADSPA_Control_Output*output = LADSPAcontrolOutput(control);
+    if(plugin->shared_controls)
+      continue;
+    for(i = 0; i < control->num_controls; i++)
+      if(LADSPA_CNTRL_OUTPUT == control->data[i].type && output->value[i] != plugin->controls[i])
+        output->value[i] = plugin->controls[i];
+  }
 }
 
-/*
- * try to create an alsa ext plugin
- * on success
- *     find an existing iemladspa-plugin with the same root-config
- *     on failure
- *         create a new iemladspa-plugin
- *     (on success)
- *         add ourself to the iemladspa-plugin (and vice-versa 'private_data')
- * on failure
- *   return FAIL
- */
+/* run the plugin on <frames> frames (at its own rate, if it has one) */
+static void iemladspa_process(snd_pcm_iemladspa_t *iemladspa,
+                              LADSPA_Data**inports, LADSPA_Data**outports,
+                              unsigned long frames) {
+  iemladspa_controls_snapshot(iemladspa);
+  if(iemladspa->resampling.active)
+    iemladspa_resample_process(iemladspa, inports, outports, frames);
+  else
+    iemladspa_process_blocks(iemladspa, inports, outports, frames);
+  iemladspa_controls_publish(iemladspa);
+}
 
-static snd_pcm_iemladspa_t * iemladspa_mergeplugin_create(const void *key,
-                                                          const char*libname,
-                                                          const char*module,
-                                                          const char*controlfile,
-                                                          iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels
-                                                          ) {
-  void *library = NULL;
-  const LADSPA_Descriptor *klass=NULL;
-  LADSPA_Control *control_data= NULL;
-  int success=0;
+/* set up the resamplers for a device running at <rate>
+ * (this decides about the buffers they need, so it comes before the arena is laid out) */
+static void iemladspa_resampling_config(snd_pcm_iemladspa_t *iemladspa, unsigned int rate) {
+  iemladspa_resampling_t*rs = &iemladspa->resampling;
+  snd_pcm_uframes_t frames = 0;
+  int i;
 
-  /* Open the LADSPA Plugin */
-  library = LADSPAload(libname);
-  if(library == NULL) goto finalize;
+  rs->active = rs->rate && rate && (rs->rate != rate);
+  rs->latency = 0;
+  if(!rs->active)
+    return;
+  for(i=0; i<=SND_PCM_STREAM_LAST; i++)
+    if(iemladspa->streamdir[i].period_size > frames)
+      frames = iemladspa->streamdir[i].period_size;
+  resampler_config(&rs->down, rate, rs->rate, rs->taps, iemladspa->layout.num_inchannels, frames);
+  resampler_config(&rs->up, rs->rate, rate, rs->taps, iemladspa->layout.num_outchannels,
+                   resampler_maxout(&rs->down, frames));
+}
+/* hand the resamplers their memory (once the arena is laid out) */
+static void iemladspa_resampling_init(iemladspa_resampling_t *rs) {
+  if(!rs->active || !rs->filters.data)
+    return;
+  resampler_init(&rs->down, rs->filters.data);
+  resampler_init(&rs->up, rs->filters.data + resampler_memsize(&rs->down));
+  rs->fill = 0;
+}
+/* start over with silence */
+static void iemladspa_resampling_reset(iemladspa_resampling_t *rs) {
+  if(!rs->active || !rs->filters.data)
+    return;
+  resampler_reset(&rs->down);
+  resampler_reset(&rs->up);
+  rs->fill = 0;
+}
+/* the size of a transfer of <frames> frames at the plugin's rate
+ * (1 if it varies from transfer to transfer) */
+static unsigned long iemladspa_resampling_frames(const iemladspa_resampling_t *rs, unsigned long frames) {
+  if(!rs->active)
+    return frames;
+  if((frames * rs->down.up) % rs->down.down)
+    return 1;
+  return frames * rs->down.up / rs->down.down;
+}
+/* the delay of both filters, and of the FIFO's <fifolatency> frames at the plugin's rate */
+static void iemladspa_resampling_latency(iemladspa_resampling_t *rs, unsigned int fifolatency) {
+  const double ratio = (double)rs->down.down / rs->down.up; /* device frames per plugin frame */
+  if(!rs->active)
+    return;
+  rs->latency = (unsigned int)(resampler_delay(&rs->down) + resampler_delay(&rs->up) * ratio
+                               + fifolatency * ratio + 0.5);
+}
 
-  klass = LADSPAfind(library, libname, module);
-  if(klass == NULL)goto finalize;
+/* frames of delay between the input and the output of the plugin (at the device rate) */
+static unsigned int iemladspa_latency(snd_pcm_iemladspa_t *iemladspa) {
+  const unsigned int latency = iemladspa->plugin_latency + iemladspa->worker.latency;
+  if(iemladspa->resampling.active)
+    return iemladspa->resampling.latency + latency;
+  return iemladspa->fifo.latency + latency;
+}
 
-  control_data = LADSPAcontrolMMAP(klass, controlfile,
-                                   sourcechannels, sinkchannels);
+/* frames of delay a plugin reports on its "latency" port (at its rate) */
+static unsigned long plugin_latency(const iemladspa_plugin_t *plugin) {
+  const LADSPA_Data latency = plugin->latency?*plugin->latency:0;
+  return (latency > 0)?(unsigned long)(latency + 0.5):0;
+}
+/* frames of delay from the PCM's inputs to a wire of the graph (-1: silence) */
+static unsigned long graph_wire_latency(const iemladspa_graph_t*graph, int wire) {
+  unsigned int k;
+  if(wire < (int)graph->num_inputs)
+    return 0;
+  for(k = 0; k < graph->num_nodes; k++)
+    if((unsigned int)wire < graph->nodes[k].first_output + graph->nodes[k].num_outputs)
+      return graph->nodes[k].latency;
+  return 0;
+}
+/* frames of delay through the graph: along its longest path */
+static unsigned long graph_latency(iemladspa_graph_t*graph) {
+  unsigned long latency = 0;
+  unsigned int k, j;
+  /* nodes are only fed by nodes defined before them */
+  for(k = 0; k < graph->num_nodes; k++) {
+    iemladspa_node_t*node = &graph->nodes[k];
+    node->latency = 0;
+    for(j = 0; j < node->num_inputs; j++) {
+      const unsigned long input = graph_wire_latency(graph, node->inputs[j]);
+      if(input > node->latency)
+        node->latency = input;
+    }
+    node->latency += plugin_latency(node->plugin);
+  }
+  for(j = 0; j < graph->num_outputs; j++) {
+    const unsigned long output = graph_wire_latency(graph, graph->outputs[j]);
+    if(output > latency)
+      latency = output;
+  }
+  return latency;
+}
+/* pick up the delay the plugins report (which may change while they run),
+ * and publish the total delay via the controls file */
+static void iemladspa_latency_update(snd_pcm_iemladspa_t *iemladspa, unsigned int rate) {
+  const iemladspa_resampling_t*rs = &iemladspa->resampling;
+  LADSPA_Control*control = iemladspa->plugins[0].control_data;
+  unsigned long latency = 0;
+  unsigned int k;
+  if(iemladspa->graph)
+    latency = graph_latency(iemladspa->graph);
+  else
+    for(k = 0; k < iemladspa->num_plugins; k++)
+      latency += plugin_latency(&iemladspa->plugins[k]);
+  /* the plugins count frames at their own rate */
+  if(rs->active)
+    latency = (latency * rs->down.down + rs->down.up / 2) / rs->down.up;
+  iemladspa->plugin_latency = latency;
+
+  /* the tail has to make it through the FIFO, the resamplers, the worker and the plugins as well */
+  iemladspa->gate.tail = (unsigned long)iemladspa->gate.tail_ms * rate / 1000
+    + iemladspa_latency(iemladspa);
+  /* (don't dirty the shared cache line needlessly) */
+  if(LADSPAcontrolOutput(control)->latency != iemladspa_latency(iemladspa))
+    LADSPAcontrolOutput(control)->latency = iemladspa_latency(iemladspa);
+}
 
-  if(NULL == control_data) goto finalize;
-  success=1;
+/* greatest common divisor */
+static unsigned long gcd(unsigned long a, unsigned long b) {
+  while(b) {
+    unsigned long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
 
- finalize:
+/* (re)start the FIFOs with <latency> frames of silence */
+static void iemladspa_fifo_reset(iemladspa_fifo_t*fifo) {
+  if(!fifo->blocksize)
+    return;
+  fifo->infill = 0;
+  fifo->outfill = fifo->latency;
+  if(fifo->out.data)
+    memset(fifo->out.data, 0, fifo->out.size*sizeof(float));
+}
 
-  if(success) {
-    snd_pcm_iemladspa_t*iemladspa=(snd_pcm_iemladspa_t*)calloc(1, sizeof(snd_pcm_iemladspa_t));
-    if(!iemladspa)return NULL;
-    iemladspa->key              = key;
-    iemladspa->library          = library;
-    iemladspa->klass            = klass;
-    iemladspa->control_data     = control_data;
-    iemladspa->stream_direction = -1;
+/* ring helpers: the producer owns 'wpos', the consumer owns 'rpos' */
+static inline float*ring_at(iemladspa_ring_t*ring, unsigned int channel, unsigned long pos) {
+  return ring->buf.data + channel*ring->buf.frames + (pos & (ring->buf.frames - 1));
+}
+static inline unsigned long ring_readable(iemladspa_ring_t*ring) {
+  return __atomic_load_n(&ring->wpos, __ATOMIC_ACQUIRE) - ring->rpos;
+}
+static inline unsigned long ring_writable(iemladspa_ring_t*ring) {
+  return ring->buf.frames - (ring->wpos - __atomic_load_n(&ring->rpos, __ATOMIC_ACQUIRE));
+}
+static void ring_write(iemladspa_ring_t*ring, LADSPA_Data**ports, unsigned long offset, unsigned long frames) {
+  const unsigned long head = ring->buf.frames - (ring->wpos & (ring->buf.frames - 1));
+  const unsigned long n = (frames < head)?frames:head;
+  unsigned int c;
+  for(c=0; c<ring->buf.channels; c++) {
+    memcpy(ring_at(ring, c, ring->wpos), ports[c] + offset, n * sizeof(float));
+    memcpy(ring_at(ring, c, ring->wpos + n), ports[c] + offset + n, (frames - n) * sizeof(float));
+  }
+  __atomic_store_n(&ring->wpos, ring->wpos + frames, __ATOMIC_RELEASE);
+}
+static void ring_read(iemladspa_ring_t*ring, LADSPA_Data**ports, unsigned long offset, unsigned long frames) {
+  const unsigned long head = ring->buf.frames - (ring->rpos & (ring->buf.frames - 1));
+  const unsigned long n = (frames < head)?frames:head;
+  unsigned int c;
+  for(c=0; c<ring->buf.channels; c++) {
+    memcpy(ports[c] + offset, ring_at(ring, c, ring->rpos), n * sizeof(float));
+    memcpy(ports[c] + offset + n, ring_at(ring, c, ring->rpos + n), (frames - n) * sizeof(float));
+  }
+  __atomic_store_n(&ring->rpos, ring->rpos + frames, __ATOMIC_RELEASE);
+}
+static unsigned int pow2_ceil(unsigned int n) {
+  unsigned int p = 1;
+  while(p < n)
+    p <<= 1;
+  return p;
+}
 
-    return iemladspa;
+/* the worker thread: run the plugin on whatever the transfers have pushed,
+ * directly on the ring memory
+ * (the time it takes counts towards the load of the stream that runs the plugin) */
+static void *iemladspa_worker_thread(void *data) {
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)data;
+  iemladspa_worker_t*worker = &iemladspa->worker;
+  iemladspa_ring_t*in = &worker->in, *out = &worker->out;
+  stats_meter_t*meter = &iemladspa->streamdir[iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled?
+                                               SND_PCM_STREAM_PLAYBACK:SND_PCM_STREAM_CAPTURE].meter;
+  unsigned int j;
+
+  while(1) {
+    sem_wait(&worker->wakeup);
+    if(__atomic_load_n(&worker->stop, __ATOMIC_ACQUIRE))
+      break;
+    while(1) {
+      unsigned long frames = ring_readable(in), n;
+      n = ring_writable(out);
+      if(n < frames)
+        frames = n;
+      /* don't run across the wrap-around of either ring */
+      n = in->buf.frames - (in->rpos & (in->buf.frames - 1));
+      if(n < frames)
+        frames = n;
+      n = out->buf.frames - (out->wpos & (out->buf.frames - 1));
+      if(n < frames)
+        frames = n;
+      /* never more than a period at once (that's what the buffers are made for) */
+      if(worker->latency < frames)
+        frames = worker->latency;
+      if(!frames)
+        break;
+
+      for(j = 0; j < in->buf.channels; j++)
+        worker->inports[j] = ring_at(in, j, in->rpos);
+      for(j = 0; j < out->buf.channels; j++)
+        worker->outports[j] = ring_at(out, j, out->wpos);
+      if(iemladspa->stats) {
+        const uint64_t start = stats_now();
+        iemladspa_process(iemladspa, worker->inports, worker->outports, frames);
+        stats_meter_offload(meter, stats_now() - start);
+      } else
+        iemladspa_process(iemladspa, worker->inports, worker->outports, frames);
+
+      __atomic_store_n(&in->rpos, in->rpos + frames, __ATOMIC_RELEASE);
+      __atomic_store_n(&out->wpos, out->wpos + frames, __ATOMIC_RELEASE);
+    }
   }
-  if(library)
-    LADSPAunload(library);
   return NULL;
 }
 
+static void iemladspa_worker_stop(iemladspa_worker_t*worker) {
+  if(!worker->running)
+    return;
+  __atomic_store_n(&worker->stop, 1, __ATOMIC_RELEASE);
+  sem_post(&worker->wakeup);
+  pthread_join(worker->thread, NULL);
+  worker->running = 0;
+}
 
-static snd_pcm_iemladspa_t * iemladspa_mergeplugin_findorcreate(const void *key,
-                                                                const char*libname,
-                                                                const char*module,
-                                                                const char*controlfile,
-                                                                iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels
-                                                                ) {
-  /* find a 'iemladspa' instance with 'key' */
-  snd_pcm_iemladspa_t*iemladspa=linked_list_find(s_mergeplugin_list, key);
-  if(!iemladspa) {
-    iemladspa = iemladspa_mergeplugin_create(key, libname, module, controlfile, sourcechannels, sinkchannels);
-    s_mergeplugin_list = linked_list_add(s_mergeplugin_list, key, iemladspa);
+/* how often the persist thread looks at the settings (in milliseconds) */
+#define PERSIST_INTERVAL_MS 500
+/* looks after which changing settings are written back anyhow */
+#define PERSIST_MAX_WAIT 10
+
+/* write back the settings that have settled since the last look
+ * (or that have kept changing for too long); <flush>: all of them, now */
+static void iemladspa_persist_run(snd_pcm_iemladspa_t *iemladspa, int flush) {
+  unsigned int k;
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    unsigned int seq;
+    if(!plugin->persist)
+      continue;
+    seq = __atomic_load_n(&LADSPAcontrolInput(plugin->control_data)->seq, __ATOMIC_ACQUIRE);
+    if(seq == plugin->persisted)
+      continue;
+    if(!flush && (seq != plugin->pending || (seq & 1)) && plugin->waited < PERSIST_MAX_WAIT) {
+      plugin->pending = seq;
+      plugin->waited++;
+      continue;
+    }
+    /* (on failure, try again after the next change) */
+    if(LADSPAcontrolPersist(plugin->control_data, plugin->persist, &plugin->persisted) < 0)
+      plugin->persisted = seq;
+    plugin->pending = plugin->persisted;
+    plugin->waited = 0;
   }
-  if(iemladspa)
-    iemladspa->usecount++;
+}
 
-  return iemladspa;
+static void *iemladspa_persist_thread(void *arg) {
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t*)arg;
+  iemladspa_persist_t *persist = &iemladspa->persist;
+  struct timespec wakeup;
+
+  pthread_mutex_lock(&persist->mutex);
+  clock_gettime(CLOCK_MONOTONIC, &wakeup);
+  while(!persist->stop) {
+    wakeup.tv_nsec += PERSIST_INTERVAL_MS * 1000000L;
+    while(wakeup.tv_nsec >= 1000000000L) {
+      wakeup.tv_nsec -= 1000000000L;
+      wakeup.tv_sec++;
+    }
+    while(!persist->stop && pthread_cond_timedwait(&persist->cond, &persist->mutex, &wakeup) != ETIMEDOUT);
+    if(!persist->stop)
+      iemladspa_persist_run(iemladspa, 0);
+  }
+  pthread_mutex_unlock(&persist->mutex);
+  iemladspa_persist_run(iemladspa, 1);
+  return NULL;
 }
 
+/* write back the settings one last time, and stop the persist thread */
+static void iemladspa_persist_stop(iemladspa_persist_t *persist) {
+  if(!persist->running)
+    return;
+  pthread_mutex_lock(&persist->mutex);
+  persist->stop = 1;
+  pthread_cond_signal(&persist->cond);
+  pthread_mutex_unlock(&persist->mutex);
+  pthread_join(persist->thread, NULL);
+  pthread_cond_destroy(&persist->cond);
+  pthread_mutex_destroy(&persist->mutex);
+  persist->running = 0;
+}
 
-static snd_pcm_extplug_callback_t iemladspa_callback = {
-  .transfer = iemladspa_transfer,
-  .init = iemladspa_init,
-  .close = iemladspa_close,
-};
+/* start the persist thread, if any of the controls live in shared memory
+ * (it runs with the default scheduling: it is all about the filesystem) */
+static int iemladspa_persist_start(snd_pcm_iemladspa_t *iemladspa) {
+  iemladspa_persist_t *persist = &iemladspa->persist;
+  pthread_condattr_t attr;
+  unsigned int k;
+  int err;
 
-SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
-{
+  if(persist->running)
+    return 0;
+  for(k = 0; k < iemladspa->num_plugins; k++)
+    if(iemladspa->plugins[k].persist)
+      break;
+  if(k == iemladspa->num_plugins)
+    return 0;
+
+  persist->stop = 0;
+  pthread_mutex_init(&persist->mutex, NULL);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&persist->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  err = pthread_create(&persist->thread, NULL, iemladspa_persist_thread, iemladspa);
+  if(err) {
+    pthread_cond_destroy(&persist->cond);
+    pthread_mutex_destroy(&persist->mutex);
+    return -err;
+  }
+  persist->running = 1;
+  return 0;
+}
+
+/* (re)start the worker with empty rings;
+ * the transfers start out with one period of silence (see iemladspa_worker_exchange()) */
+static int iemladspa_worker_start(snd_pcm_iemladspa_t *iemladspa) {
+  iemladspa_worker_t*worker = &iemladspa->worker;
+  pthread_attr_t attr;
+  int err;
+
+  iemladspa_worker_stop(worker);
+  if(!worker->in.buf.data || !worker->out.buf.data)
+    return -EINVAL;
+  if(!worker->have_sem) {
+    if(sem_init(&worker->wakeup, 0, 0))
+      return -errno;
+    worker->have_sem = 1;
+  }
+  while(!sem_trywait(&worker->wakeup));
+  worker->in.rpos = worker->in.wpos = 0;
+  worker->out.rpos = worker->out.wpos = 0;
+  worker->debt = -(long)worker->latency;
+  worker->stop = 0;
+
+  pthread_attr_init(&attr);
+  if(worker->priority > 0) {
+    struct sched_param param;
+    param.sched_priority = worker->priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+  if(worker->cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+  }
+  err = pthread_create(&worker->thread, &attr, iemladspa_worker_thread, iemladspa);
+  if(err == EPERM) {
+    /* not allowed to use realtime scheduling (or that CPU): run the thread anyhow */
+    DEBUG("cannot create RT worker thread, falling back to default scheduling\n");
+    pthread_attr_destroy(&attr);
+    pthread_attr_init(&attr);
+    err = pthread_create(&worker->thread, &attr, iemladspa_worker_thread, iemladspa);
+  }
+  pthread_attr_destroy(&attr);
+  if(err)
+    return -err;
+  worker->running = 1;
+  return 0;
+}
+
+/* hand <frames> frames from <inports> to the worker,
+ * and fill <outports> with what it has produced for the previous period
+ * (if the worker is late, the missing frames are filled with silence,
+ *  and dropped once they arrive, so the latency stays the same) */
+static void iemladspa_worker_exchange(snd_pcm_iemladspa_t *iemladspa,
+                                      LADSPA_Data**inports, LADSPA_Data**outports,
+                                      unsigned long frames) {
+  iemladspa_worker_t*worker = &iemladspa->worker;
+  const unsigned int outchannels = iemladspa->layout.num_outchannels;
+  unsigned long n, done = 0;
+  unsigned int j;
+
+  n = ring_writable(&worker->in);
+  if(n > frames)
+    n = frames;
+  ring_write(&worker->in, inports, 0, n);
+  sem_post(&worker->wakeup);
+  /* the output for input we had to drop will never arrive */
+  worker->debt -= frames - n;
+
+  if(worker->debt < 0) {
+    n = -worker->debt;
+    if(n > frames)
+      n = frames;
+    for(j = 0; j < outchannels; j++)
+      memset(outports[j], 0, n * sizeof(float));
+    worker->debt += n;
+    done = n;
+  }
+  n = ring_readable(&worker->out);
+  if(worker->debt > 0) {
+    unsigned long drop = ((unsigned long)worker->debt < n)?worker->debt:n;
+    __atomic_store_n(&worker->out.rpos, worker->out.rpos + drop, __ATOMIC_RELEASE);
+    worker->debt -= drop;
+    n -= drop;
+  }
+  if(n > frames - done)
+    n = frames - done;
+  ring_read(&worker->out, outports, done, n);
+  done += n;
+  if(done < frames) {
+    for(j = 0; j < outchannels; j++)
+      memset(outports[j] + done, 0, (frames - done) * sizeof(float));
+    worker->debt += frames - done;
+  }
+}
+
+/* run the plugin once on a period (or block) of silence,
+ * so its own memory is paged in before the first real period */
+static void iemladspa_warmup(snd_pcm_iemladspa_t *iemladspa, snd_pcm_uframes_t frames) {
+  iemladspa_fifo_t*fifo = &iemladspa->fifo;
+  float*inbuf  = iemladspa->streamdir[SND_PCM_STREAM_CAPTURE ].buf.data;
+  float*outbuf = iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data;
+  unsigned int j;
+
+  if(fifo->blocksize) {
+    if(!fifo->in.data || !fifo->out.data)
+      return;
+    samples_mute(fifo->in.data, fifo->blocksize, iemladspa->layout.num_inchannels);
+    fifo->infill = fifo->blocksize;
+    fifo->outfill = 0;
+    iemladspa_fifo_run(iemladspa);
+    return;
+  }
+
+  if(!frames || !inbuf || !outbuf)
+    return;
+  samples_mute(inbuf, frames, iemladspa->layout.num_inchannels);
+  for(j = 0; j < iemladspa->layout.num_inchannels; j++)
+    iemladspa->inports[j] = inbuf + j*frames;
+  for(j = 0; j < iemladspa->layout.num_outchannels; j++)
+    iemladspa->outports[j] = outbuf + j*frames;
+  iemladspa_run(iemladspa, iemladspa->inports, iemladspa->outports, frames);
+}
+
+/* lay out all the audio buffers in the arena
+ * (if <arena> is NULL, only calculate the number of bytes needed)
+ * - the shared planar buffers hold the largest period of both streams
+ * - each stream has its own scratch buffer for one of its periods
+ * - the FIFO holds one block of input and two blocks of output
+ * - when resampling, the buffers between the plugins hold a period at the
+ *   plugin's rate (if that is more) */
+static size_t iemladspa_arena_layout(snd_pcm_iemladspa_t *iemladspa, iemladspa_arena_t *arena) {
+  const iemladspa_layout_t*control = &iemladspa->layout;
+  iemladspa_fifo_t*fifo = &iemladspa->fifo;
+  iemladspa_resampling_t*rs = &iemladspa->resampling;
+  snd_pcm_uframes_t frames = 0, pluginframes;
+  size_t offset = 0;
+  int i;
+
+  for(i=0; i<=SND_PCM_STREAM_LAST; i++)
+    if(iemladspa->streamdir[i].period_size > frames)
+      frames = iemladspa->streamdir[i].period_size;
+  pluginframes = frames;
+  if(rs->active && resampler_maxout(&rs->down, frames) > pluginframes)
+    pluginframes = resampler_maxout(&rs->down, frames);
+
+  audiobuffer_carve(&iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].buf, arena, &offset,
+                    frames, control->sourcechannels.in +control->sinkchannels.in);
+  audiobuffer_carve(&iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf, arena, &offset,
+                    frames, control->sourcechannels.out+control->sinkchannels.out);
+  for(i=0; i<=SND_PCM_STREAM_LAST; i++) {
+    iemladspa_stream_t*stream = &iemladspa->streamdir[i];
+    unsigned int channels = (stream->ext.channels > stream->ext.slave_channels)
+      ?stream->ext.channels:stream->ext.slave_channels;
+    /* the scratch buffer counts floats, samples are at most 64bit */
+    audiobuffer_carve(&stream->scratch, arena, &offset, stream->period_size, channels * 2);
+  }
+  if(iemladspa->graph) {
+    const unsigned int graphframes = (fifo->blocksize > pluginframes)?fifo->blocksize:pluginframes;
+    audiobuffer_carve(&iemladspa->graph->wires, arena, &offset, graphframes,
+                      iemladspa->graph->num_wires - iemladspa->graph->num_inputs);
+  } else if(iemladspa->num_plugins > 1) {
+    const unsigned int chainframes = (fifo->blocksize > pluginframes)?fifo->blocksize:pluginframes;
+    audiobuffer_carve(&iemladspa->chain[0], arena, &offset, chainframes, control->num_outchannels);
+    audiobuffer_carve(&iemladspa->chain[1], arena, &offset, chainframes, control->num_outchannels);
+  }
+  if(iemladspa->worker.enabled) {
+    /* room for a few periods, in case the worker falls behind */
+    const unsigned int ringsize = pow2_ceil(4 * frames);
+    audiobuffer_carve(&iemladspa->worker.in.buf, arena, &offset, ringsize, control->num_inchannels);
+    audiobuffer_carve(&iemladspa->worker.out.buf, arena, &offset, ringsize, control->num_outchannels);
+  }
+  if(fifo->blocksize) {
+    audiobuffer_carve(&fifo->in, arena, &offset, fifo->blocksize,
+                      control->sourcechannels.in +control->sinkchannels.in);
+    audiobuffer_carve(&fifo->out, arena, &offset, 2*fifo->blocksize,
+                      control->sourcechannels.out+control->sinkchannels.out);
+  }
+  if(rs->active) {
+    const unsigned long maxin = resampler_maxout(&rs->down, frames);
+    audiobuffer_carve(&rs->filters, arena, &offset,
+                      resampler_memsize(&rs->down) + resampler_memsize(&rs->up), 1);
+    audiobuffer_carve(&rs->in , arena, &offset, maxin, control->num_inchannels);
+    audiobuffer_carve(&rs->out, arena, &offset, maxin, control->num_outchannels);
+    /* a period, plus what the upsampler may produce in excess */
+    audiobuffer_carve(&rs->fifo, arena, &offset, resampler_maxout(&rs->up, maxin) + frames,
+                      control->num_outchannels);
+  }
+  return offset;
+}
+
+/* size the sub-blocks from the L2 cache */
+#define SUBBLOCK_AUTO -1
+/* the part of the L2 cache a sub-block may use (the plugin needs some as well) */
+#define SUBBLOCK_L2_SHARE 2
+/* the L2 cache size, if the system doesn't tell */
+#define SUBBLOCK_L2_DEFAULT (256*1024)
+
+/* the number of frames that a transfer works on in one go
+ * large transfers are cut into sub-blocks, whose audio (in all its shapes)
+ * stays in the cache from the deinterleaving to the reinterleaving */
+static snd_pcm_uframes_t iemladspa_subblock_frames(snd_pcm_iemladspa_t *iemladspa,
+                                                   const iemladspa_plan_t *plan) {
+  const iemladspa_layout_t*control = &iemladspa->layout;
+  const unsigned int blocksize = iemladspa->fifo.blocksize;
+  snd_pcm_uframes_t frames = iemladspa->subblock;
+  if(!frames)
+    return plan->frames;
+
+  if(SUBBLOCK_AUTO == iemladspa->subblock) {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    /* the ALSA areas, the planar in- and outputs, and the buffers between the plugins */
+    size_t bytes = plan->alsa_inchannels  * snd_pcm_format_physical_width(plan->informat) / 8
+      + plan->alsa_outchannels * snd_pcm_format_physical_width(plan->outformat) / 8
+      + (control->num_inchannels + control->num_outchannels) * sizeof(float);
+    if(iemladspa->graph)
+      bytes += (iemladspa->graph->num_wires - iemladspa->graph->num_inputs) * sizeof(float);
+    else if(iemladspa->num_plugins > 1)
+      bytes += 2 * control->num_outchannels * sizeof(float);
+    if(l2 <= 0)
+      l2 = SUBBLOCK_L2_DEFAULT;
+    frames = l2 / SUBBLOCK_L2_SHARE / bytes;
+    /* whole cache lines of FLOAT samples */
+    frames &= ~15UL;
+    if(frames < 16)
+      frames = 16;
+  }
+  /* the FIFO relies on the transfers being aligned to the blocks */
+  if(blocksize)
+    frames = (frames < blocksize) ? blocksize : frames - frames % blocksize;
+  return (frames < plan->frames) ? frames : plan->frames;
+}
+
+/* precompute what the transfer of a stream needs */
+static int iemladspa_plan_build(snd_pcm_iemladspa_t *iemladspa, snd_pcm_extplug_t *ext) {
+  iemladspa_stream_t*stream = &iemladspa->streamdir[ext->stream];
+  iemladspa_plan_t*plan = &stream->plan;
+  const iemladspa_layout_t*control = &iemladspa->layout;
+  const int playback = (SND_PCM_STREAM_PLAYBACK == ext->stream);
+
+  memset(plan, 0, sizeof(*plan));
+  memset(&stream->src, 0, sizeof(stream->src));
+  memset(&stream->dst, 0, sizeof(stream->dst));
+
+  plan->runner = iemladspa_is_runner(iemladspa, ext->stream);
+  plan->frames = stream->period_size;
+
+  /* input/output sample formats for the alsa-plugin (transfer call) */
+  plan->informat  = ( playback)?ext->format:ext->slave_format;
+  plan->outformat = (!playback)?ext->format:ext->slave_format;
+  if(!iemladspa_get_kernels(plan->informat , &plan->deinterleave, NULL)
+     || !iemladspa_get_kernels(plan->outformat, NULL, &plan->reinterleave))
+    return 0;
+
+  /* input/output channels for the alsa-plugin (transfer call) */
+  plan->alsa_inchannels  = ( playback)?ext->channels:ext->slave_channels;
+  plan->alsa_outchannels = (!playback)?ext->channels:ext->slave_channels;
+
+  /* input/output channels for the ladspa-plugin */
+  plan->inchannels  = (playback)?(control->sourcechannels.in ):(control->sinkchannels.in);
+  plan->outchannels = (playback)?(control->sourcechannels.out):(control->sinkchannels.out);
+  plan->chanoffset_in  = (playback)?control->sourcechannels.in :0;
+  plan->chanoffset_out = (playback)?control->sourcechannels.out:0;
+
+  /* in PLAYBACK mode, the client-application might send us data in MONO;
+   * in CAPTURE mode, it might want to receive MONO data */
+  if(plan->alsa_inchannels != plan->inchannels) {
+    if(!playback || 1 != plan->alsa_inchannels)
+      return 0;
+    plan->dupe = 1;
+  }
+  if(plan->alsa_outchannels != plan->outchannels) {
+    if(playback || 1 != plan->alsa_outchannels)
+      return 0;
+    plan->mixdown = 1;
+  }
+
+  plan->zerocopy_in  = plan->runner && !plan->dupe    && (SND_PCM_FORMAT_FLOAT == plan->informat);
+  plan->zerocopy_out = plan->runner && !plan->mixdown && (SND_PCM_FORMAT_FLOAT == plan->outformat);
+
+  /* MUTE the inputs of unused streams (their outputs are simply never read) */
+  if(!iemladspa->streamdir[SND_PCM_STREAM_CAPTURE].enabled) {
+    plan->mute_in [plan->num_mute_in ][0] = 0;
+    plan->mute_in [plan->num_mute_in ][1] = control->sourcechannels.in;
+    plan->num_mute_in++;
+  }
+  if(!iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled) {
+    plan->mute_in [plan->num_mute_in ][0] = control->sourcechannels.in;
+    plan->mute_in [plan->num_mute_in ][1] = control->sinkchannels.in;
+    plan->num_mute_in++;
+  }
+
+  plan->frames = iemladspa_subblock_frames(iemladspa, plan);
+  plan->valid = (plan->frames > 0);
+  return plan->valid;
+}
+
+/* length of the crossfade when (un)bypassing the plugin */
+#define BYPASS_FADE 256
+
+/* crossfade between the plugin output and its input, while the bypass is switched
+ * (the plugin's latency has to pass before its output can be faded back in) */
+static void iemladspa_bypass_fade(snd_pcm_iemladspa_t *iemladspa,
+                                  LADSPA_Data**inports, LADSPA_Data**outports,
+                                  unsigned long frames, int bypass) {
+  iemladspa_bypass_t*state = &iemladspa->bypass;
+  const unsigned int channels = iemladspa->layout.num_outchannels;
+  unsigned long frame;
+  unsigned int j;
+
+  for(frame = 0; frame < frames; frame++) {
+    float dry;
+    if(bypass) {
+      if(state->dry < BYPASS_FADE)
+        state->dry++;
+    } else if(state->wait) {
+      state->wait--;
+    } else if(state->dry) {
+      state->dry--;
+    }
+    dry = (float)state->dry / BYPASS_FADE;
+    /* (the output channels of the plugin correspond to its input channels) */
+    for(j = 0; j < channels; j++)
+      outports[j][frame] += dry * (inports[j][frame] - outports[j][frame]);
+  }
+}
+
+/* the plugin is bypassed: hand the input of the transfer straight to its output */
+static void iemladspa_bypass_transfer(iemladspa_stream_t*stream, const iemladspa_plan_t*plan,
+                                      float*buf,
+                                      const snd_pcm_channel_area_t *dst_areas, snd_pcm_uframes_t dst_offset,
+                                      iemladspa_areashape_t dstshape,
+                                      const snd_pcm_channel_area_t *src_areas, snd_pcm_uframes_t src_offset,
+                                      iemladspa_areashape_t srcshape,
+                                      snd_pcm_uframes_t size) {
+  if(plan->informat == plan->outformat && plan->alsa_inchannels == plan->alsa_outchannels) {
+    snd_pcm_areas_copy(dst_areas, dst_offset, src_areas, src_offset,
+                       plan->alsa_outchannels, size, plan->outformat);
+    return;
+  }
+
+  /* different formats (or MONO): convert via FLOAT */
+  if(plan->dupe) {
+    areas_deinterleave_dupe(&stream->scratch, plan->deinterleave, srcshape,
+                            src_areas, src_offset, plan->informat, buf, size, plan->inchannels);
+  } else {
+    areas_deinterleave(&stream->scratch, plan->deinterleave, srcshape,
+                       src_areas, src_offset, plan->informat, buf, size, plan->inchannels);
+  }
+  if(plan->mixdown) {
+    areas_reinterleave_mixdown(&stream->scratch, plan->reinterleave, buf, size, plan->outchannels,
+                               dstshape, dst_areas, dst_offset, plan->outformat);
+  } else {
+    areas_reinterleave(&stream->scratch, plan->reinterleave, buf, size, plan->outchannels,
+                       dstshape, dst_areas, dst_offset, plan->outformat);
+  }
+}
+
+static snd_pcm_sframes_t iemladspa_transfer(snd_pcm_extplug_t *ext,
+                                            const snd_pcm_channel_area_t *dst_areas,
+                                            snd_pcm_uframes_t dst_offset,
+                                            const snd_pcm_channel_area_t *src_areas,
+                                            snd_pcm_uframes_t src_offset,
+                                            snd_pcm_uframes_t size)
+{
+  DEBUG("transfer: stream=%d\tchannels=%d\tslavechannels=%d\n", ext->stream, ext->channels, ext->slave_channels);
+
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)(ext->private_data);
+  iemladspa_stream_t*stream = &iemladspa->streamdir[ext->stream];
+  const iemladspa_plan_t*plan = &stream->plan;
+  iemladspa_areashape_t srcshape, dstshape;
+  float*inbuf, *outbuf;
+  LADSPA_Data**inports  = iemladspa->inports;
+  LADSPA_Data**outports = iemladspa->outports;
+  int zerocopy_in = 0, zerocopy_out = 0;
+  int gated, bypass = 0;
+  unsigned int j;
+
+  if(!plan->valid && !iemladspa_plan_build(iemladspa, ext))
+    return size;
+  stats_meter_start(&stream->meter);
+
+  /* never process more than our buffers (or a sub-block) can hold
+   * (ALSA will call us again for the rest) */
+  if(size > plan->frames)
+    size = plan->frames;
+
+  /* NOTE: swap source and destination memory space when deinterleaved.
+     then swap it back during the interleave call below */
+  inbuf  = iemladspa->streamdir[SND_PCM_STREAM_CAPTURE ].buf.data;
+  outbuf = iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf.data;
+
+  srcshape = areas_shape(&stream->src, src_areas, plan->alsa_inchannels , plan->informat);
+  dstshape = areas_shape(&stream->dst, dst_areas, plan->alsa_outchannels, plan->outformat);
+
+  /* the runner decides about the bypass (so the latency is handled in one place) */
+  if(plan->runner) {
+    iemladspa_latency_update(iemladspa, ext->rate);
+    /* (the mixer sets it, from another process) */
+    bypass = (0 != __atomic_load_n(&LADSPAcontrolInput(iemladspa->plugins[0].control_data)->bypass,
+                                   __ATOMIC_RELAXED));
+    if(!bypass && __atomic_load_n(&iemladspa->bypass.active, __ATOMIC_RELAXED)) {
+      /* coming back: wait for the plugin's latency, then fade it in */
+      __atomic_store_n(&iemladspa->bypass.active, 0, __ATOMIC_RELAXED);
+      iemladspa->bypass.wait = iemladspa_latency(iemladspa);
+    }
+  }
+  if(__atomic_load_n(&iemladspa->bypass.active, __ATOMIC_RELAXED)) {
+    iemladspa_bypass_transfer(stream, plan, inbuf + plan->chanoffset_in*size,
+                              dst_areas, dst_offset, dstshape,
+                              src_areas, src_offset, srcshape, size);
+    stats_meter_lap(&stream->meter, STATS_REINTERLEAVE);
+    stats_meter_stop(&stream->meter, size);
+    iemladspa->stream_direction = ext->stream;
+    return size;
+  }
+
+  if(plan->runner) {
+    for(j = 0; j < iemladspa->layout.num_inchannels; j++)
+      inports[j] = inbuf + j*size;
+    for(j = 0; j < iemladspa->layout.num_outchannels; j++)
+      outports[j] = outbuf + j*size;
+
+    /* if the ALSA areas of our own channels are already LADSPA-style FLOAT buffers,
+     * we connect the ports to them directly and skip the copying */
+    if(plan->zerocopy_in && AREAS_PLANAR == srcshape) {
+      areas_ladspa(src_areas, src_offset, plan->inchannels, inports + plan->chanoffset_in);
+      zerocopy_in = 1;
+    }
+    if(plan->zerocopy_out && AREAS_PLANAR == dstshape) {
+      areas_ladspa(dst_areas, dst_offset, plan->outchannels, outports + plan->chanoffset_out);
+      zerocopy_out = 1;
+      if(1 == iemladspa->num_plugins && !iemladspa->graph
+         && LADSPA_IS_INPLACE_BROKEN(iemladspa->plugins[0].klass->Properties)
+         && ports_overlap(inports, iemladspa->layout.num_inchannels,
+                          outports + plan->chanoffset_out, plan->outchannels)) {
+        /* don't let the plugin write into its own input */
+        for(j = 0; j < plan->outchannels; j++)
+          outports[plan->chanoffset_out + j] = outbuf + (plan->chanoffset_out + j)*size;
+        zerocopy_out = 0;
+      }
+    }
+  }
+
+  if(zerocopy_in) {
+    /* nothing to do */
+  } else if(plan->dupe) {
+    /* blow the MONO data up to *channels.in */
+    areas_deinterleave_dupe(&stream->scratch, plan->deinterleave, srcshape,
+                            src_areas, src_offset, plan->informat,
+                            inbuf + plan->chanoffset_in*size, size, plan->inchannels);
+  } else {
+    areas_deinterleave(&stream->scratch, plan->deinterleave, srcshape,
+                       src_areas, src_offset, plan->informat,
+                       inbuf + plan->chanoffset_in*size, size, plan->inchannels);
+  }
+  stats_meter_lap(&stream->meter, STATS_DEINTERLEAVE);
+
+  if(plan->runner) {
+    /* unused inputs are connected to silence, rather than zeroed each time */
+    for(j = 0; j < plan->num_mute_in; j++) {
+      unsigned int c;
+      for(c = 0; c < plan->mute_in[j][1]; c++)
+        inports[plan->mute_in[j][0] + c] = iemladspa->zeros;
+    }
+
+    gated = iemladspa_gate_update(&iemladspa->gate, inports, iemladspa->layout.num_inchannels, size);
+    stats_meter_lap(&stream->meter, STATS_MUTE);
+    if(gated) {
+      /* the plugin has nothing to do (and its FIFO and worker stay as they are) */
+    } else if(iemladspa->worker.running)
+      iemladspa_worker_exchange(iemladspa, inports, outports, size);
+    else
+      iemladspa_process(iemladspa, inports, outports, size);
+
+    if(!iemladspa->gate.closed && (bypass || iemladspa->bypass.dry)) {
+      iemladspa_bypass_fade(iemladspa, inports, outports, size, bypass);
+      /* once the plugin is faded out, it's no longer needed */
+      __atomic_store_n(&iemladspa->bypass.active, bypass && (BYPASS_FADE == iemladspa->bypass.dry),
+                       __ATOMIC_RELAXED);
+    }
+    stats_meter_lap(&stream->meter, STATS_RUN);
+  }
+
+  /* while the gate is closed, the output is taken from the zero pages */
+  gated = iemladspa->gate.closed;
+  if(gated)
+    outbuf = iemladspa->zeros;
+
+  if(zerocopy_out) {
+    if(gated)
+      for(j = 0; j < plan->outchannels; j++)
+        memset(outports[plan->chanoffset_out + j], 0, size * sizeof(float));
+  } else if(plan->mixdown) {
+    /* mix the data down to MONO while interleaving it */
+    areas_reinterleave_mixdown(&stream->scratch, plan->reinterleave,
+                               outbuf + plan->chanoffset_out*size, size, plan->outchannels,
+                               dstshape, dst_areas, dst_offset, plan->outformat);
+  } else {
+    areas_reinterleave(&stream->scratch, plan->reinterleave,
+                       outbuf + plan->chanoffset_out*size, size, plan->outchannels,
+                       dstshape, dst_areas, dst_offset, plan->outformat);
+  }
+  stats_meter_lap(&stream->meter, STATS_REINTERLEAVE);
+  stats_meter_stop(&stream->meter, size);
+
+  iemladspa->stream_direction = ext->stream;
+  return size;
+}
+
+static int iemladspa_close(snd_pcm_extplug_t *ext) {
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t*)ext->private_data;
+  unsigned int k;
+
+  /* the stream is gone, whoever else is still around */
+  stats_meter_close(&iemladspa->streamdir[ext->stream].meter);
+
+  /* check whether we are the last user of iemladspa */
+  if((--(iemladspa->usecount))>0)
+    return 0;
+
+  iemladspa_worker_stop(&iemladspa->worker);
+  if(iemladspa->worker.have_sem)
+    sem_destroy(&iemladspa->worker.wakeup);
+  iemladspa_persist_stop(&iemladspa->persist);
+  iemladspa_graph_free(iemladspa->graph);
+  iemladspa->graph = NULL;
+
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    if(plugin->plugininstance) {
+      if(plugin->klass->deactivate) {
+        plugin->klass->deactivate(plugin->plugininstance);
+      }
+
+      /* TODO: Figure out why this segfaults */
+      if(plugin->klass->cleanup) {
+        plugin->klass->cleanup(plugin->plugininstance);
+      } else {
+        free(plugin->plugininstance);
+      }
+    }
+    plugin->plugininstance = NULL;
+    free(plugin->connected);
+
+    if(plugin->control_data && !plugin->shared_controls)
+      LADSPAcontrolUnMMAP(plugin->control_data);
+    free(plugin->controls);
+    free(plugin->scratch);
+    plugin->control_data=NULL;
+    plugin->controls=plugin->scratch=NULL;
+    free(plugin->persist);
+    free(plugin->notify);
+    plugin->persist=plugin->notify=NULL;
+    if(plugin->library)
+      LADSPAunload(plugin->library);
+    plugin->library=NULL;
+  }
+  free(iemladspa->plugins);
+
+  /* all the audio buffers live in the arena */
+  arena_free(&iemladspa->arena);
+  zeros_free(iemladspa);
+  free(iemladspa->inports);
+  free(iemladspa->outports);
+  free(iemladspa->chainports[0]);
+  free(iemladspa->chainports[1]);
+  free(iemladspa->runports[0]);
+  free(iemladspa->runports[1]);
+  free(iemladspa->fifo.inports);
+  free(iemladspa->fifo.outports);
+  free(iemladspa->worker.inports);
+  free(iemladspa->worker.outports);
+  free(iemladspa->resampling.inports);
+  free(iemladspa->resampling.outports);
+  stats_unmap(iemladspa->stats);
+
+  s_mergeplugin_list = linked_list_delete(s_mergeplugin_list, iemladspa->key);
+  free(iemladspa);
+  return 0;
+}
+
+static int iemladspa_init(snd_pcm_extplug_t *ext)
+{
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)ext->private_data;
+  const unsigned int numports = iemladspa->layout.num_inchannels + iemladspa->layout.num_outchannels;
+  unsigned int i, k;
+
+  for(k = 0; k < iemladspa->num_plugins; k++) {
+    iemladspa_plugin_t*plugin = &iemladspa->plugins[k];
+    if(!plugin->connected)
+      plugin->connected = calloc(numports, sizeof(LADSPA_Data*));
+    if(!plugin->connected)
+      return -ENOMEM;
+
+    if(!plugin->plugininstance) {
+      /* Instantiate a LADSPA Plugin (at its own rate, if it has one) */
+      plugin->plugininstance=plugin->klass->instantiate(plugin->klass,
+                                                        iemladspa->resampling.rate?iemladspa->resampling.rate:ext->rate);
+
+      if(plugin->plugininstance == NULL) {
+        return -1;
+      }
+      /* a fresh instance has none of its audio ports connected */
+      memset(plugin->connected, 0, numports * sizeof(LADSPA_Data*));
+      if(plugin->klass->activate) {
+        plugin->klass->activate(plugin->plugininstance);
+      }
+    }
+
+    /* Connect controls to the LADSPA Plugin */
+    for(i = 0; i < plugin->control_data->num_controls; i++) {
+      plugin->klass->connect_port(plugin->plugininstance,
+                                  plugin->control_data->data[i].index,
+                                  &plugin->controls[i]);
+    }
+  }
+
+  if(!iemladspa->inports)
+    iemladspa->inports = calloc(iemladspa->layout.num_inchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->outports)
+    iemladspa->outports = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->fifo.inports)
+    iemladspa->fifo.inports = calloc(iemladspa->layout.num_inchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->fifo.outports)
+    iemladspa->fifo.outports = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  for(k = 0; k < 2; k++)
+    if(!iemladspa->chainports[k])
+      iemladspa->chainports[k] = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->runports[0])
+    iemladspa->runports[0] = calloc(iemladspa->layout.num_inchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->runports[1])
+    iemladspa->runports[1] = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->worker.inports)
+    iemladspa->worker.inports = calloc(iemladspa->layout.num_inchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->worker.outports)
+    iemladspa->worker.outports = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->resampling.inports)
+    iemladspa->resampling.inports = calloc(iemladspa->layout.num_inchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->resampling.outports)
+    iemladspa->resampling.outports = calloc(iemladspa->layout.num_outchannels, sizeof(LADSPA_Data*));
+  if(!iemladspa->inports || !iemladspa->outports
+     || !iemladspa->fifo.inports || !iemladspa->fifo.outports
+     || !iemladspa->chainports[0] || !iemladspa->chainports[1]
+     || !iemladspa->runports[0] || !iemladspa->runports[1]
+     || !iemladspa->worker.inports || !iemladspa->worker.outports
+     || !iemladspa->resampling.inports || !iemladspa->resampling.outports)
+    return -ENOMEM;
+
+  if(iemladspa_is_runner(iemladspa, ext->stream)) {
+    const LADSPA_Control_Output*published = LADSPAcontrolOutput(iemladspa->plugins[0].control_data);
+    const unsigned long latency = published->latency;
+    iemladspa_worker_stop(&iemladspa->worker);
+    iemladspa_warmup(iemladspa, iemladspa->streamdir[ext->stream].period_size);
+    iemladspa_fifo_reset(&iemladspa->fifo);
+    iemladspa_resampling_reset(&iemladspa->resampling);
+    /* (the warmup ran the plugins, so they have reported their delay) */
+    iemladspa_latency_update(iemladspa, ext->rate);
+    if(published->latency != latency && iemladspa->plugins[0].notify)
+      LADSPAcontrolNotify(iemladspa->plugins[0].notify);
+    iemladspa->gate.quiet = 0;
+    iemladspa->gate.closed = 0;
+    __atomic_store_n(&iemladspa->bypass.active, 0, __ATOMIC_RELAXED);
+    iemladspa->bypass.dry = 0;
+    iemladspa->bypass.wait = 0;
+    if(iemladspa->worker.enabled) {
+      int err = iemladspa_worker_start(iemladspa);
+      if(err < 0)
+        return err;
+    }
+  }
+
+  return 0;
+}
+
+/* set up a stream for periods of <period_size> frames
+ * (the part of hw_params that doesn't need the hw_params) */
+static int iemladspa_configure(snd_pcm_extplug_t *ext, snd_pcm_uframes_t period_size)
+{
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)ext->private_data;
+  iemladspa_stream_t*stream = &iemladspa->streamdir[ext->stream];
+  iemladspa_fifo_t*fifo = &iemladspa->fifo;
+  const iemladspa_audiobuf_t*outbuf = &iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].buf;
+  const int restart = iemladspa->worker.running;
+
+  /* the worker is running on the buffers we are about to re-arrange
+   * (the runner restarts it when it is prepared; for the other stream, we do) */
+  iemladspa_worker_stop(&iemladspa->worker);
+
+  /* transfers are cut down to the period size,
+   * so that's all the buffers need to hold */
+  if(!period_size)
+    return -EINVAL;
+  stream->period_size = period_size;
+
+  /* the resamplers' buffers depend on the rates */
+  iemladspa_resampling_config(iemladspa, ext->rate);
+
+  /* allocate all buffers up front, so the transfer never has to */
+  if(!arena_reserve(&iemladspa->arena, iemladspa_arena_layout(iemladspa, NULL)))
+    return -ENOMEM;
+  iemladspa_arena_layout(iemladspa, &iemladspa->arena);
+  iemladspa_resampling_init(&iemladspa->resampling);
+  /* as much silence as the largest planar output buffer (for the gate),
+   * which is plenty for a single muted input */
+  iemladspa->gate.closed = 0;
+  if(!zeros_map(iemladspa, audiobuffer_bytes(outbuf->frames, outbuf->channels)))
+    return -ENOMEM;
+
+  if(!iemladspa_plan_build(iemladspa, ext))
+    return -EINVAL;
+
+  /* the load is measured against the period */
+  stats_meter_config(&stream->meter, iemladspa->stats?&iemladspa->stats->stream[ext->stream]:NULL,
+                     ext->rate, period_size);
+
+  if(!stream->plan.runner)
+    return restart?iemladspa_worker_start(iemladspa):0;
+
+  iemladspa->worker.latency = (iemladspa->worker.enabled)?period_size:0;
+
+  if(fifo->blocksize) {
+    /* if all transfers are multiples of <g> frames, a delay of <blocksize - g> frames is enough;
+     * if the period size is a multiple of the blocksize, there is no delay at all
+     * (when resampling, this is about the periods at the plugin's rate) */
+    fifo->latency = fifo->blocksize - gcd(iemladspa_resampling_frames(&iemladspa->resampling, period_size),
+                                          fifo->blocksize);
+    DEBUG("blocksize=%d\tperiod=%lu\tlatency=%d\n", fifo->blocksize, period_size, fifo->latency);
+    iemladspa_fifo_reset(fifo);
+  }
+  iemladspa_resampling_latency(&iemladspa->resampling, fifo->latency);
+  return 0;
+}
+
+static int iemladspa_hw_params(snd_pcm_extplug_t *ext, snd_pcm_hw_params_t *params)
+{
+  snd_pcm_uframes_t period_size = 0;
+  int dir = 0;
+  if(snd_pcm_hw_params_get_period_size(params, &period_size, &dir) < 0)
+    return -EINVAL;
+  return iemladspa_configure(ext, period_size);
+}
+
+static void iemladspa_dump(snd_pcm_extplug_t *ext, snd_output_t *out)
+{
+  snd_pcm_iemladspa_t *iemladspa = (snd_pcm_iemladspa_t *)ext->private_data;
+  unsigned int k;
+  snd_output_printf(out, "%s\n", ext->name);
+  for(k = 0; k < iemladspa->num_plugins; k++)
+    snd_output_printf(out, "LADSPA plugin: %s (%lu)\n",
+                      iemladspa->plugins[k].klass->Label, iemladspa->plugins[k].klass->UniqueID);
+  if(iemladspa->fifo.blocksize)
+    snd_output_printf(out, "blocksize: %u (latency: %u frames)\n", iemladspa->fifo.blocksize, iemladspa->fifo.latency);
+  if(iemladspa->worker.enabled)
+    snd_output_printf(out, "worker thread: priority %d, cpu %d (latency: %u frames)\n",
+                      iemladspa->worker.priority, iemladspa->worker.cpu, iemladspa->worker.latency);
+  if(iemladspa->gate.enabled)
+    snd_output_printf(out, "silence gate: threshold %g, tail %u ms\n",
+                      iemladspa->gate.threshold, iemladspa->gate.tail_ms);
+  if(iemladspa->resampling.active)
+    snd_output_printf(out, "plugin rate: %u Hz, %u taps (%s; latency: %u frames)\n",
+                      iemladspa->resampling.rate, iemladspa->resampling.down.taps,
+                      resampler_kernel(), iemladspa->resampling.latency);
+  if(iemladspa->subblock)
+    snd_output_printf(out, "sub-blocks: %lu frames\n", iemladspa->streamdir[ext->stream].plan.frames);
+  snd_output_printf(out, "latency: %u frames (plugins: %lu frames)\n",
+                    iemladspa_latency(iemladspa), iemladspa->plugin_latency);
+  snd_output_printf(out, "Its setup is:\n");
+  snd_pcm_dump_setup(ext->pcm, out);
+}
+
+/*
+ * try to create an alsa ext plugin
+ * on success
+ *     find an existing iemladspa-plugin with the same root-config
+ *     on failure
+ *         create a new iemladspa-plugin
+ *     (on success)
+ *         add ourself to the iemladspa-plugin (and vice-versa 'private_data')
+ * on failure
+ *   return FAIL
+ */
+
+/* open a LADSPA-plugin, and MMAP to its controls file */
+static int iemladspa_plugin_load(iemladspa_plugin_t *plugin, const iemladspa_pluginconf_t *conf,
+                                 iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels) {
+  unsigned long offset_in, offset_out;
+  unsigned int j;
+  int latency;
+
+  /* Open the LADSPA Plugin */
+  plugin->library = LADSPAload(conf->library);
+  if(plugin->library == NULL)
+    return 0;
+
+  plugin->klass = LADSPAfind(plugin->library, conf->library, conf->module);
+  if(plugin->klass == NULL)
+    return 0;
+
+  plugin->control_data = LADSPAcontrolMMAP(plugin->klass, conf->library, conf->controls,
+                                           sourcechannels, sinkchannels, conf->backend);
+  if(plugin->control_data == NULL)
+    return 0;
+  /* the controls live in shared memory: the persist thread writes them back to the file */
+  if(LADSPA_CNTRL_BACKEND_SHM == conf->backend) {
+    plugin->persist = LADSPAcontrolFilename(conf->controls);
+    if(!plugin->persist)
+      return 0;
+    plugin->persisted = plugin->pending =
+      __atomic_load_n(&LADSPAcontrolInput(plugin->control_data)->seq, __ATOMIC_ACQUIRE);
+  }
+  /* (without it, the mixers just don't learn about the latency) */
+  plugin->notify = LADSPAcontrolPath(conf->controls, conf->backend);
+
+  /* the plugin starts with the current settings (and the last values it reported) */
+  plugin->controls = malloc(plugin->control_data->num_controls * sizeof(LADSPA_Data));
+  plugin->scratch = malloc(plugin->control_data->num_controls * sizeof(LADSPA_Data));
+  if(!plugin->controls || !plugin->scratch)
+    return 0;
+  memcpy(plugin->controls, LADSPAcontrolOutput(plugin->control_data)->value,
+         plugin->control_data->num_controls * sizeof(LADSPA_Data));
+  plugin->seq = 1; /* (never a valid sequence number: forces the first snapshot) */
+  if(!LADSPAcontrolSnapshot(plugin->control_data, plugin->controls, plugin->scratch, &plugin->seq))
+    memcpy(plugin->controls, LADSPAcontrolInput(plugin->control_data)->value,
+           plugin->control_data->num_controls * sizeof(LADSPA_Data));
+
+  latency = LADSPAcontrolLatency(plugin->klass, plugin->control_data);
+  if(latency >= 0)
+    plugin->latency = &plugin->controls[latency];
+
+  /* Make sure that the control file makes sense */
+  offset_in = plugin->control_data->num_controls;
+  offset_out = offset_in + plugin->control_data->num_inchannels;
+
+  for(j=0; j<plugin->control_data->num_inchannels; j++) {
+    unsigned int index=plugin->control_data->data[offset_in + j].index;
+    if(index>=plugin->klass->PortCount || plugin->klass->PortDescriptors[index] !=
+       (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
+      SNDERR("Problem with control file %s.", conf->controls);
+      return 0;
+    }
+  }
+  for(j=0; j<plugin->control_data->num_outchannels; j++) {
+    unsigned int index=plugin->control_data->data[offset_out+ j].index;
+
+    if(index>=plugin->klass->PortCount || plugin->klass->PortDescriptors[index] !=
+       (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
+      SNDERR("Problem with control file %s.", conf->controls);
+      return 0;
+    }
+  }
+  return 1;
+}
+/* open another copy of a LADSPA-plugin, sharing the controls file of the <original> */
+static int iemladspa_plugin_replicate(iemladspa_plugin_t *plugin, const iemladspa_plugin_t *original,
+                                      const iemladspa_pluginconf_t *conf) {
+  /* keep the library loaded for as long as any copy uses it */
+  plugin->library = LADSPAload(conf->library);
+  if(plugin->library == NULL)
+    return 0;
+  plugin->klass = original->klass;
+  plugin->control_data = original->control_data;
+  plugin->shared_controls = 1;
+  plugin->original = original;
+  /* (the output ports are our own: only the original's values are published) */
+  plugin->controls = malloc(original->control_data->num_controls * sizeof(LADSPA_Data));
+  if(!plugin->controls)
+    return 0;
+  memcpy(plugin->controls, original->controls, original->control_data->num_controls * sizeof(LADSPA_Data));
+  if(original->latency)
+    plugin->latency = plugin->controls + (original->latency - original->controls);
+  return 1;
+}
+static void iemladspa_plugin_unload(iemladspa_plugin_t *plugin) {
+  if(plugin->control_data && !plugin->shared_controls)
+    LADSPAcontrolUnMMAP(plugin->control_data);
+  free(plugin->controls);
+  free(plugin->scratch);
+  plugin->control_data=NULL;
+  plugin->controls=plugin->scratch=NULL;
+  free(plugin->persist);
+  free(plugin->notify);
+  plugin->persist=plugin->notify=NULL;
+  if(plugin->library)
+    LADSPAunload(plugin->library);
+  plugin->library=NULL;
+}
+
+/* resolve a connection of the graph into a wire */
+static int graph_resolve(const iemladspa_graph_t*graph, iemladspa_wireref_t ref) {
+  if(ref.node < 0)
+    return (ref.port < graph->num_inputs)?(int)ref.port:-1;
+  if(ref.port >= graph->nodes[ref.node].num_outputs)
+    return -1;
+  return graph->nodes[ref.node].first_output + ref.port;
+}
+
+/* wire up the (already loaded) plugins as described by the configuration */
+static iemladspa_graph_t*iemladspa_graph_create(iemladspa_plugin_t*plugins,
+                                                const iemladspa_pluginconf_t*pluginconfs,
+                                                unsigned int num_nodes,
+                                                const iemladspa_graphconf_t*graphconf,
+                                                const iemladspa_layout_t*layout) {
+  iemladspa_graph_t*graph = (iemladspa_graph_t*)calloc(1, sizeof(iemladspa_graph_t));
+  unsigned int k, j, d;
+  if(!graph)
+    return NULL;
+
+  graph->num_nodes = num_nodes;
+  graph->num_inputs = layout->num_inchannels;
+  graph->num_outputs = layout->num_outchannels;
+  graph->num_wires = graph->num_inputs;
+  graph->nodes = (iemladspa_node_t*)calloc(num_nodes, sizeof(iemladspa_node_t));
+  graph->outputs = (int*)calloc(graph->num_outputs, sizeof(int));
+  if(!graph->nodes || !graph->outputs)
+    goto fail;
+
+  for(k = 0; k < num_nodes; k++) {
+    iemladspa_node_t*node = &graph->nodes[k];
+    node->task.run = iemladspa_node_run;
+    node->graph = graph;
+    node->plugin = &plugins[k];
+    node->num_inputs = plugins[k].control_data->num_inchannels;
+    node->num_outputs = plugins[k].control_data->num_outchannels;
+    node->first_output = graph->num_wires;
+    graph->num_wires += node->num_outputs;
+    node->inputs = (unsigned int*)calloc(node->num_inputs, sizeof(unsigned int));
+    node->dependents = (iemladspa_node_t**)calloc(num_nodes, sizeof(iemladspa_node_t*));
+    node->inports = (LADSPA_Data**)calloc(node->num_inputs, sizeof(LADSPA_Data*));
+    node->outports = (LADSPA_Data**)calloc(node->num_outputs, sizeof(LADSPA_Data*));
+    if(!node->inputs || !node->dependents || !node->inports || !node->outports)
+      goto fail;
+
+    /* nodes can only be fed by the PCM or by nodes defined before them,
+     * so there are no cycles */
+    for(j = 0; j < node->num_inputs; j++) {
+      const iemladspa_wireref_t ref = pluginconfs[k].inputs[j];
+      int wire = graph_resolve(graph, ref);
+      if(wire < 0) {
+        SNDERR("input %u of node '%s' refers to a non-existing channel", j, pluginconfs[k].name);
+        goto fail;
+      }
+      node->inputs[j] = wire;
+      if(ref.node < 0)
+        continue;
+      for(d = 0; d < graph->nodes[ref.node].num_dependents; d++)
+        if(graph->nodes[ref.node].dependents[d] == node)
+          break;
+      if(d == graph->nodes[ref.node].num_dependents) {
+        graph->nodes[ref.node].dependents[d] = node;
+        graph->nodes[ref.node].num_dependents++;
+        node->num_dependencies++;
+      }
+    }
+  }
+
+  if(graphconf->num_outputs != graph->num_outputs) {
+    SNDERR("the graph needs exactly %u outputs", graph->num_outputs);
+    goto fail;
+  }
+  for(j = 0; j < graph->num_outputs; j++) {
+    if(graphconf->outputs[j].node < -1) {
+      graph->outputs[j] = -1;
+      continue;
+    }
+    graph->outputs[j] = graph_resolve(graph, graphconf->outputs[j]);
+    if(graph->outputs[j] < 0) {
+      SNDERR("output %u of the graph refers to a non-existing channel", j);
+      goto fail;
+    }
+  }
+
+  if(graphconf->threads > 0) {
+    if(workpool_acquire(graphconf->threads, graphconf->priority) < 0)
+      goto fail;
+    graph->pooled = 1;
+    graph->deque = workpool_deque_get();
+  }
+  return graph;
+
+ fail:
+  iemladspa_graph_free(graph);
+  return NULL;
+}
+
+static snd_pcm_iemladspa_t * iemladspa_mergeplugin_create(const void *key,
+                                                          const iemladspa_pluginconf_t*pluginconfs,
+                                                          unsigned int num_plugins,
+                                                          const iemladspa_graphconf_t*graphconf,
+                                                          iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels
+                                                          ) {
+  iemladspa_plugin_t *plugins = NULL;
+  iemladspa_graph_t *graph = NULL;
+  snd_pcm_iemladspa_t*iemladspa = NULL;
+  iemladspa_layout_t layout;
+  unsigned int k;
+
+  layout.sourcechannels  = sourcechannels;
+  layout.sinkchannels    = sinkchannels;
+  layout.num_inchannels  = sourcechannels.in  + sinkchannels.in;
+  layout.num_outchannels = sourcechannels.out + sinkchannels.out;
+
+  plugins = (iemladspa_plugin_t*)calloc(num_plugins, sizeof(iemladspa_plugin_t));
+  if(!plugins)
+    return NULL;
+
+  for(k = 0; k < num_plugins; k++) {
+    if(graphconf) {
+      /* a node has as many audio inputs as it has connections */
+      iemladspa_iochannels_t nodechannels = {pluginconfs[k].num_inputs, pluginconfs[k].num_inputs};
+      iemladspa_iochannels_t nochannels = {0, 0};
+      if(pluginconfs[k].original) {
+        if(!iemladspa_plugin_replicate(&plugins[k], &plugins[pluginconfs[k].original - pluginconfs], &pluginconfs[k]))
+          goto fail;
+        continue;
+      }
+      if(!iemladspa_plugin_load(&plugins[k], &pluginconfs[k], nodechannels, nochannels))
+        goto fail;
+      continue;
+    }
+    if(!iemladspa_plugin_load(&plugins[k], &pluginconfs[k], sourcechannels, sinkchannels))
+      goto fail;
+    /* each plugin feeds the next one */
+    if(plugins[k].control_data->num_outchannels != layout.num_outchannels) {
+      SNDERR("LADSPA-plugin '%s' doesn't fit into the chain.", pluginconfs[k].module);
+      goto fail;
+    }
+  }
+  if(graphconf) {
+    graph = iemladspa_graph_create(plugins, pluginconfs, num_plugins, graphconf, &layout);
+    if(!graph)
+      goto fail;
+  }
+
+  iemladspa=(snd_pcm_iemladspa_t*)calloc(1, sizeof(snd_pcm_iemladspa_t));
+  if(!iemladspa)
+    goto fail;
+  iemladspa->graph            = graph;
+  iemladspa->key              = key;
+  iemladspa->plugins          = plugins;
+  iemladspa->num_plugins      = num_plugins;
+  iemladspa->layout           = layout;
+  iemladspa->stream_direction = -1;
+
+  return iemladspa;
+
+ fail:
+  iemladspa_graph_free(graph);
+  for(k = 0; k < num_plugins; k++)
+    iemladspa_plugin_unload(&plugins[k]);
+  free(plugins);
+  return NULL;
+}
+
+
+static snd_pcm_iemladspa_t * iemladspa_mergeplugin_findorcreate(const void *key,
+                                                                const iemladspa_pluginconf_t*pluginconfs,
+                                                                unsigned int num_plugins,
+                                                                const iemladspa_graphconf_t*graphconf,
+                                                                iemladspa_iochannels_t sourcechannels, iemladspa_iochannels_t sinkchannels
+                                                                ) {
+  /* find a 'iemladspa' instance with 'key' */
+  snd_pcm_iemladspa_t*iemladspa=linked_list_find(s_mergeplugin_list, key);
+  if(!iemladspa) {
+    iemladspa = iemladspa_mergeplugin_create(key, pluginconfs, num_plugins, graphconf, sourcechannels, sinkchannels);
+    s_mergeplugin_list = linked_list_add(s_mergeplugin_list, key, iemladspa);
+  }
+  if(iemladspa)
+    iemladspa->usecount++;
+
+  return iemladspa;
+}
+
+/* the realtime priority of the calling thread (0: it has none) */
+static int iemladspa_thread_priority(void) {
+  struct sched_param param;
+  int policy;
+  if(pthread_getschedparam(pthread_self(), &policy, &param) || (SCHED_FIFO != policy && SCHED_RR != policy))
+    return 0;
+  return param.sched_priority;
+}
+
+/* parse a list of plugins: [ { library "..."; module "..."; controls "..."; } ... ] */
+static int iemladspa_parse_plugins(snd_config_t *conf, iemladspa_pluginconf_t **pluginconfs, unsigned int *num_plugins) {
+  snd_config_iterator_t i, next, j, jnext;
+  iemladspa_pluginconf_t *confs = NULL;
+  unsigned int count = 0;
+
+  snd_config_for_each(i, next, conf)
+    count++;
+  if(!count) {
+    SNDERR("plugins must not be empty");
+    return -EINVAL;
+  }
+  confs = (iemladspa_pluginconf_t*)calloc(count, sizeof(iemladspa_pluginconf_t));
+  if(!confs)
+    return -ENOMEM;
+
+  count = 0;
+  snd_config_for_each(i, next, conf) {
+    snd_config_t *entry = snd_config_iterator_entry(i);
+    if(snd_config_get_type(entry) != SND_CONFIG_TYPE_COMPOUND) {
+      SNDERR("plugins must be a list of compounds");
+      free(confs);
+      return -EINVAL;
+    }
+    snd_config_for_each(j, jnext, entry) {
+      snd_config_t *n = snd_config_iterator_entry(j);
+      const char *id;
+      if (snd_config_get_id(n, &id) < 0)
+        continue;
+      if (strcmp(id, "library") == 0) {
+        snd_config_get_string(n, &confs[count].library);
+        continue;
+      }
+      if (strcmp(id, "module") == 0) {
+        snd_config_get_string(n, &confs[count].module);
+        continue;
+      }
+      if (strcmp(id, "controls") == 0) {
+        snd_config_get_string(n, &confs[count].controls);
+        continue;
+      }
+      SNDERR("Unknown field plugins.%s", id);
+      free(confs);
+      return -EINVAL;
+    }
+    if(!confs[count].module) {
+      SNDERR("each of the plugins needs a module");
+      free(confs);
+      return -EINVAL;
+    }
+    count++;
+  }
+
+  *pluginconfs = confs;
+  *num_plugins = count;
+  return 0;
+}
+
+
+static void iemladspa_pluginconfs_free(iemladspa_pluginconf_t *pluginconfs, unsigned int num_plugins) {
+  unsigned int k;
+  if(!pluginconfs)
+    return;
+  for(k = 0; k < num_plugins; k++) {
+    free(pluginconfs[k].default_controls);
+    free(pluginconfs[k].found_library);
+    free(pluginconfs[k].found_module);
+    free(pluginconfs[k].inputs);
+  }
+  free(pluginconfs);
+}
+
+/* a plugin that is given by its module (a label or a UniqueID) alone is looked up
+ * along the LADSPA_PATH */
+static int iemladspa_pluginconf_find(iemladspa_pluginconf_t *conf) {
+  int err;
+  if(conf->library)
+    return 0;
+  err = ladspa_index_find(conf->module, &conf->found_library, &conf->found_module);
+  if(err < 0) {
+    SNDERR("unable to find the LADSPA-plugin '%s' along the LADSPA_PATH", conf->module);
+    return err;
+  }
+  conf->library = conf->found_library;
+  conf->module = conf->found_module;
+  return 0;
+}
+
+/* parse a reference to a channel:
+ * 'in:<index>' (an input of the PCM), '<node>:<index>' (an output of one of the first <num_nodes> nodes)
+ * or 'none' (silence; only if <silence> is set) */
+static int parse_wireref(const char *str, const iemladspa_pluginconf_t *nodes, unsigned int num_nodes,
+                         int silence, iemladspa_wireref_t *ref) {
+  const char *colon;
+  char *end;
+  size_t len;
+  unsigned int k;
+
+  if(silence && !strcmp(str, "none")) {
+    ref->node = -2;
+    ref->port = 0;
+    return 1;
+  }
+  colon = strrchr(str, ':');
+  if(!colon || !colon[1])
+    return 0;
+  ref->port = strtoul(colon + 1, &end, 10);
+  if(*end)
+    return 0;
+  len = colon - str;
+  if(2 == len && !strncmp(str, "in", len)) {
+    ref->node = -1;
+    return 1;
+  }
+  for(k = 0; k < num_nodes; k++) {
+    if(strlen(nodes[k].name) == len && !strncmp(nodes[k].name, str, len)) {
+      ref->node = k;
+      return 1;
+    }
+  }
+  return 0;
+}
+/* parse a list of channel references */
+static int parse_wirerefs(snd_config_t *conf, const iemladspa_pluginconf_t *nodes, unsigned int num_nodes,
+                          int silence, iemladspa_wireref_t **refs, unsigned int *count) {
+  snd_config_iterator_t i, next;
+  unsigned int n = 0;
+
+  snd_config_for_each(i, next, conf)
+    n++;
+  *refs = (iemladspa_wireref_t*)calloc(n?n:1, sizeof(iemladspa_wireref_t));
+  if(!*refs)
+    return -ENOMEM;
+  *count = 0;
+  snd_config_for_each(i, next, conf) {
+    const char *str = NULL;
+    snd_config_get_string(snd_config_iterator_entry(i), &str);
+    if(!str || !parse_wireref(str, nodes, num_nodes, silence, &(*refs)[*count])) {
+      SNDERR("invalid channel '%s'", str?str:"");
+      return -EINVAL;
+    }
+    (*count)++;
+  }
+  return 0;
+}
+
+/* from this many channels on, the copies of a replicated plugin are run on the thread pool */
+#define IEMLADSPA_REPLICATE_PARALLEL 8
+
+/* turn a chain of mono plugins into a graph, with one copy of the chain per channel
+ * all copies of a plugin share the controls of the first one */
+static int iemladspa_replicate_chain(iemladspa_pluginconf_t **pluginconfs, unsigned int *num_plugins,
+                                     iemladspa_graphconf_t *graphconf, unsigned int channels) {
+  const unsigned int length = *num_plugins;
+  iemladspa_pluginconf_t *chain = *pluginconfs;
+  iemladspa_pluginconf_t *confs = NULL;
+  unsigned int c, p;
+
+  confs = (iemladspa_pluginconf_t*)calloc(length * channels, sizeof(iemladspa_pluginconf_t));
+  graphconf->outputs = (iemladspa_wireref_t*)calloc(channels, sizeof(iemladspa_wireref_t));
+  if(!confs || !graphconf->outputs) {
+    free(confs);
+    return -ENOMEM;
+  }
+  for(c = 0; c < channels; c++) {
+    for(p = 0; p < length; p++) {
+      iemladspa_pluginconf_t *node = &confs[c * length + p];
+      node->library  = chain[p].library;
+      node->module   = chain[p].module;
+      node->controls = chain[p].controls;
+      node->backend  = chain[p].backend;
+      node->name     = chain[p].module;
+      node->original = c?&confs[p]:NULL;
+      node->num_inputs = 1;
+      node->inputs = (iemladspa_wireref_t*)calloc(1, sizeof(iemladspa_wireref_t));
+      if(!node->inputs) {
+        iemladspa_pluginconfs_free(confs, length * channels);
+        return -ENOMEM;
+      }
+      /* the first plugin gets the channel, the others the output of their predecessor */
+      node->inputs[0].node = p?(int)(c * length + p - 1):-1;
+      node->inputs[0].port = p?0:c;
+    }
+    graphconf->outputs[c].node = c * length + length - 1;
+    graphconf->outputs[c].port = 0;
+  }
+  graphconf->num_outputs = channels;
+
+  /* the (default) controls filenames (and what was found in the index) now belong to the first copy */
+  for(p = 0; p < length; p++) {
+    confs[p].default_controls = chain[p].default_controls;
+    confs[p].found_library = chain[p].found_library;
+    confs[p].found_module = chain[p].found_module;
+    chain[p].default_controls = NULL;
+    chain[p].found_library = chain[p].found_module = NULL;
+  }
+  iemladspa_pluginconfs_free(chain, length);
+
+  *pluginconfs = confs;
+  *num_plugins = length * channels;
+  return 0;
+}
+
+/* parse a graph:
+ *   graph {
+ *     nodes { <name> { library "..."; module "..."; controls "..."; inputs [ "in:0" ... ] } ... }
+ *     outputs [ "<name>:0" ... ]
+ *     threads <count>
+ *   } */
+static int iemladspa_parse_graph(snd_config_t *conf, iemladspa_pluginconf_t **pluginconfs, unsigned int *num_plugins,
+                                 iemladspa_graphconf_t *graphconf) {
+  snd_config_iterator_t i, next, j, jnext;
+  snd_config_t *nodes = NULL, *outputs = NULL;
+  iemladspa_pluginconf_t *confs = NULL;
+  unsigned int count = 0;
+  int err = -EINVAL;
+
+  snd_config_for_each(i, next, conf) {
+    snd_config_t *n = snd_config_iterator_entry(i);
+    const char *id;
+    if (snd_config_get_id(n, &id) < 0)
+      continue;
+    if (strcmp(id, "nodes") == 0) {
+      nodes = n;
+      continue;
+    }
+    if (strcmp(id, "outputs") == 0) {
+      outputs = n;
+      continue;
+    }
+    if (strcmp(id, "threads") == 0) {
+      snd_config_get_integer(n, &graphconf->threads);
+      if(graphconf->threads < 0) {
+        SNDERR("graph.threads < 0");
+        return -EINVAL;
+      }
+      continue;
+    }
+    SNDERR("Unknown field graph.%s", id);
+    return -EINVAL;
+  }
+  if(!nodes || !outputs) {
+    SNDERR("graph needs nodes and outputs");
+    return -EINVAL;
+  }
+
+  snd_config_for_each(i, next, nodes)
+    count++;
+  if(!count) {
+    SNDERR("graph.nodes must not be empty");
+    return -EINVAL;
+  }
+  confs = (iemladspa_pluginconf_t*)calloc(count, sizeof(iemladspa_pluginconf_t));
+  if(!confs)
+    return -ENOMEM;
+
+  count = 0;
+  snd_config_for_each(i, next, nodes) {
+    snd_config_t *entry = snd_config_iterator_entry(i);
+    iemladspa_pluginconf_t *node = &confs[count];
+    snd_config_t *inputs = NULL;
+    if(snd_config_get_id(entry, &node->name) < 0 || !strcmp(node->name, "in")
+       || snd_config_get_type(entry) != SND_CONFIG_TYPE_COMPOUND) {
+      SNDERR("graph.nodes must be compounds (not named 'in')");
+      goto fail;
+    }
+    snd_config_for_each(j, jnext, entry) {
+      snd_config_t *n = snd_config_iterator_entry(j);
+      const char *id;
+      if (snd_config_get_id(n, &id) < 0)
+        continue;
+      if (strcmp(id, "library") == 0) {
+        snd_config_get_string(n, &node->library);
+        continue;
+      }
+      if (strcmp(id, "module") == 0) {
+        snd_config_get_string(n, &node->module);
+        continue;
+      }
+      if (strcmp(id, "controls") == 0) {
+        snd_config_get_string(n, &node->controls);
+        continue;
+      }
+      if (strcmp(id, "inputs") == 0) {
+        inputs = n;
+        continue;
+      }
+      SNDERR("Unknown field graph.nodes.%s.%s", node->name, id);
+      goto fail;
+    }
+    if(!node->module || !inputs) {
+      SNDERR("graph node '%s' needs a module and inputs", node->name);
+      goto fail;
+    }
+    /* only PCM inputs and nodes defined before this one can feed it */
+    err = parse_wirerefs(inputs, confs, count, 0, &node->inputs, &node->num_inputs);
+    count++;
+    if(err < 0)
+      goto fail;
+    err = -EINVAL;
+  }
+  err = parse_wirerefs(outputs, confs, count, 1, &graphconf->outputs, &graphconf->num_outputs);
+  if(err < 0)
+    goto fail;
+
+  *pluginconfs = confs;
+  *num_plugins = count;
+  return 0;
+
+ fail:
+  iemladspa_pluginconfs_free(confs, count);
+  return err;
+}
+
+
+static snd_pcm_extplug_callback_t iemladspa_callback = {
+  .transfer = iemladspa_transfer,
+  .init = iemladspa_init,
+  .close = iemladspa_close,
+  .hw_params = iemladspa_hw_params,
+  .dump = iemladspa_dump,
+};
+
+SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
+{
   snd_config_iterator_t i, next;
   snd_pcm_iemladspa_t *iemladspa=NULL;
   snd_config_t *sconf = NULL;
   const char *controls = NULL;
   char *default_controls=NULL;
-  const char *library = "/usr/lib/ladspa/iemladspa.so";
-  const char *module = "iemladspa";
+  const char *library = NULL;
+  const char *module = NULL;
+  snd_config_t *pluginsconf = NULL;
+  snd_config_t *graphnode = NULL;
+  iemladspa_graphconf_t graphconf;
+  iemladspa_pluginconf_t *pluginconfs = NULL;
+  unsigned int num_plugins = 0, k;
+  int single_plugin = 0;
+  int replicate = 0;
   int err;
   iemladspa_iochannels_t sourcechannels, sinkchannels;
   long inchannels = 2;
   long outchannels = 2;
+  long blocksize = 0;
+  int lockmem = 0;
+  int thread = 0;
+  long thread_priority = 70;
+  long pool_priority = -1;
+  long thread_cpu = -1;
+  int silence_gate = 0;
+  double silence_threshold = 0.;
+  long silence_tail = 1000;
+  long subblock = 0;
+  long plugin_rate = 0;
+  long plugin_rate_taps = 32;
+  int stats = 1;
+  int backend = LADSPA_CNTRL_BACKEND_FILE;
   unsigned int pcmchannels = 2;
   snd_pcm_extplug_t*ext=NULL;
   const char *configname = NULL;
 
-  unsigned int format = SND_PCM_FORMAT_S16;
+  snd_pcm_format_t format = SND_PCM_FORMAT_S16;
+  snd_pcm_format_t slave_format = SND_PCM_FORMAT_UNKNOWN;
 
   if (snd_config_get_id(conf, &configname) < 0)
     configname=NULL;
@@ -642,21 +2920,35 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
     }
     if (strcmp(id, "library") == 0) {
       snd_config_get_string(n, &library);
+      single_plugin = 1;
       continue;
     }
     if (strcmp(id, "module") == 0) {
       snd_config_get_string(n, &module);
+      single_plugin = 1;
+      continue;
+    }
+    if (strcmp(id, "plugins") == 0) {
+      pluginsconf = n;
+      continue;
+    }
+    if (strcmp(id, "graph") == 0) {
+      graphnode = n;
       continue;
     }
-    if (strcmp(id, "format") == 0) {
+    if (strcmp(id, "format") == 0 || strcmp(id, "slave_format") == 0) {
       const char*fmt=NULL;
+      snd_pcm_format_t value;
       snd_config_get_string(n, &fmt);
-      format=snd_pcm_format_value(fmt);
-      if(SND_PCM_FORMAT_S16!=format && SND_PCM_FORMAT_FLOAT!=format) {
-        SNDERR("format must be %s or %s", snd_pcm_format_name(SND_PCM_FORMAT_S16), snd_pcm_format_name(SND_PCM_FORMAT_FLOAT));
+      value=fmt?snd_pcm_format_value(fmt):SND_PCM_FORMAT_UNKNOWN;
+      if(!iemladspa_get_kernels(value, NULL, NULL)) {
+        SNDERR("%s must be one of S16, S24, S24_3LE, S32, FLOAT or FLOAT64", id);
         return -EINVAL;
-
       }
+      if(strcmp(id, "format") == 0)
+        format=value;
+      else
+        slave_format=value;
       continue;
     }
     if (strcmp(id, "inchannels") == 0) {
@@ -675,6 +2967,129 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
       }
       continue;
     }
+    if (strcmp(id, "replicate") == 0) {
+      replicate = snd_config_get_bool(n);
+      if(replicate < 0) {
+        SNDERR("replicate must be a boolean");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "mlock") == 0) {
+      lockmem = snd_config_get_bool(n);
+      if(lockmem < 0) {
+        SNDERR("mlock must be a boolean");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "thread") == 0) {
+      thread = snd_config_get_bool(n);
+      if(thread < 0) {
+        SNDERR("thread must be a boolean");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "thread_priority") == 0) {
+      snd_config_get_integer(n, &thread_priority);
+      if(thread_priority < 0 || thread_priority > 99) {
+        SNDERR("thread_priority must be between 0 and 99");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "pool_priority") == 0) {
+      snd_config_get_integer(n, &pool_priority);
+      if(pool_priority < -1 || pool_priority > 99) {
+        SNDERR("pool_priority must be between 0 and 99 (or -1)");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "thread_cpu") == 0) {
+      snd_config_get_integer(n, &thread_cpu);
+      if(thread_cpu < -1 || thread_cpu >= CPU_SETSIZE) {
+        SNDERR("thread_cpu must be a CPU number (or -1)");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "silence_gate") == 0) {
+      silence_gate = snd_config_get_bool(n);
+      if(silence_gate < 0) {
+        SNDERR("silence_gate must be a boolean");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "silence_threshold") == 0) {
+      if(snd_config_get_ireal(n, &silence_threshold) < 0 || silence_threshold < 0. || silence_threshold >= 1.) {
+        SNDERR("silence_threshold must be between 0 and 1");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "silence_tail") == 0) {
+      snd_config_get_integer(n, &silence_tail);
+      if(silence_tail < 0 || silence_tail > 3600000) {
+        SNDERR("silence_tail must be between 0 and 3600000 (ms)");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "plugin_rate") == 0) {
+      snd_config_get_integer(n, &plugin_rate);
+      if(plugin_rate < 0 || plugin_rate > 768000) {
+        SNDERR("plugin_rate must be between 0 and 768000 (Hz)");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "plugin_rate_taps") == 0) {
+      snd_config_get_integer(n, &plugin_rate_taps);
+      if(plugin_rate_taps < 8 || plugin_rate_taps > 256) {
+        SNDERR("plugin_rate_taps must be between 8 and 256");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "subblock") == 0) {
+      const char*str = NULL;
+      if(snd_config_get_string(n, &str) >= 0 && str && !strcmp(str, "auto")) {
+        subblock = SUBBLOCK_AUTO;
+        continue;
+      }
+      if(snd_config_get_integer(n, &subblock) < 0 || subblock < 0) {
+        SNDERR("subblock must be a number of frames (or 'auto')");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "stats") == 0) {
+      stats = snd_config_get_bool(n);
+      if(stats < 0) {
+        SNDERR("stats must be a boolean");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "controls_backend") == 0) {
+      const char*str = NULL;
+      if(snd_config_get_string(n, &str) < 0 || (backend = LADSPAcontrolBackend(str)) < 0) {
+        SNDERR("controls_backend must be 'file' or 'shm'");
+        return -EINVAL;
+      }
+      continue;
+    }
+    if (strcmp(id, "blocksize") == 0) {
+      snd_config_get_integer(n, &blocksize);
+      if(blocksize < 0 || blocksize > 65536 || (blocksize & (blocksize - 1))) {
+        SNDERR("blocksize must be a power of two (up to 65536)");
+        return -EINVAL;
+      }
+      continue;
+    }
 
     SNDERR("Unknown field %s", id);
     return -EINVAL;
@@ -682,6 +3097,10 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
   sourcechannels.in = sourcechannels.out = inchannels;
   sinkchannels.in   = sinkchannels.out   = outchannels;
 
+  /* the slave uses the application's format, unless told otherwise */
+  if(SND_PCM_FORMAT_UNKNOWN == slave_format)
+    slave_format = format;
+
   /* Make sure we have a slave and control devices defined */
   if (! sconf) {
     SNDERR("No slave configuration for iemladspa pcm");
@@ -698,22 +3117,129 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
     controls=default_controls;
   }
 
+  /* either a single plugin, a chain of them or a graph */
+  memset(&graphconf, 0, sizeof(graphconf));
+  graphconf.threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+  /* by default, the pool runs at the priority of the thread that waits for it
+   * (the worker, or the thread that opens the PCM, which is likely to transfer) */
+  graphconf.priority = (pool_priority >= 0)?pool_priority:(thread?thread_priority:iemladspa_thread_priority());
+  if(single_plugin + !!pluginsconf + !!graphnode > 1) {
+    SNDERR("use only one of library/module, plugins or graph");
+    return -EINVAL;
+  }
+  if(replicate && graphnode) {
+    SNDERR("replicate cannot be used with a graph");
+    return -EINVAL;
+  }
+  if(pluginsconf) {
+    err = iemladspa_parse_plugins(pluginsconf, &pluginconfs, &num_plugins);
+    if(err < 0)
+      return err;
+  } else if(graphnode) {
+    err = iemladspa_parse_graph(graphnode, &pluginconfs, &num_plugins, &graphconf);
+    if(err < 0) {
+      free(graphconf.outputs);
+      return err;
+    }
+  } else {
+    pluginconfs = (iemladspa_pluginconf_t*)calloc(1, sizeof(iemladspa_pluginconf_t));
+    if(!pluginconfs)
+      return -ENOMEM;
+    /* (without a module, it's the default plugin) */
+    pluginconfs[0].library = module?library:(library?library:"/usr/lib/ladspa/iemladspa.so");
+    pluginconfs[0].module  = module?module:"iemladspa";
+    num_plugins = 1;
+  }
+  for(k = 0; k < num_plugins; k++) {
+    err = iemladspa_pluginconf_find(&pluginconfs[k]);
+    if(err < 0) {
+      iemladspa_pluginconfs_free(pluginconfs, num_plugins);
+      free(graphconf.outputs);
+      free(default_controls);
+      return err;
+    }
+  }
+  /* the first plugin uses 'controls', the others default to '<name>.<index>.bin'
+   * (graph nodes to '<name>.<node>.bin') */
+  if(!pluginconfs[0].controls && !graphnode)
+    pluginconfs[0].controls = controls;
+  for(k = 0; k < num_plugins; k++) {
+    const char*nodename = pluginconfs[k].name;
+    pluginconfs[k].backend = backend;
+    if(pluginconfs[k].controls)
+      continue;
+    pluginconfs[k].default_controls = (char*)calloc(strlen(configname)+(nodename?strlen(nodename):0)+16, 1);
+    if(!pluginconfs[k].default_controls) {
+      SNDERR("unable to allocate memory for the controls of '%s'", configname);
+      iemladspa_pluginconfs_free(pluginconfs, num_plugins);
+      free(graphconf.outputs);
+      free(default_controls);
+      return -ENOMEM;
+    }
+    if(nodename)
+      sprintf(pluginconfs[k].default_controls, "%s.%s.bin", configname, nodename);
+    else
+      sprintf(pluginconfs[k].default_controls, "%s.%u.bin", configname, k);
+    pluginconfs[k].controls = pluginconfs[k].default_controls;
+  }
+  /* run a copy of the (mono) plugins for each channel */
+  if(replicate) {
+    const unsigned int channels = inchannels + outchannels;
+    err = iemladspa_replicate_chain(&pluginconfs, &num_plugins, &graphconf, channels);
+    if(err < 0) {
+      iemladspa_pluginconfs_free(pluginconfs, num_plugins);
+      free(graphconf.outputs);
+      return err;
+    }
+    /* with only a few channels, the copies are cheaper to run one after the other */
+    if(channels < IEMLADSPA_REPLICATE_PARALLEL)
+      graphconf.threads = 0;
+  }
+
   /* ========= init phase done ============ */
 
   /* Intialize the local object data */
   iemladspa = iemladspa_mergeplugin_findorcreate(configname,
-                                                 library,
-                                                 module,
-                                                 controls,
+                                                 pluginconfs,
+                                                 num_plugins,
+                                                 (graphnode||replicate)?&graphconf:NULL,
                                                  sourcechannels, sinkchannels);
+  iemladspa_pluginconfs_free(pluginconfs, num_plugins);
+  free(graphconf.outputs);
   if (iemladspa == NULL)
     return -ENOMEM;
+  iemladspa->fifo.blocksize = blocksize;
+  iemladspa->arena.lock = lockmem;
+  iemladspa->worker.enabled = thread;
+  iemladspa->worker.priority = thread_priority;
+  iemladspa->worker.cpu = thread_cpu;
+  iemladspa->gate.enabled = silence_gate;
+  iemladspa->gate.threshold = silence_threshold;
+  iemladspa->gate.tail_ms = silence_tail;
+  iemladspa->subblock = subblock;
+  iemladspa->resampling.rate = plugin_rate;
+  iemladspa->resampling.taps = plugin_rate_taps;
+  /* (without it, the settings would only be written back by the mixer) */
+  if(iemladspa_persist_start(iemladspa) < 0)
+    SNDERR("unable to start writing back the controls of '%s'", configname);
+  /* publish the timing in shared memory named after the controls file
+   * (failing to do so is not worth failing the PCM for) */
+  if(stats && !iemladspa->stats) {
+    char*name = stats_name(controls);
+    if(name)
+      iemladspa->stats = stats_map(name, 1);
+    free(name);
+  }
 
   /* check whether we already have an ext for this stream,
      if so, we are done;
      if not, create a new one
   */
 
+  /* enabling a stream changes what the other one has to do */
+  iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].plan.valid=0;
+  iemladspa->streamdir[SND_PCM_STREAM_CAPTURE ].plan.valid=0;
+
   if(SND_PCM_STREAM_PLAYBACK==stream) {
     iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].enabled=1;
     if(iemladspa->streamdir[SND_PCM_STREAM_PLAYBACK].ext.private_data == iemladspa)return 0;
@@ -736,43 +3262,10 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
     return err;
   }
 
-  /* MMAP to the controls file */
-  if(!iemladspa->control_data) {
-    iemladspa->control_data = LADSPAcontrolMMAP(iemladspa->klass, controls,
-                                                sourcechannels, sinkchannels);
-    if(iemladspa->control_data == NULL) {
-      return -1;
-    }
-
-    /* Make sure that the control file makes sense */
-    unsigned int j;
-
-    const unsigned long offset_in = iemladspa->control_data->num_controls;
-    const unsigned long offset_out = offset_in + iemladspa->control_data->num_inchannels;
-
-    for(j=0; j<iemladspa->control_data->num_inchannels; j++) {
-      unsigned int index=iemladspa->control_data->data[offset_in + j].index;
-      if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
-         (LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO)) {
-        SNDERR("Problem with control file %s.", controls);
-        return -1;
-      }
-    }
-    for(j=0; j<iemladspa->control_data->num_outchannels; j++) {
-      unsigned int index=iemladspa->control_data->data[offset_out+ j].index;
-
-      if(index>=iemladspa->klass->PortCount || iemladspa->klass->PortDescriptors[index] !=
-         (LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO)) {
-        SNDERR("Problem with control file %s.", controls);
-        return -1;
-      }
-    }
-  }
-
   /* Set PCM Contraints */
   pcmchannels = (SND_PCM_STREAM_PLAYBACK == stream)
-    ? iemladspa->control_data->sourcechannels.out
-    : iemladspa->control_data->sinkchannels.in;
+    ? iemladspa->layout.sourcechannels.out
+    : iemladspa->layout.sinkchannels.in;
 
   /* MONO support: we really should make an enumeration, rather than minmax */
 #if 0
@@ -802,7 +3295,7 @@ SND_PCM_PLUGIN_DEFINE_FUNC(iemladspa)
                                          pcmchannels);
 
   snd_pcm_extplug_set_param(ext, SND_PCM_EXTPLUG_HW_FORMAT, format);
-  snd_pcm_extplug_set_slave_param(ext, SND_PCM_EXTPLUG_HW_FORMAT, format);
+  snd_pcm_extplug_set_slave_param(ext, SND_PCM_EXTPLUG_HW_FORMAT, slave_format);
 
   *pcmp = ext->pcm;
 
@@ -0,0 +1,337 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* reference LADSPA-plugins for testing and benchmarking
+ *
+ * each plugin exists with N = 2, 4, 8 and 16 audio in- and outputs
+ * (so it fits a PCM with inchannels+outchannels = N), and as a mono plugin
+ * (N = 1, for 'replicate'), labelled '<kind>_<N>':
+ *   passthrough_N: copies its inputs to its outputs; reports a 'latency' of 0
+ *                  and the number of 'frames' it has processed (so tests can
+ *                  tell whether it ran)
+ *   gain_N       : multiplies all channels by 'Gain'
+ *   matrix_N     : output j is the sum of all inputs i, weighted by 'i>j'
+ *                  (identity by default; N <= 8 only)
+ *   fir_N        : a linear-phase lowpass (at a quarter of the sample rate)
+ *                  with 'Taps' taps, computed the slow way, so it is
+ *                  deliberately heavy; reports its 'latency'
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ladspa.h>
+
+#define REF_UNIQUEID 0x1e5a00  /* the IDs of the plugins follow this one */
+#define REF_FIR_MAXTAPS 4096
+
+typedef enum {
+  REF_PASSTHROUGH,
+  REF_GAIN,
+  REF_MATRIX,
+  REF_FIR,
+  REF_KINDS
+} ref_kind_t;
+
+static const char *s_kindname[REF_KINDS] = { "passthrough", "gain", "matrix", "fir" };
+/* (mono comes last, so the IDs of the others stay the same) */
+static const unsigned int s_channels[] = { 2, 4, 8, 16, 1 };
+#define REF_NUMCHANNELS (sizeof(s_channels) / sizeof(*s_channels))
+#define REF_MATRIX_MAXCHANNELS 8
+
+typedef struct _ref_instance {
+  const LADSPA_Descriptor *descriptor;
+  ref_kind_t kind;
+  unsigned int channels;
+  LADSPA_Data **ports;     /* audio inputs, audio outputs, controls */
+  unsigned long frames;    /* (passthrough) frames processed so far */
+  /* fir */
+  unsigned int taps;       /* the taps 'coefs' were computed for */
+  float *coefs;
+  float *history;          /* per channel: 2*REF_FIR_MAXTAPS samples (the ring buffer, twice) */
+  unsigned int pos;
+} ref_instance_t;
+
+static LADSPA_Descriptor *s_descriptors[REF_KINDS * REF_NUMCHANNELS];
+static unsigned long s_num_descriptors = 0;
+
+/* the controls (following the audio ports) */
+static unsigned long ref_num_controls(ref_kind_t kind, unsigned int channels) {
+  switch(kind) {
+  case REF_PASSTHROUGH: return 2; /* latency, frames */
+  case REF_GAIN:        return 1; /* Gain */
+  case REF_MATRIX:      return channels * channels;
+  case REF_FIR:         return 2; /* Taps, latency */
+  default:              return 0;
+  }
+}
+static inline LADSPA_Data *ref_control(ref_instance_t *ref, unsigned long index) {
+  return ref->ports[2 * ref->channels + index];
+}
+
+static LADSPA_Handle ref_instantiate(const LADSPA_Descriptor *descriptor, unsigned long rate) {
+  const unsigned long index = descriptor->UniqueID - REF_UNIQUEID;
+  ref_instance_t *ref = calloc(1, sizeof(ref_instance_t));
+  (void)rate;
+  if(!ref)
+    return NULL;
+  ref->descriptor = descriptor;
+  ref->kind = index / REF_NUMCHANNELS;
+  ref->channels = s_channels[index % REF_NUMCHANNELS];
+  ref->ports = calloc(descriptor->PortCount, sizeof(LADSPA_Data*));
+  if(ref->kind == REF_FIR) {
+    ref->coefs = calloc(REF_FIR_MAXTAPS, sizeof(float));
+    ref->history = calloc((size_t)ref->channels * 2 * REF_FIR_MAXTAPS, sizeof(float));
+  }
+  if(!ref->ports || (ref->kind == REF_FIR && (!ref->coefs || !ref->history))) {
+    free(ref->ports);
+    free(ref->coefs);
+    free(ref->history);
+    free(ref);
+    return NULL;
+  }
+  return ref;
+}
+static void ref_connect_port(LADSPA_Handle handle, unsigned long port, LADSPA_Data *data) {
+  ref_instance_t *ref = handle;
+  ref->ports[port] = data;
+}
+static void ref_activate(LADSPA_Handle handle) {
+  ref_instance_t *ref = handle;
+  ref->frames = 0;
+  ref->taps = 0;
+  ref->pos = 0;
+  if(ref->history)
+    memset(ref->history, 0, (size_t)ref->channels * 2 * REF_FIR_MAXTAPS * sizeof(float));
+}
+static void ref_cleanup(LADSPA_Handle handle) {
+  ref_instance_t *ref = handle;
+  free(ref->ports);
+  free(ref->coefs);
+  free(ref->history);
+  free(ref);
+}
+
+/* a Blackman-windowed sinc at a quarter of the sample rate, with unity gain at DC */
+static void ref_fir_design(ref_instance_t *ref, unsigned int taps) {
+  const double center = (taps - 1) / 2.;
+  double sum = 0.;
+  unsigned int k;
+  for(k = 0; k < taps; k++) {
+    const double x = (k - center) * 0.5;
+    const double w = (taps > 1)
+      ? 0.42 - 0.5 * cos(2 * M_PI * k / (taps - 1)) + 0.08 * cos(4 * M_PI * k / (taps - 1))
+      : 1.;
+    const double v = w * ((x != 0.) ? sin(M_PI * x) / (M_PI * x) : 1.);
+    ref->coefs[k] = v;
+    sum += v;
+  }
+  for(k = 0; k < taps; k++)
+    ref->coefs[k] /= sum;
+  ref->taps = taps;
+}
+
+static void ref_run(LADSPA_Handle handle, unsigned long frames) {
+  ref_instance_t *ref = handle;
+  const unsigned int channels = ref->channels;
+  LADSPA_Data **in = ref->ports, **out = ref->ports + channels;
+  unsigned long i;
+  unsigned int c, j;
+
+  switch(ref->kind) {
+  case REF_PASSTHROUGH:
+    for(c = 0; c < channels; c++)
+      if(out[c] != in[c])
+        memmove(out[c], in[c], frames * sizeof(LADSPA_Data));
+    ref->frames += frames;
+    *ref_control(ref, 0) = 0;
+    /* (a float holds integers up to 2^24 exactly) */
+    *ref_control(ref, 1) = ref->frames % 16777216;
+    break;
+  case REF_GAIN: {
+    const LADSPA_Data gain = *ref_control(ref, 0);
+    for(c = 0; c < channels; c++)
+      for(i = 0; i < frames; i++)
+        out[c][i] = in[c][i] * gain;
+    break;
+  }
+  case REF_MATRIX:
+    /* INPLACE_BROKEN: all inputs are needed for every output */
+    for(j = 0; j < channels; j++) {
+      for(i = 0; i < frames; i++) {
+        LADSPA_Data sum = 0;
+        for(c = 0; c < channels; c++)
+          sum += in[c][i] * *ref_control(ref, c * channels + j);
+        out[j][i] = sum;
+      }
+    }
+    break;
+  case REF_FIR: {
+    LADSPA_Data taps = *ref_control(ref, 0);
+    unsigned int n, pos = ref->pos;
+    n = (taps < 1) ? 1 : (taps > REF_FIR_MAXTAPS) ? REF_FIR_MAXTAPS : (unsigned int)taps;
+    if(n != ref->taps)
+      ref_fir_design(ref, n);
+    for(c = 0; c < channels; c++) {
+      float *history = ref->history + (size_t)c * 2 * REF_FIR_MAXTAPS;
+      pos = ref->pos;
+      for(i = 0; i < frames; i++) {
+        const float *x;
+        float y = 0.f;
+        pos = (pos + 1) % REF_FIR_MAXTAPS;
+        history[pos] = history[pos + REF_FIR_MAXTAPS] = in[c][i];
+        /* the newest sample first */
+        x = history + pos + REF_FIR_MAXTAPS;
+        for(j = 0; j < n; j++)
+          y += ref->coefs[j] * x[-(int)j];
+        out[c][i] = y;
+      }
+    }
+    ref->pos = pos;
+    *ref_control(ref, 1) = (n - 1) / 2;
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+static char *ref_strdup(const char *fmt, unsigned int a, unsigned int b) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), fmt, a, b);
+  return strdup(buf);
+}
+
+static LADSPA_Descriptor *ref_describe(ref_kind_t kind, unsigned int index) {
+  const unsigned int channels = s_channels[index];
+  const unsigned long controls = ref_num_controls(kind, channels);
+  const unsigned long ports = 2 * channels + controls;
+  LADSPA_Descriptor *d = calloc(1, sizeof(LADSPA_Descriptor));
+  LADSPA_PortDescriptor *descriptors = calloc(ports, sizeof(LADSPA_PortDescriptor));
+  LADSPA_PortRangeHint *hints = calloc(ports, sizeof(LADSPA_PortRangeHint));
+  char **names = calloc(ports, sizeof(char*));
+  char buf[64];
+  unsigned long p;
+  if(!d || !descriptors || !hints || !names) {
+    free(d);
+    free(descriptors);
+    free(hints);
+    free(names);
+    return NULL;
+  }
+
+  d->UniqueID = REF_UNIQUEID + kind * REF_NUMCHANNELS + index;
+  snprintf(buf, sizeof(buf), "%s_%u", s_kindname[kind], channels);
+  d->Label = strdup(buf);
+  snprintf(buf, sizeof(buf), "iemladspa reference %s (%u channels)", s_kindname[kind], channels);
+  d->Name = strdup(buf);
+  d->Properties = LADSPA_PROPERTY_HARD_RT_CAPABLE | ((REF_MATRIX == kind) ? LADSPA_PROPERTY_INPLACE_BROKEN : 0);
+  d->Maker = "IEM";
+  d->Copyright = "LGPL";
+  d->PortCount = ports;
+  d->PortDescriptors = descriptors;
+  d->PortRangeHints = hints;
+  d->PortNames = (const char * const *)names;
+  d->instantiate = ref_instantiate;
+  d->connect_port = ref_connect_port;
+  d->activate = ref_activate;
+  d->run = ref_run;
+  d->cleanup = ref_cleanup;
+
+  for(p = 0; p < channels; p++) {
+    descriptors[p] = LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO;
+    names[p] = ref_strdup("In %u", p, 0);
+    descriptors[channels + p] = LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO;
+    names[channels + p] = ref_strdup("Out %u", p, 0);
+  }
+  for(p = 0; p < controls; p++) {
+    const unsigned long port = 2 * channels + p;
+    LADSPA_PortRangeHint *hint = &hints[port];
+    descriptors[port] = LADSPA_PORT_INPUT | LADSPA_PORT_CONTROL;
+    hint->HintDescriptor = LADSPA_HINT_BOUNDED_BELOW | LADSPA_HINT_BOUNDED_ABOVE;
+    switch(kind) {
+    case REF_PASSTHROUGH:
+      descriptors[port] = LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL;
+      names[port] = strdup(p ? "frames" : "latency");
+      hint->HintDescriptor = 0;
+      break;
+    case REF_GAIN:
+      names[port] = strdup("Gain");
+      hint->HintDescriptor |= LADSPA_HINT_DEFAULT_1;
+      hint->UpperBound = 2;
+      break;
+    case REF_MATRIX:
+      names[port] = ref_strdup("%u>%u", p / channels, p % channels);
+      hint->HintDescriptor |= (p / channels == p % channels) ? LADSPA_HINT_DEFAULT_1 : LADSPA_HINT_DEFAULT_0;
+      hint->UpperBound = 1;
+      break;
+    case REF_FIR:
+      if(p) {
+        descriptors[port] = LADSPA_PORT_OUTPUT | LADSPA_PORT_CONTROL;
+        names[port] = strdup("latency");
+        hint->HintDescriptor = 0;
+        break;
+      }
+      names[port] = strdup("Taps");
+      hint->HintDescriptor |= LADSPA_HINT_INTEGER | LADSPA_HINT_DEFAULT_MIDDLE;
+      hint->LowerBound = 1;
+      hint->UpperBound = REF_FIR_MAXTAPS - 1;
+      break;
+    default:
+      break;
+    }
+  }
+  return d;
+}
+
+static void ref_free(LADSPA_Descriptor *d) {
+  unsigned long p;
+  for(p = 0; p < d->PortCount; p++)
+    free((char*)d->PortNames[p]);
+  free((char**)d->PortNames);
+  free((LADSPA_PortDescriptor*)d->PortDescriptors);
+  free((LADSPA_PortRangeHint*)d->PortRangeHints);
+  free((char*)d->Label);
+  free((char*)d->Name);
+  free(d);
+}
+
+__attribute__((constructor)) static void ref_init(void) {
+  unsigned int kind, index;
+  for(kind = 0; kind < REF_KINDS; kind++) {
+    for(index = 0; index < REF_NUMCHANNELS; index++) {
+      LADSPA_Descriptor *d;
+      if(REF_MATRIX == kind && s_channels[index] > REF_MATRIX_MAXCHANNELS)
+        continue;
+      d = ref_describe(kind, index);
+      if(d)
+        s_descriptors[s_num_descriptors++] = d;
+    }
+  }
+}
+__attribute__((destructor)) static void ref_fini(void) {
+  while(s_num_descriptors)
+    ref_free(s_descriptors[--s_num_descriptors]);
+}
+
+const LADSPA_Descriptor *ladspa_descriptor(unsigned long index) {
+  return (index < s_num_descriptors) ? s_descriptors[index] : NULL;
+}
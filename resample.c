@@ -0,0 +1,265 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* streaming polyphase resampler
+ *
+ * the output frame n lies at n*down/up input frames: between the input
+ * frames 'pos' and pos+1, at 'phase'/up of the way.
+ * it is the dot product of the last <taps> input frames with the
+ * coefficients of that phase (a polyphase decomposition of a lowpass at
+ * <up> times the input rate).
+ * the vectorized dot products sum in a different order, so their results
+ * can differ from the scalar one in the last bits.
+ */
+
+#include <math.h>
+#include <string.h>
+#include "resample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+# define HAVE_NEON_KERNELS 1
+# include <arm_neon.h>
+# if !defined(__aarch64__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+# endif
+#endif
+
+/* the passband edge, relative to the lower of the two Nyquist frequencies
+ * (the transition band lies below it, so nothing is folded back) */
+#define RESAMPLER_CUTOFF 0.45
+
+typedef float dot_fun_t(const float *a, const float *b, unsigned int n);
+
+/* ------------------------------------------------------------------ */
+/* dot products of <n> (a multiple of 8) floats */
+
+static float dot_scalar(const float *a, const float *b, unsigned int n)
+{
+  float sum = 0.f;
+  unsigned int i;
+  for(i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+#ifdef HAVE_X86_KERNELS
+static __attribute__((target("sse2"))) float dot_sse2(const float *a, const float *b, unsigned int n)
+{
+  __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+  float sum[4];
+  unsigned int i;
+  for(i = 0; i < n; i += 8) {
+    s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(a + i    ), _mm_loadu_ps(b + i    )));
+    s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+  }
+  _mm_storeu_ps(sum, _mm_add_ps(s0, s1));
+  return (sum[0] + sum[2]) + (sum[1] + sum[3]);
+}
+static __attribute__((target("avx2,fma"))) float dot_avx2(const float *a, const float *b, unsigned int n)
+{
+  __m256 s = _mm256_setzero_ps();
+  __m128 h;
+  unsigned int i;
+  for(i = 0; i < n; i += 8)
+    s = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), s);
+  h = _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+  h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+  h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+  return _mm_cvtss_f32(h);
+}
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+static float dot_neon(const float *a, const float *b, unsigned int n)
+{
+  float32x4_t s0 = vdupq_n_f32(0.f), s1 = vdupq_n_f32(0.f);
+  float32x2_t h;
+  unsigned int i;
+  for(i = 0; i < n; i += 8) {
+    s0 = vmlaq_f32(s0, vld1q_f32(a + i    ), vld1q_f32(b + i    ));
+    s1 = vmlaq_f32(s1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+  }
+  s0 = vaddq_f32(s0, s1);
+  h = vadd_f32(vget_low_f32(s0), vget_high_f32(s0));
+  return vget_lane_f32(vpadd_f32(h, h), 0);
+}
+#endif /* HAVE_NEON_KERNELS */
+
+/* ------------------------------------------------------------------ */
+/* runtime dispatch */
+
+static dot_fun_t *s_dot = dot_scalar;
+static const char *s_dot_name = "scalar";
+
+static void resampler_kernels_init(void) __attribute__((constructor));
+static void resampler_kernels_init(void)
+{
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2")) {
+    s_dot = dot_sse2;
+    s_dot_name = "sse2";
+  }
+  if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    s_dot = dot_avx2;
+    s_dot_name = "avx2";
+  }
+#endif
+#ifdef HAVE_NEON_KERNELS
+# if !defined(__aarch64__)
+  if(getauxval(AT_HWCAP) & HWCAP_NEON)
+# endif
+  {
+    s_dot = dot_neon;
+    s_dot_name = "neon";
+  }
+#endif
+}
+
+const char *resampler_kernel(void)
+{
+  return s_dot_name;
+}
+
+/* ------------------------------------------------------------------ */
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+  while(b) {
+    unsigned int t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}
+
+void resampler_config(resampler_t *r, unsigned int inrate, unsigned int outrate,
+                      unsigned int taps, unsigned int channels, unsigned int maxin)
+{
+  const unsigned int g = gcd(inrate, outrate);
+  memset(r, 0, sizeof(*r));
+  r->up = outrate / g;
+  r->down = inrate / g;
+  r->taps = (taps < 8) ? 8 : (taps + 7) & ~7U;
+  r->channels = channels;
+  r->length = r->taps + maxin;
+}
+
+size_t resampler_memsize(const resampler_t *r)
+{
+  return (size_t)r->up * r->taps + (size_t)r->channels * r->length;
+}
+
+void resampler_init(resampler_t *r, float *memory)
+{
+  const unsigned int up = r->up, taps = r->taps;
+  const unsigned int length = up * taps;
+  const double fc = RESAMPLER_CUTOFF / ((up > r->down) ? up : r->down);
+  double sum = 0.;
+  unsigned int i;
+
+  r->coeffs = memory;
+  r->history = memory + (size_t)up * taps;
+
+  /* Blackman-windowed sinc, at <up> times the input rate;
+   * the coefficient i belongs to phase i%up */
+  for(i = 0; i < length; i++) {
+    const double x = i - (length - 1) / 2.;
+    const double sinc = (x == 0.) ? 2. * fc : sin(2. * M_PI * fc * x) / (M_PI * x);
+    const double window = 0.42
+      - 0.5  * cos(2. * M_PI * i / (length - 1))
+      + 0.08 * cos(4. * M_PI * i / (length - 1));
+    const double h = sinc * window;
+    r->coeffs[(i % up) * taps + (taps - 1 - i / up)] = h;
+    sum += h;
+  }
+  /* unity gain: each output is made from every <up>th coefficient */
+  for(i = 0; i < length; i++)
+    r->coeffs[i] *= up / sum;
+
+  resampler_reset(r);
+}
+
+void resampler_reset(resampler_t *r)
+{
+  memset(r->history, 0, (size_t)r->channels * r->length * sizeof(float));
+  r->fill = r->taps - 1;
+  r->pos = r->taps - 1;
+  r->phase = 0;
+}
+
+unsigned long resampler_maxout(const resampler_t *r, unsigned long frames)
+{
+  return (frames * r->up + r->down - 1) / r->down + 1;
+}
+
+double resampler_delay(const resampler_t *r)
+{
+  return (r->up * r->taps - 1) / (2. * r->up);
+}
+
+unsigned long resampler_process(resampler_t *r, const float * const *in, unsigned long frames,
+                                float *out, unsigned long stride)
+{
+  const unsigned int taps = r->taps, length = r->length;
+  unsigned long done = 0, produced = 0;
+  unsigned int j;
+
+  while(done < frames) {
+    unsigned long n = length - r->fill, shift;
+    if(n > frames - done)
+      n = frames - done;
+    for(j = 0; j < r->channels; j++)
+      memcpy(r->history + j*length + r->fill, in[j] + done, n * sizeof(float));
+    r->fill += n;
+    done += n;
+
+    /* all outputs whose input frames have arrived */
+    while(r->pos < r->fill) {
+      const float *coeffs = r->coeffs + r->phase * taps;
+      const float *history = r->history + r->pos + 1 - taps;
+      for(j = 0; j < r->channels; j++)
+        out[j*stride + produced] = s_dot(history + j*length, coeffs, taps);
+      produced++;
+      r->phase += r->down;
+      r->pos += r->phase / r->up;
+      r->phase %= r->up;
+    }
+
+    /* only keep what the next output needs */
+    shift = r->pos + 1 - taps;
+    if(shift > r->fill)
+      shift = r->fill;
+    if(shift) {
+      for(j = 0; j < r->channels; j++)
+        memmove(r->history + j*length, r->history + j*length + shift,
+                (r->fill - shift) * sizeof(float));
+      r->fill -= shift;
+      r->pos -= shift;
+    }
+  }
+  return produced;
+}
@@ -0,0 +1,74 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IEMLADSPA_RESAMPLE_H
+#define IEMLADSPA_RESAMPLE_H
+
+#include <stddef.h>
+
+/* streaming polyphase resampler for planar FLOAT channels
+ *
+ * converts by a rational ratio <up>/<down> (reduced from the two rates),
+ * with a windowed-sinc lowpass of <taps> taps per phase.
+ * more taps give a steeper filter (less aliasing) at the cost of CPU and
+ * latency (the group delay is about taps/2 input frames).
+ *
+ * all memory is handed in by the caller (resampler_memsize() floats),
+ * so nothing is allocated while streaming.
+ */
+
+typedef struct _resampler {
+  unsigned int up, down;   /* the reduced ratio of output to input rate */
+  unsigned int taps;       /* per phase (a multiple of 8) */
+  unsigned int channels;
+  unsigned int length;     /* frames of history per channel */
+  float *coeffs;           /* <up> phases of <taps> coefficients (in reverse order) */
+  float *history;          /* <channels> x <length> input frames */
+  unsigned int fill;       /* frames in the history (including the taps-1 old ones) */
+  unsigned int pos;        /* the newest input frame used by the next output */
+  unsigned int phase;      /* ...and the position of that output between it and the next one (0..up-1) */
+} resampler_t;
+
+/* set up a resampler from <inrate> to <outrate>
+ * that takes at most <maxin> frames per call (more are handled in chunks) */
+void resampler_config(resampler_t *r, unsigned int inrate, unsigned int outrate,
+                      unsigned int taps, unsigned int channels, unsigned int maxin);
+/* floats of memory needed by a configured resampler */
+size_t resampler_memsize(const resampler_t *r);
+/* hand the memory to the resampler, calculate the filter and reset it */
+void resampler_init(resampler_t *r, float *memory);
+/* forget all input so far (the history is silence) */
+void resampler_reset(resampler_t *r);
+
+/* the largest number of output frames that <frames> input frames can produce */
+unsigned long resampler_maxout(const resampler_t *r, unsigned long frames);
+/* the group delay of the filter, in input frames */
+double resampler_delay(const resampler_t *r);
+
+/* resample <frames> frames from the <in> channels
+ * into <out> (channel j starts at out+j*stride)
+ * returns the number of output frames */
+unsigned long resampler_process(resampler_t *r, const float * const *in, unsigned long frames,
+                                float *out, unsigned long stride);
+
+/* the name of the dot-product kernel used for the running CPU */
+const char *resampler_kernel(void);
+
+#endif /* IEMLADSPA_RESAMPLE_H */
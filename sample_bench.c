@@ -0,0 +1,126 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* throughput of the (de)interleaving kernels against the channel count
+ *
+ * usage: sample_bench [frames]
+ *
+ * for every kernel set supported by the running CPU, prints one line per
+ * format, direction and channel count with the number of samples
+ * (frames*channels) converted per microsecond.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sample_utils.h"
+
+#define BENCH_SAMPLES (1 << 24) /* samples converted per measurement */
+
+static const int s_channels[] = { 1, 2, 4, 8, 16, 24, 32, 48, 64, 96, 128 };
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* samples per microsecond; the best of a few runs */
+static double bench_deinterleave(deinterleave_fun_t *fun, void *interleaved, float *planar,
+                                 int frames, int channels)
+{
+  const int loops = BENCH_SAMPLES / (frames * channels) + 1;
+  double best = 0.;
+  int run, l;
+  for(run = 0; run < 3; run++) {
+    double t = now();
+    for(l = 0; l < loops; l++)
+      fun(interleaved, planar, frames, channels);
+    t = now() - t;
+    if(t > 0. && (double)loops * frames * channels / t > best)
+      best = (double)loops * frames * channels / t;
+  }
+  return best * 1e-6;
+}
+static double bench_reinterleave(reinterleave_fun_t *fun, float *planar, void *interleaved,
+                                 int frames, int channels)
+{
+  const int loops = BENCH_SAMPLES / (frames * channels) + 1;
+  double best = 0.;
+  int run, l;
+  for(run = 0; run < 3; run++) {
+    double t = now();
+    for(l = 0; l < loops; l++)
+      fun(planar, interleaved, frames, channels);
+    t = now() - t;
+    if(t > 0. && (double)loops * frames * channels / t > best)
+      best = (double)loops * frames * channels / t;
+  }
+  return best * 1e-6;
+}
+
+int main(int argc, char **argv)
+{
+  const sample_kernels_t * const *kernels;
+  const int num_channels = sizeof(s_channels) / sizeof(*s_channels);
+  const int maxchannels = s_channels[num_channels - 1];
+  int frames = 1024;
+  float *planar;
+  void *interleaved;
+  int c;
+
+  if(argc > 1)
+    frames = atoi(argv[1]);
+  if(frames < 1) {
+    fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+    return 1;
+  }
+  planar = calloc((size_t)frames * maxchannels, sizeof(float));
+  interleaved = calloc((size_t)frames * maxchannels, sizeof(float));
+  if(!planar || !interleaved) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+  for(c = 0; c < frames * maxchannels; c++)
+    planar[c] = (c % 199) / 200.f - .5f;
+  memcpy(interleaved, planar, (size_t)frames * maxchannels * sizeof(float));
+
+  printf("# frames=%d; samples/us\n", frames);
+  printf("# %-8s %-6s %-12s %8s %10s\n", "kernels", "format", "direction", "channels", "throughput");
+  for(kernels = sample_kernels_list(); *kernels; kernels++) {
+    const sample_kernels_t *k = *kernels;
+    for(c = 0; c < num_channels; c++) {
+      const int ch = s_channels[c];
+      printf("  %-8s %-6s %-12s %8d %10.1f\n", k->name, "FLOAT", "deinterleave", ch,
+             bench_deinterleave(k->deinterleaveFLOAT, interleaved, planar, frames, ch));
+      printf("  %-8s %-6s %-12s %8d %10.1f\n", k->name, "FLOAT", "reinterleave", ch,
+             bench_reinterleave(k->reinterleaveFLOAT, planar, interleaved, frames, ch));
+      printf("  %-8s %-6s %-12s %8d %10.1f\n", k->name, "S16", "deinterleave", ch,
+             bench_deinterleave(k->deinterleaveS16, interleaved, planar, frames, ch));
+      printf("  %-8s %-6s %-12s %8d %10.1f\n", k->name, "S16", "reinterleave", ch,
+             bench_reinterleave(k->reinterleaveS16, planar, interleaved, frames, ch));
+    }
+  }
+  free(planar);
+  free(interleaved);
+  return 0;
+}
@@ -0,0 +1,892 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* sample (de)interleaving kernels
+ *
+ * the scalar kernels are the reference: all vectorized kernels must produce
+ * bit-identical results.
+ * S16 conversion is done in single precision:
+ *   FLOAT->S16 scales by 32767, truncates towards zero and saturates to
+ *   [-32767..32767]
+ *   S16->FLOAT scales by 1/32767
+ * the same applies to S24 (with 8388607) and S32 (with 2147483647, in double
+ * precision, as a float cannot represent the full scale).
+ * S24_LE and S32_LE are read and written in host byte order.
+ *
+ * the vectorized kernels handle mono and stereo specially, and otherwise
+ * transpose tiles of 4 channels by 4 (or 8) frames; left-over channels
+ * and frames are handled by the scalar code.
+ * with many channels, these small tiles are visited in blocks of
+ * TILE_FRAMES x TILE_CHANNELS, so the planar side is written (or read)
+ * through a handful of cache lines at a time, rather than through one line
+ * (and one page) per channel.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "sample_utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+# define HAVE_X86_KERNELS 1
+# include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || defined(__ARM_NEON)
+# define HAVE_NEON_KERNELS 1
+# include <arm_neon.h>
+# if !defined(__aarch64__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+# endif
+#endif
+
+#define S16_SCALE_OUT 32767.f
+#define S16_SCALE_IN  (1.f/32767.f)
+
+/* the block size of the general transpose loops
+ * TILE_FRAMES must be a multiple of every kernel's frame step, and
+ * TILE_CHANNELS a multiple of 4 */
+#define TILE_FRAMES   64
+#define TILE_CHANNELS 8
+
+/* visit the <step> frames by 4 channels sub-tiles (whole ones only) of the
+ * sample matrix, one TILE_FRAMES x TILE_CHANNELS block after the other;
+ * up to TILE_CHANNELS channels this is plain frame order */
+#define FOREACH_SUBTILE(ib, jb, i, j, frames, channels, step)                   \
+  for(ib = 0; ib + (step) <= (frames); ib += TILE_FRAMES)                       \
+    for(jb = 0; jb + 4 <= (channels); jb += TILE_CHANNELS)                      \
+      for(i = ib; i < ib + TILE_FRAMES && i + (step) <= (frames); i += (step))  \
+        for(j = jb; j < jb + TILE_CHANNELS && j + 4 <= (channels); j += 4)
+
+/* ------------------------------------------------------------------ */
+/* scalar reference */
+
+/* the scalar loops take the first frame to process,
+ * so the vectorized kernels can use them for the left-overs */
+static inline void reinterleaveFLOAT_from(const float *src, float *dst,
+                                          int frames, int channels, int i)
+{
+  int j;
+  for(; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i*channels + j] = src[i + frames*j];
+    }
+  }
+}
+static inline void deinterleaveFLOAT_from(const float *src, float *dst,
+                                          int frames, int channels, int i)
+{
+  int j;
+  for(; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i + frames*j] = src[i*channels + j];
+    }
+  }
+}
+static inline signed short float2s16(float f)
+{
+  float v = f * S16_SCALE_OUT;
+  if(v > S16_SCALE_OUT)
+    v = S16_SCALE_OUT;
+  else if (v < -S16_SCALE_OUT)
+    v = -S16_SCALE_OUT;
+  return (signed short)v;
+}
+static inline void reinterleaveS16_from(const float *src, signed short *dst,
+                                        int frames, int channels, int i)
+{
+  int j;
+  for(; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i*channels + j] = float2s16(src[i + frames*j]);
+    }
+  }
+}
+static inline void deinterleaveS16_from(const signed short *src, float *dst,
+                                        int frames, int channels, int i)
+{
+  const float scale = S16_SCALE_IN;
+  int j;
+  for(; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i + frames*j] = src[i*channels + j] * scale;
+    }
+  }
+}
+
+static void reinterleaveFLOAT_scalar(float *src, void *dst_, int frames, int channels)
+{
+  reinterleaveFLOAT_from(src, (float*)dst_, frames, channels, 0);
+}
+static void deinterleaveFLOAT_scalar(void *src_, float *dst, int frames, int channels)
+{
+  deinterleaveFLOAT_from((const float*)src_, dst, frames, channels, 0);
+}
+static void reinterleaveS16_scalar(float *src, void *dst_, int frames, int channels)
+{
+  reinterleaveS16_from(src, (signed short*)dst_, frames, channels, 0);
+}
+static void deinterleaveS16_scalar(void *src_, float *dst, int frames, int channels)
+{
+  deinterleaveS16_from((const signed short*)src_, dst, frames, channels, 0);
+}
+
+/* the wide formats only have scalar kernels, which are shared by all sets */
+#define S24_SCALE_OUT 8388607.f
+#define S24_SCALE_IN  (1.f/8388607.f)
+#define S32_SCALE_OUT 2147483647.
+#define S32_SCALE_IN  (1./2147483647.)
+
+static inline int32_t float2s24(float f)
+{
+  float v = f * S24_SCALE_OUT;
+  if(v > S24_SCALE_OUT)
+    v = S24_SCALE_OUT;
+  else if (v < -S24_SCALE_OUT)
+    v = -S24_SCALE_OUT;
+  return (int32_t)v;
+}
+static inline float s24tofloat(uint32_t v)
+{
+  /* sign-extend from bit 23, ignoring whatever is in the upper byte */
+  return ((int32_t)(v << 8) >> 8) * S24_SCALE_IN;
+}
+
+static void reinterleaveS24_scalar(float *src, void *dst_, int frames, int channels)
+{
+  int32_t *dst = (int32_t*)dst_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i*channels + j] = float2s24(src[i + frames*j]);
+    }
+  }
+}
+static void deinterleaveS24_scalar(void *src_, float *dst, int frames, int channels)
+{
+  const uint32_t *src = (const uint32_t*)src_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i + frames*j] = s24tofloat(src[i*channels + j]);
+    }
+  }
+}
+static void reinterleaveS24_3LE_scalar(float *src, void *dst_, int frames, int channels)
+{
+  unsigned char *dst = (unsigned char*)dst_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      int32_t v = float2s24(src[i + frames*j]);
+      unsigned char *out = dst + 3*(i*channels + j);
+      out[0] = v;
+      out[1] = v >> 8;
+      out[2] = v >> 16;
+    }
+  }
+}
+static void deinterleaveS24_3LE_scalar(void *src_, float *dst, int frames, int channels)
+{
+  const unsigned char *src = (const unsigned char*)src_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      const unsigned char *in = src + 3*(i*channels + j);
+      dst[i + frames*j] = s24tofloat(in[0] | (in[1] << 8) | ((uint32_t)in[2] << 16));
+    }
+  }
+}
+static void reinterleaveS32_scalar(float *src, void *dst_, int frames, int channels)
+{
+  int32_t *dst = (int32_t*)dst_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      double v = src[i + frames*j] * S32_SCALE_OUT;
+      if(v > S32_SCALE_OUT)
+        v = S32_SCALE_OUT;
+      else if (v < -S32_SCALE_OUT)
+        v = -S32_SCALE_OUT;
+      dst[i*channels + j] = (int32_t)v;
+    }
+  }
+}
+static void deinterleaveS32_scalar(void *src_, float *dst, int frames, int channels)
+{
+  const int32_t *src = (const int32_t*)src_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i + frames*j] = src[i*channels + j] * S32_SCALE_IN;
+    }
+  }
+}
+static void reinterleaveFLOAT64_scalar(float *src, void *dst_, int frames, int channels)
+{
+  double *dst = (double*)dst_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i*channels + j] = src[i + frames*j];
+    }
+  }
+}
+static void deinterleaveFLOAT64_scalar(void *src_, float *dst, int frames, int channels)
+{
+  const double *src = (const double*)src_;
+  int i, j;
+  for(i = 0; i < frames; i++){
+    for(j = 0; j < channels; j++){
+      dst[i + frames*j] = src[i*channels + j];
+    }
+  }
+}
+#define SCALAR_WIDE_KERNELS                     \
+  deinterleaveS24_scalar,                       \
+  reinterleaveS24_scalar,                       \
+  deinterleaveS24_3LE_scalar,                   \
+  reinterleaveS24_3LE_scalar,                   \
+  deinterleaveS32_scalar,                       \
+  reinterleaveS32_scalar,                       \
+  deinterleaveFLOAT64_scalar,                   \
+  reinterleaveFLOAT64_scalar
+
+const sample_kernels_t sample_kernels_scalar = {
+  "scalar",
+  deinterleaveFLOAT_scalar,
+  reinterleaveFLOAT_scalar,
+  deinterleaveS16_scalar,
+  reinterleaveS16_scalar,
+  SCALAR_WIDE_KERNELS,
+};
+
+/* ------------------------------------------------------------------ */
+/* x86: SSE2 and AVX2 */
+#ifdef HAVE_X86_KERNELS
+# define SSE2 __attribute__((target("sse2")))
+# define AVX2 __attribute__((target("avx2")))
+
+/* 4 S16 samples (in the lower half of 'v') to FLOAT */
+static inline SSE2 __m128 sse2_s16tofloat(__m128i v)
+{
+  __m128i i32 = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+  return _mm_mul_ps(_mm_cvtepi32_ps(i32), _mm_set1_ps(S16_SCALE_IN));
+}
+/* 8 FLOAT samples to S16: 'packs' saturates, the float 'min' only guards
+ * the int32 conversion against huge positive values */
+static inline SSE2 __m128i sse2_floattos16(__m128 a, __m128 b)
+{
+  const __m128 scale = _mm_set1_ps(S16_SCALE_OUT);
+  __m128i ia = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(a, scale), scale));
+  __m128i ib = _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(b, scale), scale));
+  return _mm_max_epi16(_mm_packs_epi32(ia, ib), _mm_set1_epi16(-32767));
+}
+
+static SSE2 void deinterleaveFLOAT_sse2(void *src_, float *dst, int frames, int channels)
+{
+  const float *src = (const float*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      _mm_storeu_ps(dst + i, _mm_loadu_ps(src + i));
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 4 <= frames; i += 4) {
+      __m128 a = _mm_loadu_ps(src + 2*i), b = _mm_loadu_ps(src + 2*i + 4);
+      _mm_storeu_ps(dst  + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(dst1 + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      __m128 r0 = _mm_loadu_ps(in);
+      __m128 r1 = _mm_loadu_ps(in +   channels);
+      __m128 r2 = _mm_loadu_ps(in + 2*channels);
+      __m128 r3 = _mm_loadu_ps(in + 3*channels);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(out           , r0);
+      _mm_storeu_ps(out +   frames, r1);
+      _mm_storeu_ps(out + 2*frames, r2);
+      _mm_storeu_ps(out + 3*frames, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j];
+  }
+  deinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static SSE2 void reinterleaveFLOAT_sse2(float *src, void *dst_, int frames, int channels)
+{
+  float *dst = (float*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      _mm_storeu_ps(dst + i, _mm_loadu_ps(src + i));
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 4 <= frames; i += 4) {
+      __m128 l = _mm_loadu_ps(src + i), r = _mm_loadu_ps(src1 + i);
+      _mm_storeu_ps(dst + 2*i    , _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(dst + 2*i + 4, _mm_unpackhi_ps(l, r));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + j*frames + i;
+      float *out = dst + i*channels + j;
+      __m128 r0 = _mm_loadu_ps(in);
+      __m128 r1 = _mm_loadu_ps(in +   frames);
+      __m128 r2 = _mm_loadu_ps(in + 2*frames);
+      __m128 r3 = _mm_loadu_ps(in + 3*frames);
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(out             , r0);
+      _mm_storeu_ps(out +   channels, r1);
+      _mm_storeu_ps(out + 2*channels, r2);
+      _mm_storeu_ps(out + 3*channels, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = src[k + frames*j];
+  }
+  reinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static SSE2 void deinterleaveS16_sse2(void *src_, float *dst, int frames, int channels)
+{
+  const signed short *src = (const signed short*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 8 <= frames; i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+      _mm_storeu_ps(dst + i    , sse2_s16tofloat(v));
+      _mm_storeu_ps(dst + i + 4, sse2_s16tofloat(_mm_srli_si128(v, 8)));
+    }
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 4 <= frames; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i*)(src + 2*i));
+      __m128 a = sse2_s16tofloat(v), b = sse2_s16tofloat(_mm_srli_si128(v, 8));
+      _mm_storeu_ps(dst  + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+      _mm_storeu_ps(dst1 + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const signed short *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      __m128 r0 = sse2_s16tofloat(_mm_loadl_epi64((const __m128i*)(in)));
+      __m128 r1 = sse2_s16tofloat(_mm_loadl_epi64((const __m128i*)(in +   channels)));
+      __m128 r2 = sse2_s16tofloat(_mm_loadl_epi64((const __m128i*)(in + 2*channels)));
+      __m128 r3 = sse2_s16tofloat(_mm_loadl_epi64((const __m128i*)(in + 3*channels)));
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      _mm_storeu_ps(out           , r0);
+      _mm_storeu_ps(out +   frames, r1);
+      _mm_storeu_ps(out + 2*frames, r2);
+      _mm_storeu_ps(out + 3*frames, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j] * S16_SCALE_IN;
+  }
+  deinterleaveS16_from(src, dst, frames, channels, i);
+}
+static SSE2 void reinterleaveS16_sse2(float *src, void *dst_, int frames, int channels)
+{
+  signed short *dst = (signed short*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 8 <= frames; i += 8) {
+      _mm_storeu_si128((__m128i*)(dst + i),
+                       sse2_floattos16(_mm_loadu_ps(src + i), _mm_loadu_ps(src + i + 4)));
+    }
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 4 <= frames; i += 4) {
+      __m128 l = _mm_loadu_ps(src + i), r = _mm_loadu_ps(src1 + i);
+      _mm_storeu_si128((__m128i*)(dst + 2*i),
+                       sse2_floattos16(_mm_unpacklo_ps(l, r), _mm_unpackhi_ps(l, r)));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + j*frames + i;
+      signed short *out = dst + i*channels + j;
+      __m128 r0 = _mm_loadu_ps(in);
+      __m128 r1 = _mm_loadu_ps(in +   frames);
+      __m128 r2 = _mm_loadu_ps(in + 2*frames);
+      __m128 r3 = _mm_loadu_ps(in + 3*frames);
+      __m128i f01, f23;
+      _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+      f01 = sse2_floattos16(r0, r1);
+      f23 = sse2_floattos16(r2, r3);
+      _mm_storel_epi64((__m128i*)(out             ), f01);
+      _mm_storel_epi64((__m128i*)(out +   channels), _mm_srli_si128(f01, 8));
+      _mm_storel_epi64((__m128i*)(out + 2*channels), f23);
+      _mm_storel_epi64((__m128i*)(out + 3*channels), _mm_srli_si128(f23, 8));
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = float2s16(src[k + frames*j]);
+  }
+  reinterleaveS16_from(src, dst, frames, channels, i);
+}
+
+static const sample_kernels_t sample_kernels_sse2 = {
+  "sse2",
+  deinterleaveFLOAT_sse2,
+  reinterleaveFLOAT_sse2,
+  deinterleaveS16_sse2,
+  reinterleaveS16_sse2,
+  SCALAR_WIDE_KERNELS,
+};
+
+/* in-lane 4x4 transpose of two 4x4 matrices */
+# define AVX2_TRANSPOSE4(r0, r1, r2, r3) do {                     \
+    __m256 t0 = _mm256_unpacklo_ps(r0, r1);                       \
+    __m256 t1 = _mm256_unpacklo_ps(r2, r3);                       \
+    __m256 t2 = _mm256_unpackhi_ps(r0, r1);                       \
+    __m256 t3 = _mm256_unpackhi_ps(r2, r3);                       \
+    r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));      \
+    r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));      \
+    r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));      \
+    r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));      \
+  } while(0)
+
+/* build a register from two 128bit halves */
+static inline AVX2 __m256 avx2_join(__m128 lo, __m128 hi)
+{
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+/* 8 S16 samples to FLOAT */
+static inline AVX2 __m256 avx2_s16tofloat(__m128i v)
+{
+  return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)),
+                       _mm256_set1_ps(S16_SCALE_IN));
+}
+/* 16 FLOAT samples to S16 (in-lane: a.lo, b.lo, a.hi, b.hi) */
+static inline AVX2 __m256i avx2_floattos16(__m256 a, __m256 b)
+{
+  const __m256 scale = _mm256_set1_ps(S16_SCALE_OUT);
+  __m256i ia = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(a, scale), scale));
+  __m256i ib = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_mul_ps(b, scale), scale));
+  return _mm256_max_epi16(_mm256_packs_epi32(ia, ib), _mm256_set1_epi16(-32767));
+}
+/* the 64bit quarters 0,2,1,3 */
+# define AVX2_QUARTERS_0213 _MM_SHUFFLE(3, 1, 2, 0)
+
+static AVX2 void deinterleaveFLOAT_avx2(void *src_, float *dst, int frames, int channels)
+{
+  const float *src = (const float*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 8 <= frames; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_loadu_ps(src + i));
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 8 <= frames; i += 8) {
+      __m256 a = _mm256_loadu_ps(src + 2*i), b = _mm256_loadu_ps(src + 2*i + 8);
+      __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      _mm256_storeu_ps(dst  + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), AVX2_QUARTERS_0213)));
+      _mm256_storeu_ps(dst1 + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), AVX2_QUARTERS_0213)));
+    }
+  } else {
+    /* the low lane holds frames 0..3, the high lane frames 4..7 */
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 8) {
+      const float *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      __m256 r0 = avx2_join(_mm_loadu_ps(in             ), _mm_loadu_ps(in + 4*channels));
+      __m256 r1 = avx2_join(_mm_loadu_ps(in +   channels), _mm_loadu_ps(in + 5*channels));
+      __m256 r2 = avx2_join(_mm_loadu_ps(in + 2*channels), _mm_loadu_ps(in + 6*channels));
+      __m256 r3 = avx2_join(_mm_loadu_ps(in + 3*channels), _mm_loadu_ps(in + 7*channels));
+      AVX2_TRANSPOSE4(r0, r1, r2, r3);
+      _mm256_storeu_ps(out           , r0);
+      _mm256_storeu_ps(out +   frames, r1);
+      _mm256_storeu_ps(out + 2*frames, r2);
+      _mm256_storeu_ps(out + 3*frames, r3);
+    }
+    i = frames - frames % 8;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j];
+  }
+  deinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static AVX2 void reinterleaveFLOAT_avx2(float *src, void *dst_, int frames, int channels)
+{
+  float *dst = (float*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 8 <= frames; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_loadu_ps(src + i));
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 8 <= frames; i += 8) {
+      __m256 l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_loadu_ps(src  + i)), AVX2_QUARTERS_0213));
+      __m256 r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_loadu_ps(src1 + i)), AVX2_QUARTERS_0213));
+      _mm256_storeu_ps(dst + 2*i    , _mm256_unpacklo_ps(l, r));
+      _mm256_storeu_ps(dst + 2*i + 8, _mm256_unpackhi_ps(l, r));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 8) {
+      const float *in = src + j*frames + i;
+      float *out = dst + i*channels + j;
+      __m256 r0 = _mm256_loadu_ps(in);
+      __m256 r1 = _mm256_loadu_ps(in +   frames);
+      __m256 r2 = _mm256_loadu_ps(in + 2*frames);
+      __m256 r3 = _mm256_loadu_ps(in + 3*frames);
+      AVX2_TRANSPOSE4(r0, r1, r2, r3);
+      _mm_storeu_ps(out             , _mm256_castps256_ps128(r0));
+      _mm_storeu_ps(out +   channels, _mm256_castps256_ps128(r1));
+      _mm_storeu_ps(out + 2*channels, _mm256_castps256_ps128(r2));
+      _mm_storeu_ps(out + 3*channels, _mm256_castps256_ps128(r3));
+      _mm_storeu_ps(out + 4*channels, _mm256_extractf128_ps(r0, 1));
+      _mm_storeu_ps(out + 5*channels, _mm256_extractf128_ps(r1, 1));
+      _mm_storeu_ps(out + 6*channels, _mm256_extractf128_ps(r2, 1));
+      _mm_storeu_ps(out + 7*channels, _mm256_extractf128_ps(r3, 1));
+    }
+    i = frames - frames % 8;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = src[k + frames*j];
+  }
+  reinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static AVX2 void deinterleaveS16_avx2(void *src_, float *dst, int frames, int channels)
+{
+  const signed short *src = (const signed short*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 8 <= frames; i += 8)
+      _mm256_storeu_ps(dst + i, avx2_s16tofloat(_mm_loadu_si128((const __m128i*)(src + i))));
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 8 <= frames; i += 8) {
+      __m128i v0 = _mm_loadu_si128((const __m128i*)(src + 2*i));
+      __m128i v1 = _mm_loadu_si128((const __m128i*)(src + 2*i + 8));
+      __m256 a = avx2_s16tofloat(v0), b = avx2_s16tofloat(v1);
+      __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+      __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      _mm256_storeu_ps(dst  + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), AVX2_QUARTERS_0213)));
+      _mm256_storeu_ps(dst1 + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), AVX2_QUARTERS_0213)));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 8) {
+      const signed short *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      __m256 r0 = avx2_s16tofloat(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in             )),
+                                                     _mm_loadl_epi64((const __m128i*)(in + 4*channels))));
+      __m256 r1 = avx2_s16tofloat(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in +   channels)),
+                                                     _mm_loadl_epi64((const __m128i*)(in + 5*channels))));
+      __m256 r2 = avx2_s16tofloat(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in + 2*channels)),
+                                                     _mm_loadl_epi64((const __m128i*)(in + 6*channels))));
+      __m256 r3 = avx2_s16tofloat(_mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)(in + 3*channels)),
+                                                     _mm_loadl_epi64((const __m128i*)(in + 7*channels))));
+      AVX2_TRANSPOSE4(r0, r1, r2, r3);
+      _mm256_storeu_ps(out           , r0);
+      _mm256_storeu_ps(out +   frames, r1);
+      _mm256_storeu_ps(out + 2*frames, r2);
+      _mm256_storeu_ps(out + 3*frames, r3);
+    }
+    i = frames - frames % 8;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j] * S16_SCALE_IN;
+  }
+  deinterleaveS16_from(src, dst, frames, channels, i);
+}
+static AVX2 void reinterleaveS16_avx2(float *src, void *dst_, int frames, int channels)
+{
+  signed short *dst = (signed short*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 16 <= frames; i += 16) {
+      __m256i v = avx2_floattos16(_mm256_loadu_ps(src + i), _mm256_loadu_ps(src + i + 8));
+      _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute4x64_epi64(v, AVX2_QUARTERS_0213));
+    }
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 8 <= frames; i += 8) {
+      __m256 l = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_loadu_ps(src  + i)), AVX2_QUARTERS_0213));
+      __m256 r = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(_mm256_loadu_ps(src1 + i)), AVX2_QUARTERS_0213));
+      __m256i v = avx2_floattos16(_mm256_unpacklo_ps(l, r), _mm256_unpackhi_ps(l, r));
+      _mm256_storeu_si256((__m256i*)(dst + 2*i), _mm256_permute4x64_epi64(v, AVX2_QUARTERS_0213));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 8) {
+      const float *in = src + j*frames + i;
+      signed short *out = dst + i*channels + j;
+      __m256 r0 = _mm256_loadu_ps(in);
+      __m256 r1 = _mm256_loadu_ps(in +   frames);
+      __m256 r2 = _mm256_loadu_ps(in + 2*frames);
+      __m256 r3 = _mm256_loadu_ps(in + 3*frames);
+      __m256i f01, f23;
+      __m128i lo, hi;
+      AVX2_TRANSPOSE4(r0, r1, r2, r3);
+      /* lanes: (frame0, frame1 | frame4, frame5) and (frame2, frame3 | frame6, frame7) */
+      f01 = avx2_floattos16(r0, r1);
+      f23 = avx2_floattos16(r2, r3);
+      lo = _mm256_castsi256_si128(f01); hi = _mm256_extracti128_si256(f01, 1);
+      _mm_storel_epi64((__m128i*)(out             ), lo);
+      _mm_storel_epi64((__m128i*)(out +   channels), _mm_srli_si128(lo, 8));
+      _mm_storel_epi64((__m128i*)(out + 4*channels), hi);
+      _mm_storel_epi64((__m128i*)(out + 5*channels), _mm_srli_si128(hi, 8));
+      lo = _mm256_castsi256_si128(f23); hi = _mm256_extracti128_si256(f23, 1);
+      _mm_storel_epi64((__m128i*)(out + 2*channels), lo);
+      _mm_storel_epi64((__m128i*)(out + 3*channels), _mm_srli_si128(lo, 8));
+      _mm_storel_epi64((__m128i*)(out + 6*channels), hi);
+      _mm_storel_epi64((__m128i*)(out + 7*channels), _mm_srli_si128(hi, 8));
+    }
+    i = frames - frames % 8;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = float2s16(src[k + frames*j]);
+  }
+  reinterleaveS16_from(src, dst, frames, channels, i);
+}
+
+static const sample_kernels_t sample_kernels_avx2 = {
+  "avx2",
+  deinterleaveFLOAT_avx2,
+  reinterleaveFLOAT_avx2,
+  deinterleaveS16_avx2,
+  reinterleaveS16_avx2,
+  SCALAR_WIDE_KERNELS,
+};
+#endif /* HAVE_X86_KERNELS */
+
+/* ------------------------------------------------------------------ */
+/* ARM: NEON */
+#ifdef HAVE_NEON_KERNELS
+
+static inline float32x4_t neon_s16tofloat(int16x4_t v)
+{
+  return vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(v)), S16_SCALE_IN);
+}
+/* the conversion to int32 and the narrowing both saturate */
+static inline int16x4_t neon_floattos16(float32x4_t v)
+{
+  int16x4_t s = vqmovn_s32(vcvtq_s32_f32(vmulq_n_f32(v, S16_SCALE_OUT)));
+  return vmax_s16(s, vdup_n_s16(-32767));
+}
+# define NEON_TRANSPOSE4(r0, r1, r2, r3) do {                              \
+    float32x4x2_t t01 = vtrnq_f32(r0, r1);                                 \
+    float32x4x2_t t23 = vtrnq_f32(r2, r3);                                 \
+    r0 = vcombine_f32(vget_low_f32 (t01.val[0]), vget_low_f32 (t23.val[0])); \
+    r1 = vcombine_f32(vget_low_f32 (t01.val[1]), vget_low_f32 (t23.val[1])); \
+    r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])); \
+    r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])); \
+  } while(0)
+
+static void deinterleaveFLOAT_neon(void *src_, float *dst, int frames, int channels)
+{
+  const float *src = (const float*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      vst1q_f32(dst + i, vld1q_f32(src + i));
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 4 <= frames; i += 4) {
+      float32x4x2_t v = vld2q_f32(src + 2*i);
+      vst1q_f32(dst  + i, v.val[0]);
+      vst1q_f32(dst1 + i, v.val[1]);
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      float32x4_t r0 = vld1q_f32(in);
+      float32x4_t r1 = vld1q_f32(in +   channels);
+      float32x4_t r2 = vld1q_f32(in + 2*channels);
+      float32x4_t r3 = vld1q_f32(in + 3*channels);
+      NEON_TRANSPOSE4(r0, r1, r2, r3);
+      vst1q_f32(out           , r0);
+      vst1q_f32(out +   frames, r1);
+      vst1q_f32(out + 2*frames, r2);
+      vst1q_f32(out + 3*frames, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j];
+  }
+  deinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static void reinterleaveFLOAT_neon(float *src, void *dst_, int frames, int channels)
+{
+  float *dst = (float*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      vst1q_f32(dst + i, vld1q_f32(src + i));
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 4 <= frames; i += 4) {
+      float32x4x2_t v;
+      v.val[0] = vld1q_f32(src  + i);
+      v.val[1] = vld1q_f32(src1 + i);
+      vst2q_f32(dst + 2*i, v);
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + j*frames + i;
+      float *out = dst + i*channels + j;
+      float32x4_t r0 = vld1q_f32(in);
+      float32x4_t r1 = vld1q_f32(in +   frames);
+      float32x4_t r2 = vld1q_f32(in + 2*frames);
+      float32x4_t r3 = vld1q_f32(in + 3*frames);
+      NEON_TRANSPOSE4(r0, r1, r2, r3);
+      vst1q_f32(out             , r0);
+      vst1q_f32(out +   channels, r1);
+      vst1q_f32(out + 2*channels, r2);
+      vst1q_f32(out + 3*channels, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = src[k + frames*j];
+  }
+  reinterleaveFLOAT_from(src, dst, frames, channels, i);
+}
+static void deinterleaveS16_neon(void *src_, float *dst, int frames, int channels)
+{
+  const signed short *src = (const signed short*)src_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      vst1q_f32(dst + i, neon_s16tofloat(vld1_s16(src + i)));
+  } else if(2 == channels) {
+    float *dst1 = dst + frames;
+    for(; i + 4 <= frames; i += 4) {
+      int16x4x2_t v = vld2_s16(src + 2*i);
+      vst1q_f32(dst  + i, neon_s16tofloat(v.val[0]));
+      vst1q_f32(dst1 + i, neon_s16tofloat(v.val[1]));
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const signed short *in = src + i*channels + j;
+      float *out = dst + j*frames + i;
+      float32x4_t r0 = neon_s16tofloat(vld1_s16(in));
+      float32x4_t r1 = neon_s16tofloat(vld1_s16(in +   channels));
+      float32x4_t r2 = neon_s16tofloat(vld1_s16(in + 2*channels));
+      float32x4_t r3 = neon_s16tofloat(vld1_s16(in + 3*channels));
+      NEON_TRANSPOSE4(r0, r1, r2, r3);
+      vst1q_f32(out           , r0);
+      vst1q_f32(out +   frames, r1);
+      vst1q_f32(out + 2*frames, r2);
+      vst1q_f32(out + 3*frames, r3);
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k + frames*j] = src[k*channels + j] * S16_SCALE_IN;
+  }
+  deinterleaveS16_from(src, dst, frames, channels, i);
+}
+static void reinterleaveS16_neon(float *src, void *dst_, int frames, int channels)
+{
+  signed short *dst = (signed short*)dst_;
+  int i = 0, j, k, ib, jb;
+  if(1 == channels) {
+    for(; i + 4 <= frames; i += 4)
+      vst1_s16(dst + i, neon_floattos16(vld1q_f32(src + i)));
+  } else if(2 == channels) {
+    const float *src1 = src + frames;
+    for(; i + 4 <= frames; i += 4) {
+      int16x4x2_t v;
+      v.val[0] = neon_floattos16(vld1q_f32(src  + i));
+      v.val[1] = neon_floattos16(vld1q_f32(src1 + i));
+      vst2_s16(dst + 2*i, v);
+    }
+  } else {
+    FOREACH_SUBTILE(ib, jb, i, j, frames, channels, 4) {
+      const float *in = src + j*frames + i;
+      signed short *out = dst + i*channels + j;
+      float32x4_t r0 = vld1q_f32(in);
+      float32x4_t r1 = vld1q_f32(in +   frames);
+      float32x4_t r2 = vld1q_f32(in + 2*frames);
+      float32x4_t r3 = vld1q_f32(in + 3*frames);
+      NEON_TRANSPOSE4(r0, r1, r2, r3);
+      vst1_s16(out             , neon_floattos16(r0));
+      vst1_s16(out +   channels, neon_floattos16(r1));
+      vst1_s16(out + 2*channels, neon_floattos16(r2));
+      vst1_s16(out + 3*channels, neon_floattos16(r3));
+    }
+    i = frames - frames % 4;
+    for(j = channels & ~3; j < channels; j++)
+      for(k = 0; k < i; k++)
+        dst[k*channels + j] = float2s16(src[k + frames*j]);
+  }
+  reinterleaveS16_from(src, dst, frames, channels, i);
+}
+
+static const sample_kernels_t sample_kernels_neon = {
+  "neon",
+  deinterleaveFLOAT_neon,
+  reinterleaveFLOAT_neon,
+  deinterleaveS16_neon,
+  reinterleaveS16_neon,
+  SCALAR_WIDE_KERNELS,
+};
+#endif /* HAVE_NEON_KERNELS */
+
+/* ------------------------------------------------------------------ */
+/* runtime dispatch */
+
+static const sample_kernels_t *s_kernels_list[4] = { &sample_kernels_scalar, NULL };
+static const sample_kernels_t *s_kernels = &sample_kernels_scalar;
+
+static void sample_kernels_init(void) __attribute__((constructor));
+static void sample_kernels_init(void)
+{
+  unsigned int count = 0;
+  s_kernels_list[count++] = &sample_kernels_scalar;
+
+#ifdef HAVE_X86_KERNELS
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2"))
+    s_kernels_list[count++] = &sample_kernels_sse2;
+  if(__builtin_cpu_supports("avx2"))
+    s_kernels_list[count++] = &sample_kernels_avx2;
+#endif
+#ifdef HAVE_NEON_KERNELS
+# if defined(__aarch64__)
+  s_kernels_list[count++] = &sample_kernels_neon;
+# else
+  if(getauxval(AT_HWCAP) & HWCAP_NEON)
+    s_kernels_list[count++] = &sample_kernels_neon;
+# endif
+#endif
+
+  s_kernels_list[count] = NULL;
+  s_kernels = s_kernels_list[count - 1];
+}
+
+const sample_kernels_t *sample_kernels(void)
+{
+  return s_kernels;
+}
+const sample_kernels_t * const *sample_kernels_list(void)
+{
+  return s_kernels_list;
+}
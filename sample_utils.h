@@ -0,0 +1,67 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IEMLADSPA_SAMPLE_UTILS_H
+#define IEMLADSPA_SAMPLE_UTILS_H
+
+/* (de)interleaving kernels
+ *
+ * 'deinterleave' converts <frames> interleaved frames of <channels> samples
+ * into <channels> planar FLOAT channels of <frames> samples each
+ * (channel j starts at dst+j*frames); 'reinterleave' does the reverse.
+ *
+ * every kernel exists as a plain scalar reference implementation, and
+ * (depending on the architecture) as vectorized versions.
+ * the best set of kernels for the running CPU is picked once, when the
+ * library is loaded.
+ */
+
+typedef void reinterleave_fun_t(float *src, void *dst_, int frames, int channels);
+typedef void deinterleave_fun_t(void *src_, float *dst, int frames, int channels);
+
+typedef struct _sample_kernels {
+  const char *name;
+
+  deinterleave_fun_t *deinterleaveFLOAT;
+  reinterleave_fun_t *reinterleaveFLOAT;
+  deinterleave_fun_t *deinterleaveS16;
+  reinterleave_fun_t *reinterleaveS16;
+
+  deinterleave_fun_t *deinterleaveS24;
+  reinterleave_fun_t *reinterleaveS24;
+  deinterleave_fun_t *deinterleaveS24_3LE;
+  reinterleave_fun_t *reinterleaveS24_3LE;
+  deinterleave_fun_t *deinterleaveS32;
+  reinterleave_fun_t *reinterleaveS32;
+  deinterleave_fun_t *deinterleaveFLOAT64;
+  reinterleave_fun_t *reinterleaveFLOAT64;
+} sample_kernels_t;
+
+/* the scalar reference kernels */
+extern const sample_kernels_t sample_kernels_scalar;
+
+/* the fastest kernels supported by the running CPU */
+const sample_kernels_t *sample_kernels(void);
+
+/* NULL-terminated list of all kernels supported by the running CPU
+ * (the scalar reference is always the first entry) */
+const sample_kernels_t * const *sample_kernels_list(void);
+
+#endif /* IEMLADSPA_SAMPLE_UTILS_H */
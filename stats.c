@@ -0,0 +1,238 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/* timing statistics of the transfers (see stats.h) */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+#define STATS_SUFFIX ".stats"
+#define STATS_TRIES 100 /* how often a reader retries to get a consistent copy (or a set-up segment) */
+
+char *stats_name(const char *controls) {
+  /* relative names live in the same place as the controls files (see LADSPAcontrolFilename()) */
+  const char *home = "", *subdir = "", *base, *c;
+  unsigned int hash = 2166136261u; /* FNV-1a (of the controls file's full path) */
+  char *name;
+  if(controls[0] != '/') {
+    home = getenv("HOME");
+    if(!home)
+      return NULL;
+    subdir = "/.config/ladspa.iem.at/";
+  }
+  for(c = home; *c; c++)
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  for(c = subdir; *c; c++)
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  for(c = controls; *c; c++)
+    hash = (hash ^ (unsigned char)*c) * 16777619u;
+  base = strrchr(controls, '/');
+  name = malloc(128);
+  if(name)
+    snprintf(name, 128, "/iemladspa.%.64s.%08x" STATS_SUFFIX, base?base+1:controls, hash);
+  return name;
+}
+
+stats_t *stats_map(const char *name, int writer) {
+  stats_t *stats;
+  struct stat st;
+  unsigned int tries;
+  int created = 0, fd = -1;
+  if(writer) {
+    /* whoever creates the segment sets it up */
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0664);
+    created = (fd >= 0);
+    if(fd < 0 && EEXIST == errno)
+      fd = shm_open(name, O_RDWR, 0);
+  } else {
+    fd = shm_open(name, O_RDONLY, 0);
+  }
+  if(fd < 0)
+    return NULL;
+  if(fstat(fd, &st) < 0) {
+    close(fd);
+    return NULL;
+  }
+  if((size_t)st.st_size < sizeof(stats_t)) {
+    if(!writer || ftruncate(fd, sizeof(stats_t)) < 0) {
+      close(fd);
+      return NULL;
+    }
+  }
+  stats = (stats_t*)mmap(NULL, sizeof(stats_t), writer?(PROT_READ | PROT_WRITE):PROT_READ,
+                         MAP_SHARED, fd, 0);
+  close(fd);
+  if(MAP_FAILED == stats)
+    return NULL;
+
+  /* (give whoever just created it the time to set it up) */
+  for(tries = 0; !created && tries < STATS_TRIES; tries++) {
+    if(__atomic_load_n(&stats->magic, __ATOMIC_ACQUIRE) == STATS_MAGIC)
+      break;
+    usleep(1000);
+  }
+  if(stats->magic == STATS_MAGIC && stats->version == STATS_VERSION)
+    return stats;
+  if(!writer) {
+    stats_unmap(stats);
+    return NULL;
+  }
+  /* a fresh (or outdated) segment */
+  memset(stats, 0, sizeof(stats_t));
+  stats->version = STATS_VERSION;
+  __atomic_store_n(&stats->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+  return stats;
+}
+
+int stats_unlink(const char *name) {
+  return shm_unlink(name);
+}
+
+void stats_unmap(stats_t *stats) {
+  if(stats)
+    munmap(stats, sizeof(stats_t));
+}
+
+uint64_t stats_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* the record is inconsistent from stats_begin() to stats_end() */
+static void stats_begin(stats_stream_t *s) {
+  __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+static void stats_end(stats_stream_t *s) {
+  __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELEASE);
+}
+
+/* become the (only) writer of a record; 0 if somebody else is */
+static int stats_claim(stats_stream_t *s) {
+  const uint32_t self = (uint32_t)getpid();
+  uint32_t writer = 0;
+  if(__atomic_compare_exchange_n(&s->writer, &writer, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 1;
+  /* a writer that is gone (e.g. it crashed) doesn't count
+   * (but another PCM of our own process does) */
+  if(writer == self || kill((pid_t)writer, 0) == 0 || ESRCH != errno)
+    return 0;
+  if(!__atomic_compare_exchange_n(&s->writer, &writer, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+  /* (it might have died in the middle of an update) */
+  if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) & 1)
+    stats_end(s);
+  return 1;
+}
+static void stats_release(stats_stream_t *s) {
+  uint32_t self = (uint32_t)getpid();
+  __atomic_compare_exchange_n(&s->writer, &self, 0, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+int stats_read(const stats_t *stats, unsigned int stream, stats_stream_t *copy) {
+  const stats_stream_t *s = &stats->stream[stream];
+  unsigned int tries;
+  for(tries = 0; tries < STATS_TRIES; tries++) {
+    const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1) {
+      sched_yield();
+      continue;
+    }
+    memcpy(copy, s, sizeof(*copy));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq)
+      return 1;
+  }
+  return 0;
+}
+
+void stats_meter_config(stats_meter_t *meter, stats_stream_t *shared,
+                        unsigned int rate, unsigned long period) {
+  stats_stream_t *claimed = meter->shared;
+  if(claimed && claimed != shared)
+    stats_release(claimed);
+  memset(meter, 0, sizeof(*meter));
+  if(!shared || (claimed != shared && !stats_claim(shared)))
+    return;
+  meter->shared = shared;
+  stats_begin(shared);
+  memset(&shared->rate, 0, sizeof(*shared) - offsetof(stats_stream_t, rate));
+  shared->rate = rate;
+  shared->period = period;
+  stats_end(shared);
+}
+
+void stats_meter_close(stats_meter_t *meter) {
+  if(!meter->shared)
+    return;
+  stats_begin(meter->shared);
+  meter->shared->load = 0;
+  stats_end(meter->shared);
+  stats_release(meter->shared);
+  meter->shared = NULL;
+}
+
+void stats_meter_stop(stats_meter_t *meter, unsigned long frames) {
+  stats_stream_t *s = meter->shared;
+  uint64_t busy;
+  unsigned int k, bucket;
+  if(!s)
+    return;
+  busy = meter->lap - meter->start;
+  bucket = 63 - __builtin_clzll(busy | 1);
+  if(bucket >= STATS_BUCKETS)
+    bucket = STATS_BUCKETS - 1;
+  meter->period_busy += busy;
+  meter->period_frames += frames;
+
+  stats_begin(s);
+  s->transfers++;
+  s->frames += frames;
+  s->busy += busy;
+  for(k = 0; k < STATS_PHASES; k++) {
+    s->phase[k] += meter->phase[k];
+    meter->phase[k] = 0;
+  }
+  s->histogram[bucket]++;
+  if(meter->period_frames >= s->period && s->rate) {
+    /* the time spent on the period (by whoever took longer), against its duration */
+    const uint64_t duration = meter->period_frames * 1000000000ULL / s->rate;
+    const uint64_t offload = __atomic_exchange_n(&meter->offload, 0, __ATOMIC_RELAXED);
+    const uint64_t spent = (offload > meter->period_busy)?offload:meter->period_busy;
+    s->load = duration?(uint32_t)(spent * 1000 / duration):0;
+    if(s->load > s->load_max)
+      s->load_max = s->load;
+    meter->period_busy = meter->period_frames = 0;
+  }
+  stats_end(s);
+}
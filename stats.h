@@ -0,0 +1,129 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IEMLADSPA_STATS_H
+#define IEMLADSPA_STATS_H
+
+/* timing statistics of the transfers
+ *
+ * the PCM times the phases of each transfer, and publishes the totals in
+ * a small POSIX shared memory segment (so publishing them never causes any
+ * writeback to the disk) that is mmapped by everybody who wants to have a look
+ * (the mixer device, iemladspa-stat).
+ * there is a single writer per stream (the first PCM to claim it; other PCMs
+ * that use the same controls file don't collect), which never waits for the
+ * readers: each stream's record is guarded by a sequence counter, which is odd
+ * while the record is being updated; readers simply retry until they get a
+ * consistent copy.
+ * all counters only ever increase (until the PCM is set up anew),
+ * so readers can take the difference between two copies.
+ */
+
+#include <stdint.h>
+
+#define STATS_MAGIC 0x54534c49  /* "ILST" */
+#define STATS_VERSION 2
+#define STATS_BUCKETS 32        /* histogram of the transfer times: [2^k, 2^(k+1)) ns */
+
+/* the phases of a transfer */
+enum {
+  STATS_DEINTERLEAVE,
+  STATS_MUTE,          /* silencing unused inputs, and the silence gate */
+  STATS_RUN,           /* running the plugins (or exchanging data with the worker thread) */
+  STATS_REINTERLEAVE,
+  STATS_PHASES
+};
+
+typedef struct _stats_stream {
+  uint32_t seq;                /* odd while the record is being updated */
+  uint32_t writer;             /* the process that has claimed the record (0: nobody) */
+  uint32_t rate;               /* frames per second */
+  uint64_t period;             /* frames per period */
+  uint64_t transfers;
+  uint64_t frames;
+  uint64_t busy;               /* ns spent in the transfers */
+  uint64_t phase[STATS_PHASES];/* the same, by phase */
+  uint32_t load;               /* time spent on the last period, in 1/1000 of its duration
+                                * (by the transfers, or by the worker thread if that took longer) */
+  uint32_t load_max;           /* the highest load so far */
+  uint64_t histogram[STATS_BUCKETS];
+} stats_stream_t;
+
+typedef struct _stats {
+  uint32_t magic;
+  uint32_t version;
+  stats_stream_t stream[2];    /* playback, capture */
+} stats_t;
+
+/* where the writer keeps track of the current transfer and period */
+typedef struct _stats_meter {
+  stats_stream_t *shared;      /* NULL: not collecting (the record is claimed while we do) */
+  uint64_t start, lap;
+  uint64_t phase[STATS_PHASES];
+  uint64_t period_busy;        /* ns spent on the current period so far */
+  uint64_t period_frames;      /* frames of the current period so far */
+  uint64_t offload;            /* ns spent on the current period by another thread */
+} stats_meter_t;
+
+/* the name of the shared memory (see shm_open()) of the statistics that go with
+ * the controls file <controls> (resolved the same way); returns a malloc()ed string */
+char *stats_name(const char *controls);
+
+/* map the statistics; only the writer (the PCM) creates them */
+stats_t *stats_map(const char *name, int writer);
+void stats_unmap(stats_t *stats);
+/* remove the statistics (they stay mapped for whoever has them); -1 on failure */
+int stats_unlink(const char *name);
+
+/* get a consistent copy of a stream's record (0 if the writer is too busy) */
+int stats_read(const stats_t *stats, unsigned int stream, stats_stream_t *copy);
+
+/* start collecting into <shared> (NULL: stop) for periods of <period> frames at <rate>
+ * (unless somebody else has claimed <shared>: then we don't collect) */
+void stats_meter_config(stats_meter_t *meter, stats_stream_t *shared,
+                        unsigned int rate, unsigned long period);
+/* the stream is closed: its load drops to 0 */
+void stats_meter_close(stats_meter_t *meter);
+
+uint64_t stats_now(void);
+
+/* a transfer starts */
+static inline void stats_meter_start(stats_meter_t *meter) {
+  if(meter->shared)
+    meter->start = meter->lap = stats_now();
+}
+/* the transfer has finished <phase> */
+static inline void stats_meter_lap(stats_meter_t *meter, unsigned int phase) {
+  uint64_t now;
+  if(!meter->shared)
+    return;
+  now = stats_now();
+  meter->phase[phase] += now - meter->lap;
+  meter->lap = now;
+}
+/* <ns> were spent on the stream's work by another thread (the worker running
+ * the plugins); the only thing that may be called from that thread */
+static inline void stats_meter_offload(stats_meter_t *meter, uint64_t ns) {
+  __atomic_add_fetch(&meter->offload, ns, __ATOMIC_RELAXED);
+}
+/* the transfer of <frames> frames is done: publish it */
+void stats_meter_stop(stats_meter_t *meter, unsigned long frames);
+
+#endif /* IEMLADSPA_STATS_H */
@@ -0,0 +1,316 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* work-stealing thread pool
+ *
+ * the deques are Chase-Lev deques (as described by Lê, Pop, Cohen and
+ * Zappa Nardelli: "Correct and Efficient Work-Stealing for Weak Memory
+ * Models"), with a fixed capacity.
+ * all deques live in a static table, so a thread that is stealing from a
+ * deque that is just being returned never touches freed memory.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "workpool.h"
+
+#define WORKPOOL_CAPACITY 256 /* tasks per deque (a power of two) */
+#define WORKPOOL_DEQUES 64    /* pool threads + users */
+#define WORKPOOL_SPIN 64      /* how often an idle thread looks for work before sleeping */
+#define WORKPOOL_WAITING 0x80000000u /* (in a 'remaining' counter) somebody sleeps until it is 0 */
+
+struct _workpool_deque {
+  long top __attribute__((aligned(64)));
+  long bottom __attribute__((aligned(64)));
+  workpool_task_t *tasks[WORKPOOL_CAPACITY];
+  int used;
+};
+
+typedef struct _workpool {
+  pthread_mutex_t mutex;
+  unsigned int users;
+  unsigned int num_threads;
+  pthread_t threads[WORKPOOL_DEQUES];
+  int stop;
+  unsigned int sleeping;
+  sem_t wakeup;
+  unsigned int num_deques; /* number of table entries ever used */
+  workpool_deque_t deques[WORKPOOL_DEQUES];
+} workpool_t;
+
+static workpool_t s_pool = {
+  .mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+/* tell the CPU we are spinning (unlike sched_yield(), which doesn't give way
+ * to anything of a lower priority when running SCHED_FIFO) */
+static inline void workpool_pause(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  __asm__ __volatile__("yield");
+#endif
+}
+
+static workpool_task_t *deque_take(workpool_deque_t *deque) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+  long t;
+  workpool_task_t *task = NULL;
+  __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+  if(t <= b) {
+    task = __atomic_load_n(&deque->tasks[b & (WORKPOOL_CAPACITY - 1)], __ATOMIC_RELAXED);
+    if(t == b) {
+      /* the last task: race against the thieves */
+      if(!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        task = NULL;
+      __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+  } else {
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return task;
+}
+
+static workpool_task_t *deque_steal(workpool_deque_t *deque) {
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  long b;
+  workpool_task_t *task = NULL;
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+  if(t < b) {
+    task = __atomic_load_n(&deque->tasks[t & (WORKPOOL_CAPACITY - 1)], __ATOMIC_RELAXED);
+    if(!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+      return NULL;
+  }
+  return task;
+}
+
+/* steal a task from any deque but our own */
+static workpool_task_t *workpool_steal(workpool_deque_t *self) {
+  const unsigned int count = __atomic_load_n(&s_pool.num_deques, __ATOMIC_ACQUIRE);
+  unsigned int i;
+  for(i = 0; i < count; i++) {
+    workpool_deque_t *deque = &s_pool.deques[i];
+    workpool_task_t *task;
+    if(deque == self)
+      continue;
+    task = deque_steal(deque);
+    if(task)
+      return task;
+  }
+  return NULL;
+}
+
+static void *workpool_thread(void *data) {
+  workpool_deque_t *deque = (workpool_deque_t *)data;
+  unsigned int idle = 0;
+  while(!__atomic_load_n(&s_pool.stop, __ATOMIC_ACQUIRE)) {
+    workpool_task_t *task = deque_take(deque);
+    if(!task)
+      task = workpool_steal(deque);
+    if(task) {
+      task->run(task, deque);
+      idle = 0;
+      continue;
+    }
+    if(++idle < WORKPOOL_SPIN) {
+      workpool_pause();
+      continue;
+    }
+    /* nothing to do: go to sleep until somebody pushes new work */
+    __atomic_add_fetch(&s_pool.sleeping, 1, __ATOMIC_SEQ_CST);
+    task = workpool_steal(deque);
+    if(task) {
+      __atomic_sub_fetch(&s_pool.sleeping, 1, __ATOMIC_SEQ_CST);
+      task->run(task, deque);
+      idle = 0;
+      continue;
+    }
+    sem_wait(&s_pool.wakeup);
+    __atomic_sub_fetch(&s_pool.sleeping, 1, __ATOMIC_SEQ_CST);
+    idle = 0;
+  }
+  return NULL;
+}
+
+static workpool_deque_t *deque_get_locked(void) {
+  unsigned int i;
+  for(i = 0; i < WORKPOOL_DEQUES; i++) {
+    workpool_deque_t *deque = &s_pool.deques[i];
+    if(deque->used)
+      continue;
+    deque->used = 1;
+    deque->top = deque->bottom = 0;
+    if(i >= s_pool.num_deques)
+      __atomic_store_n(&s_pool.num_deques, i + 1, __ATOMIC_RELEASE);
+    return deque;
+  }
+  return NULL;
+}
+
+static void workpool_stop_locked(void) {
+  unsigned int i;
+  __atomic_store_n(&s_pool.stop, 1, __ATOMIC_RELEASE);
+  for(i = 0; i < s_pool.num_threads; i++)
+    sem_post(&s_pool.wakeup);
+  for(i = 0; i < s_pool.num_threads; i++) {
+    pthread_join(s_pool.threads[i], NULL);
+    s_pool.deques[i].used = 0;
+  }
+  s_pool.num_threads = 0;
+  sem_destroy(&s_pool.wakeup);
+}
+
+int workpool_acquire(unsigned int threads, int priority) {
+  int err = 0;
+  unsigned int i;
+  pthread_mutex_lock(&s_pool.mutex);
+  if(s_pool.users++) {
+    pthread_mutex_unlock(&s_pool.mutex);
+    return 0;
+  }
+  if(threads > WORKPOOL_DEQUES / 2)
+    threads = WORKPOOL_DEQUES / 2;
+  s_pool.stop = 0;
+  s_pool.sleeping = 0;
+  if(sem_init(&s_pool.wakeup, 0, 0)) {
+    s_pool.users--;
+    pthread_mutex_unlock(&s_pool.mutex);
+    return -errno;
+  }
+  for(i = 0; i < threads; i++) {
+    workpool_deque_t *deque = deque_get_locked();
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if(priority > 0) {
+      struct sched_param param;
+      param.sched_priority = priority;
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      pthread_attr_setschedparam(&attr, &param);
+    }
+    err = pthread_create(&s_pool.threads[i], &attr, workpool_thread, deque);
+    if(err == EPERM) {
+      /* not allowed to use realtime scheduling: run the thread anyhow */
+      pthread_attr_destroy(&attr);
+      pthread_attr_init(&attr);
+      err = pthread_create(&s_pool.threads[i], &attr, workpool_thread, deque);
+    }
+    pthread_attr_destroy(&attr);
+    if(err) {
+      deque->used = 0;
+      break;
+    }
+    s_pool.num_threads++;
+  }
+  if(err) {
+    workpool_stop_locked();
+    s_pool.users--;
+  }
+  pthread_mutex_unlock(&s_pool.mutex);
+  return -err;
+}
+
+void workpool_release(void) {
+  pthread_mutex_lock(&s_pool.mutex);
+  if(s_pool.users && !--s_pool.users)
+    workpool_stop_locked();
+  pthread_mutex_unlock(&s_pool.mutex);
+}
+
+workpool_deque_t *workpool_deque_get(void) {
+  workpool_deque_t *deque;
+  pthread_mutex_lock(&s_pool.mutex);
+  deque = deque_get_locked();
+  pthread_mutex_unlock(&s_pool.mutex);
+  return deque;
+}
+
+void workpool_deque_put(workpool_deque_t *deque) {
+  if(!deque)
+    return;
+  pthread_mutex_lock(&s_pool.mutex);
+  deque->used = 0;
+  pthread_mutex_unlock(&s_pool.mutex);
+}
+
+int workpool_push(workpool_deque_t *deque, workpool_task_t *task) {
+  long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+  long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+  if(b - t >= WORKPOOL_CAPACITY)
+    return 0;
+  __atomic_store_n(&deque->tasks[b & (WORKPOOL_CAPACITY - 1)], task, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+void workpool_wake(unsigned int count) {
+  unsigned int sleeping;
+  /* the tasks were published by a (relaxed) store to 'bottom':
+   * order it before the load, or a thread that is just going to sleep
+   * might miss the tasks while we miss that it sleeps */
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  sleeping = __atomic_load_n(&s_pool.sleeping, __ATOMIC_SEQ_CST);
+  if(count > sleeping)
+    count = sleeping;
+  while(count--)
+    sem_post(&s_pool.wakeup);
+}
+
+void workpool_done(unsigned int *remaining) {
+  if(WORKPOOL_WAITING == __atomic_sub_fetch(remaining, 1, __ATOMIC_RELEASE))
+    syscall(SYS_futex, remaining, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void workpool_help(workpool_deque_t *deque, unsigned int *remaining) {
+  unsigned int idle = 0, left;
+  while((left = __atomic_load_n(remaining, __ATOMIC_ACQUIRE) & ~WORKPOOL_WAITING)) {
+    workpool_task_t *task = deque_take(deque);
+    if(!task)
+      task = workpool_steal(deque);
+    if(task) {
+      task->run(task, deque);
+      idle = 0;
+      continue;
+    }
+    if(++idle < WORKPOOL_SPIN) {
+      workpool_pause();
+      continue;
+    }
+    /* nothing left to steal: the rest is being run by others, so rather than
+     * spinning (possibly at a higher priority than they run at), sleep until
+     * the last of them is done (tasks that become ready meanwhile are queued
+     * by whoever runs their dependencies, who also wakes up the pool for them) */
+    if(__atomic_compare_exchange_n(remaining, &left, left | WORKPOOL_WAITING, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+      syscall(SYS_futex, remaining, FUTEX_WAIT_PRIVATE, left | WORKPOOL_WAITING, NULL, NULL, 0);
+    idle = 0;
+  }
+}
@@ -0,0 +1,73 @@
+/*
+ * alsa-ladspa-bridge: use LADSPA-plugins as ALSA-plugins
+ *
+ * Copyright (c) 2013 IOhannes m zmölnig - IEM
+ *		<zmoelnig@iem.at>
+ *
+ * This library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 2.1 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IEMLADSPA_WORKPOOL_H
+#define IEMLADSPA_WORKPOOL_H
+
+/* work-stealing thread pool
+ *
+ * there is a single pool per process, shared by all its users.
+ * every pool thread has a deque of tasks; a user that wants to run
+ * tasks on the pool gets a deque of its own, pushes its tasks onto it,
+ * and then helps running tasks until its work is done.
+ * idle threads steal tasks from the other deques.
+ *
+ * a task may push new tasks (e.g. its dependents, once they become ready)
+ * onto the deque it is run from.
+ * nothing in here allocates memory or takes locks, except for
+ * workpool_acquire(), workpool_release(), workpool_deque_get() and
+ * workpool_deque_put().
+ * a thread with nothing left to take sleeps on a futex (never on a lock),
+ * so waiting for a lower-priority thread doesn't starve it.
+ */
+
+typedef struct _workpool_deque workpool_deque_t;
+
+typedef struct _workpool_task {
+  void (*run)(struct _workpool_task *task, workpool_deque_t *deque);
+} workpool_task_t;
+
+/* start using the pool; the first user starts <threads> threads
+ * (scheduled SCHED_FIFO at <priority> if permitted and <priority> is >0) */
+int workpool_acquire(unsigned int threads, int priority);
+/* stop using the pool; the threads are stopped once the last user is gone */
+void workpool_release(void);
+
+/* get/return a deque to push tasks onto (NULL if there are none left) */
+workpool_deque_t *workpool_deque_get(void);
+void workpool_deque_put(workpool_deque_t *deque);
+
+/* queue <task> on <deque> (only ever called by the deque's owner)
+ * returns 0 if the deque is full */
+int workpool_push(workpool_deque_t *deque, workpool_task_t *task);
+
+/* wake up to <count> idle threads */
+void workpool_wake(unsigned int count);
+
+/* a task of a batch (counted by *<remaining>) is done: count it off
+ * (and wake up whoever is waiting for the batch in workpool_help()) */
+void workpool_done(unsigned int *remaining);
+
+/* run tasks (own ones first, then stolen ones) until *<remaining> is 0
+ * (as counted off by workpool_done()); once there is nothing left to steal,
+ * sleep until the last task is done */
+void workpool_help(workpool_deque_t *deque, unsigned int *remaining);
+
+#endif /* IEMLADSPA_WORKPOOL_H */